@@ -118,6 +118,12 @@ void compiler_test() {
     std::cout << std::endl;
 
     interpreter.interpret();
+
+    std::cout << std::endl;
+    std::cout << "Decoded code after running:";
+    std::cout << std::endl;
+
+    decompiler.dump_decoded(interpreter.get_unit_code(*unit));
 }
 
 int main() {
@@ -22,6 +22,7 @@
 
 #include <snack/token.h>
 
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <unordered_map>
@@ -47,6 +48,7 @@ namespace snack {
         function,
         function_call,
         ret,
+        yield,
         null,
         unit_ref,
         if_else,
@@ -126,12 +128,19 @@ namespace snack {
         const std::string &get_string() const;
     };
 
+    // Literals without a dot are integers, the rest are doubles
     class number_node : public node {
         long double val;
+        int64_t int_val;
+        bool integer;
 
     public:
         number_node(node_ptr parent, const long double val);
+        number_node(node_ptr parent, const int64_t val);
+
         const long double get_value() const;
+        const int64_t get_integer() const;
+        bool is_integer() const;
     };
 
     class stmt_node : public node {
@@ -162,6 +171,7 @@ namespace snack {
 
     class unit_node : public stmt_node {
         std::unordered_map<long double, std::shared_ptr<number_node>> numbers;
+        std::unordered_map<int64_t, std::shared_ptr<number_node>> integers;
         std::unordered_map<std::string, std::shared_ptr<string_node>> strings;
 
         std::vector<std::shared_ptr<unit_reference_node>> unit_refs;
@@ -175,6 +185,10 @@ namespace snack {
             return numbers;
         }
 
+        std::unordered_map<int64_t, std::shared_ptr<number_node>> &get_integer_map() {
+            return integers;
+        }
+
         std::unordered_map<std::string, std::shared_ptr<string_node>> &get_string_map() {
             return strings;
         }
@@ -451,4 +465,16 @@ namespace snack {
             return result;
         }
     };
+
+    class yield_node : public stmt_node {
+        node_ptr result;
+        friend class parser;
+
+    public:
+        yield_node(node_ptr parent, token tok);
+
+        node_ptr get_result() {
+            return result;
+        }
+    };
 }
\ No newline at end of file
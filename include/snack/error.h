@@ -81,7 +81,7 @@ namespace snack {
         std::map<int, error> errors;
         std::atomic<int> error_id_counter;
 
-        size_t actual_error = 0;
+        std::atomic<size_t> actual_error{ 0 };
 
         std::mutex mut;
 
@@ -114,6 +114,9 @@ namespace snack {
         bool error_out(int error_id);
         bool dump_all_error();
 
+        /*! \brief Move every error of another manager here, in the order they were thrown. */
+        void merge(error_manager &from);
+
         size_t get_total_error();
     };
 }
\ No newline at end of file
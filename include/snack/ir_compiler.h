@@ -6,6 +6,7 @@
 #include <snack/unit_manager.h>
 
 #include <memory>
+#include <optional>
 #include <sstream>
 #include <unordered_map>
 
@@ -20,10 +21,39 @@ namespace snack::ir::backend {
         std::vector<ir_op_info> opcodes;
 
         size_t crr_pc;
+
+        // Operand stack depth at the current emit position, and the deepest it goes
+        size_t stack_depth;
+        size_t max_stack_depth;
+    };
+
+    /*! \brief A number constant as the data section stores it: i64data or f64data, by payload bits. */
+    struct ir_number_constant {
+        bool integer;
+        uint64_t bits;
+
+        static ir_number_constant of_integer(const int64_t val);
+        static ir_number_constant of_node(const number_node &node);
+
+        bool operator==(const ir_number_constant &rhs) const {
+            return integer == rhs.integer && bits == rhs.bits;
+        }
+    };
+
+    struct ir_number_constant_hash {
+        size_t operator()(const ir_number_constant &val) const {
+            return std::hash<uint64_t>()(val.bits) ^ static_cast<size_t>(val.integer);
+        }
     };
 
+    // Values of the major version byte. Older binaries have 0 there and are stack form.
+    constexpr char ir_binary_version_stack = 1;
+    constexpr char ir_binary_version_register = 2;
+
     struct ir_binary_header {
         char magic[4];
+
+        // SIR form of the code section, see ir_binary_version_*
         char major;
         char minor;
         char build;
@@ -34,6 +64,10 @@ namespace snack::ir::backend {
         size_t func_table_addr;
         size_t ref_count;
         size_t ref_table_addr;
+
+        // Data entries the constant operands of register form instructions index into
+        size_t const_count;
+        size_t const_table_addr;
     };
 
     class ir_compiler {
@@ -43,10 +77,15 @@ namespace snack::ir::backend {
         std::vector<ir_function> funcs;
 
         std::unordered_map<std::string, std::vector<size_t>> relocate_string_list;
-        std::unordered_map<long double, std::vector<size_t>> relocate_number_list;
+        std::unordered_map<ir_number_constant, std::vector<size_t>, ir_number_constant_hash> relocate_number_list;
 
         std::vector<std::string> unit_table;
 
+        // Constant operands of the register form, and the data entry address of each
+        std::unordered_map<ir_number_constant, uint16_t, ir_number_constant_hash> register_number_constants;
+        std::unordered_map<std::string, uint16_t> register_string_constants;
+        std::vector<size_t> const_table;
+
         ir_binary_header header;
 
         size_t data_addr;
@@ -54,6 +93,9 @@ namespace snack::ir::backend {
         size_t relocate_info_addr;
         size_t func_table_addr;
         size_t ref_table_addr;
+        size_t const_table_addr;
+
+        bool register_form = false;
 
         snack::error_manager *err_mngr;
         snack::userspace::unit_manager *unit_mngr;
@@ -64,16 +106,24 @@ namespace snack::ir::backend {
         void do_relocate();
         void write_func_entries();
         void write_unit_ref_table();
+        void write_const_table();
+
+        void adjust_stack_depth(int effect);
 
         void emit(opcode op);
         void emit(opcode op, long double value);
+        void emit(opcode op, const ir_number_constant &value);
         void emit(opcode op, const std::string &value);
         void emit(opcode op, long double nval, const std::string &sval);
+        void emit(opcode op, uint16_t dest, uint16_t lhs, uint16_t rhs = 0);
+        void emit_super(opcode op, size_t slot, size_t second_slot);
+        void emit_super(opcode op, size_t slot, const ir_number_constant &value);
 
         void build_function(function_node_ptr node);
         void build_caculate(function_node_ptr func, std::shared_ptr<caculate_node> node);
         void build_assign(function_node_ptr func, std::shared_ptr<assign_node> node);
-        void build_function_call(function_node_ptr func, std::shared_ptr<function_call_node> fun);
+        // A tail call is returned right after, see build_ret
+        void build_function_call(function_node_ptr func, std::shared_ptr<function_call_node> fun, const bool tail_call = false);
         void build_if_else(function_node_ptr func, std::shared_ptr<if_else_node> node);
         void build_unary(function_node_ptr func, std::shared_ptr<unary_node> node);
         void build_conditional_loop(function_node_ptr func, std::shared_ptr<conditional_loop_node> node);
@@ -82,9 +132,24 @@ namespace snack::ir::backend {
         void build_new_object(function_node_ptr func, std::shared_ptr<new_object_node> node, uint32_t var_index);
 
         void build_condition(function_node_ptr func, node_ptr node);
+        size_t build_condition_branch(function_node_ptr func, node_ptr node);
+        void build_push_operands(function_node_ptr func, std::shared_ptr<caculate_node> node);
+        bool build_increment(function_node_ptr func, std::shared_ptr<assign_node> node);
         void build_node(function_node_ptr func, node_ptr node);
+        void build_statement(function_node_ptr func, node_ptr node);
         void build_push_hs(function_node_ptr func, node_ptr node);
+
+        std::optional<uint16_t> get_register(function_node_ptr func, node_ptr var);
+        std::optional<size_t> get_local_slot(function_node_ptr func, node_ptr var);
+        std::optional<size_t> get_arg_slot(function_node_ptr func, node_ptr var);
+        uint16_t get_constant_operand(const ir_number_constant &value);
+        uint16_t get_constant_operand(const std::string &value);
+
+        uint16_t build_operand(function_node_ptr func, node_ptr node);
+        bool build_caculate_to(function_node_ptr func, std::shared_ptr<caculate_node> node, uint16_t dest);
+        bool build_unary_to(function_node_ptr func, std::shared_ptr<unary_node> node, uint16_t dest);
         void build_ret(function_node_ptr func, std::shared_ptr<return_node> node);
+        void build_yield(function_node_ptr func, std::shared_ptr<yield_node> node);
 
         void do_report(error_panic_code code, error_level level, node_ptr node);
         void do_report(error_panic_code code, error_level level, node_ptr node, const std::string &arg0);
@@ -92,7 +157,7 @@ namespace snack::ir::backend {
 
     public:
         explicit ir_compiler() {}
-        ir_compiler(snack::error_manager &mngr, snack::userspace::unit_manager &unit_mngr);
+        ir_compiler(snack::error_manager &mngr, snack::userspace::unit_manager &unit_mngr, const bool register_form = false);
 
         void compile(std::shared_ptr<snack::unit_node> tar);
 
@@ -2,8 +2,10 @@
 
 #include <snack/error.h>
 #include <snack/ir_compiler.h>
+#include <snack/ir_interpreter.h>
 
 #include <sstream>
+#include <vector>
 
 namespace snack::ir::frontend {
     class ir_decompiler {
@@ -24,5 +26,11 @@ namespace snack::ir::frontend {
 
         void dump();
         void dump_unit_ref_table();
+
+        /*! \brief Dump a decoded instruction stream, as the interpreter runs it.
+         *
+         * Unlike the binary, it shows the number forms instructions were quickened into.
+         */
+        void dump_decoded(const std::vector<backend::ir_instruction> &code);
     };
 }
\ No newline at end of file
@@ -3,11 +3,12 @@
 #include <snack/error.h>
 #include <snack/ir_opcode.h>
 
-#include <array>
+#include <chrono>
 #include <functional>
-#include <stack>
+#include <memory>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 #include <sstream>
 
@@ -22,61 +23,358 @@ namespace snack {
 }
 
 namespace snack::ir::backend {
+    /*! \brief Immutable, reference counted string payload of an ir_element.
+     *
+     * Interned strings are unique by content and never freed, so their reference counter is left
+     * untouched and two of them are equal only if they are the same object. The header of an arena
+     * string lives in the memory of an ir_arena, the last reference only destroys it. Its characters
+     * are still allocated by std::string as usual.
+     */
+    struct ir_string {
+        uint32_t ref_count;
+        bool interned;
+        bool arena;
+
+        std::string value;
+
+        explicit ir_string(const std::string &value)
+            : ref_count(1)
+            , interned(false)
+            , arena(false)
+            , value(value) {}
+
+        explicit ir_string(std::string &&value)
+            : ref_count(1)
+            , interned(false)
+            , arena(false)
+            , value(std::move(value)) {}
+    };
+
+    /*! \brief Get the interned string object with the given content, creating it if needed. */
+    ir_string *ir_intern_string(const std::string &value);
+
+    class ir_arena;
+
+    /*! \brief Make a string, from the string arena of this thread if one is set, see ir_set_string_arena. */
+    ir_string *ir_new_string(std::string &&value);
+
+    /*! \brief Make new strings of this thread come from the arena, or from the heap if null. Gives the previous one. */
+    ir_arena *ir_set_string_arena(ir_arena *arena);
+
+    /*! \brief A script value: 8 bytes of payload plus a tag.
+     *
+     * Numbers are either doubles (num) or 64 bits integers. Integers stay integers through add,
+     * sub, mul, the bitwise operators and mod; div and pwr, or any double operand, give a double.
+     *
+     * Strings are held by pointer and shared between copies, so pushing, popping or loading a
+     * string never copies its characters.
+     */
     struct ir_element {
-        enum {
+        // Everything before str is copied without reference counting
+        enum : uint8_t {
             none,
             num,
+            integer,
             str,
             ref
         } type;
 
-        std::string str_data;
-        long double num_data;
-        uint64_t ref_id;
-
-        std::string associated_name;
+        union {
+            double num_data;
+            int64_t int_data;
+            ir_string *str_data;
+            uint64_t ref_id;
+        };
 
         ir_element()
-            : num_data(0)
-            , str_data("")
-            , type(none) {}
+            : type(none)
+            , ref_id(0) {}
 
-        ir_element(const std::string &str_data)
-            : str_data(str_data)
-            , type(str) {}
+        ir_element(const double num_data)
+            : type(num)
+            , num_data(num_data) {}
 
-        ir_element(const long double num_data)
-            : num_data(num_data)
-            , type(num) {}
+        ir_element(const int64_t int_data)
+            : type(integer)
+            , int_data(int_data) {}
+
+        ir_element(const std::string &val)
+            : type(str)
+            , str_data(ir_new_string(std::string(val))) {}
+
+        ir_element(std::string &&val)
+            : type(str)
+            , str_data(ir_new_string(std::move(val))) {}
+
+        // Takes over one reference of the given string
+        explicit ir_element(ir_string *val)
+            : type(str)
+            , str_data(val) {}
+
+        ir_element(const ir_element &rhs)
+            : type(rhs.type)
+            , ref_id(rhs.ref_id) {
+            retain();
+        }
+
+        ir_element(ir_element &&rhs) noexcept
+            : type(rhs.type)
+            , ref_id(rhs.ref_id) {
+            rhs.type = none;
+        }
+
+        ~ir_element() {
+            release();
+        }
+
+        ir_element &operator=(const ir_element &rhs) {
+            if (this != &rhs) {
+                release();
+
+                type = rhs.type;
+                ref_id = rhs.ref_id;
+
+                retain();
+            }
+
+            return *this;
+        }
+
+        ir_element &operator=(ir_element &&rhs) noexcept {
+            if (this != &rhs) {
+                release();
+
+                type = rhs.type;
+                ref_id = rhs.ref_id;
+
+                rhs.type = none;
+            }
+
+            return *this;
+        }
+
+        bool is_number() const {
+            return type == num || type == integer;
+        }
+
+        /*! \brief Get the value as a double. None is zero, so is anything else not a number. */
+        double get_number() const {
+            return (type == num) ? num_data : (type == integer) ? static_cast<double>(int_data) : 0.0;
+        }
+
+        /*! \brief Get the value as an integer, doubles are truncated. None is zero, so is anything else not a number. */
+        int64_t get_integer() const {
+            return (type == integer) ? int_data : (type == num) ? static_cast<int64_t>(num_data) : 0;
+        }
+
+        /*! \brief Get the string payload, or an empty string if this is not a string. */
+        const std::string &get_string() const {
+            static const std::string empty_string;
+            return (type == str) ? str_data->value : empty_string;
+        }
+
+    private:
+        void retain() {
+            if (type == str && !str_data->interned) {
+                str_data->ref_count++;
+            }
+        }
+
+        void release() {
+            if (type == str && !str_data->interned && --str_data->ref_count == 0) {
+                // Arena memory is given back all at once
+                if (str_data->arena) {
+                    str_data->~ir_string();
+                } else {
+                    delete str_data;
+                }
+            }
+        }
+    };
+
+    static_assert(sizeof(ir_element) == 16, "ir_element should stay a 16 bytes tagged value");
+
+    constexpr size_t ir_default_value_stack_size = 64 * 1024;
+    constexpr size_t ir_default_frame_count = 16 * 1024;
+
+    // Coroutines get their own, smaller stacks
+    constexpr size_t ir_default_coroutine_value_stack_size = 4 * 1024;
+    constexpr size_t ir_default_coroutine_frame_count = 256;
+
+    // Calls plus loop back edges a function takes before the JIT compiles it
+    constexpr uint32_t ir_default_jit_threshold = 1000;
+
+    // Live objects before the first collection starts, and how far the heap may grow past what
+    // survived a collection before the next one
+    constexpr size_t ir_default_gc_threshold = 4096;
+    constexpr double ir_default_gc_growth = 2.0;
+
+    // Objects marked or slots swept by every collection step an allocation runs
+    constexpr size_t ir_gc_step_work = 256;
+
+    // Memory an arena takes from the heap at a time, anything larger gets a block of its own
+    constexpr size_t ir_default_arena_block_size = 64 * 1024;
+
+    // Room left above a frame stack window, for host functions pushing more than they were told to
+    constexpr size_t ir_value_stack_slack = 8;
+
+    /*! \brief A pre-decoded SIR instruction.
+     *
+     * Interpreted units translate their functions into this form once, at load time. Constants
+     * are indices into the unit constant pool, branch targets are instruction indices, call
+     * operands are split into unit and function index. Register form instructions keep their
+     * destination in short_operand and their sources in the two halves of operand.
+     *
+     * The stream is not read only: the interpreter quickens arithmetic and comparisons in place.
+     */
+    struct ir_instruction {
+        ir::opcode op;
+
+        // Local/argument slot, argument count, the unit index of a call, or a register destination
+        uint16_t short_operand;
+
+        // Constant pool index, branch target, or the function index of a call in the low half
+        // and its argument count in the high half
+        uint32_t operand;
     };
-    
+
+    class ir_interpreter;
     class ir_interpreter_ref_manager;
+    struct ir_call_site;
+    struct ir_function_entry;
+    struct ir_interpreter_func_context;
+
+    class ir_snapshot_writer;
 
+    /*! \brief Native code of a function.
+     *
+     * Runs the frame from its pc and returns when it reaches an instruction it leaves to the
+     * interpreter, with the pc on that instruction.
+     */
+    using ir_jit_code = void (*)(ir_interpreter *, ir_interpreter_func_context *);
+
+    /*! \brief Executable memory the JIT mapped, holding native code of one function or trace. */
+    struct ir_native_block {
+        void *mem;
+        size_t size;
+    };
+
+    enum class ir_jit_mode {
+        off,
+        on,
+
+        // On, and hot loops are traced and compiled on their own
+        tracing,
+
+        // Every stretch of native code is checked against the interpreter running the same instructions
+        differential
+    };
+
+    /*! \brief A call frame.
+     *
+     * Arguments, locals and the evaluation stack all live in one window of the interpreter value
+     * stack, laid out in that order. Arguments are the values the caller pushed, last argument
+     * first, so they are used in place. Everything at or above stack_ptr is none.
+     */
     struct ir_interpreter_func_context {
-        std::array<ir_element, 200> local_slots;
-        std::stack<ir_element> evaluation_stack;
-        std::array<ir_element, 30> local_args;
+        ir_element *local_args;
+        ir_element *local_slots;
+        ir_element *stack_base;
+        ir_element *stack_ptr;
 
-        const char *ir_bin;
-        const char *ir_global_bin;
+        ir_instruction *code;
+        const ir_element *constants;
+        ir_call_site *call_sites;
 
-        std::string func_name;
+        const std::string *func_name;
         userspace::unit *owning_unit;
 
         ir_interpreter_ref_manager *ref_manager;
 
+        // For host functions that need more than the frame
+        ir_interpreter *interpreter;
+
+        ir_function_entry *func;
+        ir_jit_code native_code;
+
+        // Instructions the interpreter may still run, native loops charge their iterations to it
+        int64_t *budget;
+
         size_t pc;
 
-        void push(ir_element &el);
-        void push(long double val);
+        void push(const ir_element &el);
+        void push(ir_element &&el);
+        void push(double val);
+        void push(int64_t val);
         void push(const std::string &val);
 
         ir_element pop();
+
+        /*! \brief Read a register form source: copy a register or a constant, or pop the stack. */
+        ir_element get_operand(const uint16_t operand);
+
+        /*! \brief Store a register form result into a register, or push it. */
+        void set_operand(const uint16_t operand, ir_element &&el);
+
+        size_t get_stack_size() const {
+            return stack_ptr - stack_base;
+        }
+    };
+
+    /*! \brief A host function, called with the object it was bound to. Pops its arguments and pushes its result. */
+    using ir_host_function = void (*)(void *, ir_interpreter_func_context &);
+
+    /*! \brief Everything needed to enter a script function, fixed once its unit is loaded.
+     *
+     * A unit's own entries point at its shared, never written code. Interpreters enter their own
+     * copies, see ir_unit_instance.
+     */
+    struct ir_function_entry {
+        ir_instruction *code;
+        const ir_element *constants;
+        ir_call_site *call_sites;
+
+        const std::string *name;
+        userspace::unit *owning_unit;
+
+        size_t entry;
+        size_t end;
+        size_t arg_count;
+        size_t local_count;
+        size_t max_stack;
+
+        // Calls and loop back edges, counted only while the JIT is on
+        uint32_t hit_count;
+        ir_jit_code native_code;
+    };
+
+    /*! \brief Inline cache of one call instruction.
+     *
+     * Resolved the first time the call runs. It is resolved again once the unit manager
+     * generation moves, which happens when a unit is replaced.
+     */
+    struct ir_call_site {
+        // 0x7FFF is the unit the call is in
+        uint16_t unit_ref;
+        uint16_t func_idx;
+        uint16_t arg_count;
+
+        // Generation the target was resolved in, 0 if never
+        uint64_t generation;
+
+        // Keeps a referenced unit alive while its function is cached
+        std::shared_ptr<userspace::unit> unit;
+
+        // One of the two is set
+        ir_function_entry *script_func;
+        ir_host_function host_func;
+        void *host_object;
     };
 
     enum class ir_object_base_type {
         oop,
-        array
+        array,
+        coroutine
     };
 
     class ir_object_base {
@@ -84,11 +382,23 @@ namespace snack::ir::backend {
         ir_object_base_type type;
 
         uint64_t id;
-        uint32_t ref_counter;
+
+        // Host pins, a pinned object is a root
+        uint32_t pin_count;
+
+        // Reached by the collection in progress
+        bool marked;
+
+        // Allocated from the arena of the running invocation
+        bool in_arena;
+
+        // A heap object that got a reference or string stored while an invocation ran in arena mode
+        bool remembered;
 
         ir_object_base(const ir_object_base_type type);
 
         friend class ir_interpreter_ref_manager;
+        friend class ir_interpreter;
 
     public:
         explicit ir_object_base();
@@ -103,55 +413,516 @@ namespace snack::ir::backend {
     protected:
         std::unordered_map<uint32_t, ir_element> fields;
 
+        friend class ir_interpreter;
+        friend class ir_interpreter_ref_manager;
+
     public:
         explicit ir_oop_object();
     };
 
+    enum class ir_array_storage : uint8_t {
+        // Every element is an integer, only the payloads are kept
+        integers,
+
+        // Every element is a double
+        numbers,
+
+        // Any values, for good once an array gets here
+        generic
+    };
+
+    /*! \brief An array, packed while its elements are all integers or all doubles.
+     *
+     * A packed array takes 8 bytes per element and holds no references, so collections skip it. A
+     * value of another type, or a gap left by growing it, turns it into generic values.
+     */
     class ir_array : public ir_object_base {
+        ir_array_storage storage;
+
+        std::vector<int64_t> integers;
+        std::vector<double> numbers;
         std::vector<ir_element> elements;
 
+        friend class ir_interpreter;
+        friend class ir_interpreter_ref_manager;
+
+        void make_generic();
+
     public:
         explicit ir_array();
 
-        ir_element &get_element(int idx);
-        size_t get_array_length();
+        ir_array_storage get_storage() const {
+            return storage;
+        }
+
+        size_t get_array_length() const {
+            switch (storage) {
+            case ir_array_storage::integers:
+                return integers.size();
+
+            case ir_array_storage::numbers:
+                return numbers.size();
+
+            default:
+                return elements.size();
+            }
+        }
+
+        /*! \brief Get a copy of the element, none if it is out of range. */
+        ir_element get_element(const size_t idx) const;
+
+        /*! \brief Store the value, growing the array up to the element if needed.
+         *
+         * An element keeps the type of the first value stored into it, integers and doubles both being
+         * numbers. A value of another type resets a string element to empty and a number to zero.
+         */
+        void store_element(const size_t idx, ir_element &&val);
+
+        /*! \brief Grow to at least the given length, new elements are none. */
+        void grow(const size_t length);
+
+        // Each valid while the array has that storage, until it grows
+        int64_t *get_integers() {
+            return integers.data();
+        }
+
+        double *get_numbers() {
+            return numbers.data();
+        }
+
+        ir_element *get_elements() {
+            return elements.data();
+        }
     };
 
     using ir_object_base_ptr = std::shared_ptr<ir_object_base>;
 
+    /*! \brief What one interpreter changes of a loaded unit.
+     *
+     * The unit itself stays untouched, so interpreters on other threads can share it. Each gets its
+     * own copy of the code to quicken, its own call site caches, and entries counting hits and
+     * holding native code, pointing at those copies.
+     */
+    struct ir_unit_instance {
+        // Keeps the unit alive while frames may run the copies
+        std::shared_ptr<userspace::interpreted_unit> unit;
+
+        std::vector<ir_instruction> code;
+        std::vector<ir_call_site> call_sites;
+        std::vector<ir_function_entry> entries;
+    };
+
+    /*! \brief A slot of the object table, holding an object or free. */
+    struct ir_object_slot {
+        ir_object_base_ptr object;
+
+        // Bumped every time the slot is freed, so references to the old object stop matching
+        uint32_t generation;
+
+        // While free, the next free slot
+        uint32_t next_free;
+    };
+
+    enum class ir_gc_phase {
+        idle,
+
+        // Going through what the roots reach, a bit every step
+        marking,
+
+        // Freeing every slot left unmarked, a bit every step
+        sweeping
+    };
+
+    /*! \brief Bump allocator, everything allocated from it is given back at once by reset.
+     *
+     * Blocks are kept for the next round, only oversized ones are freed.
+     */
+    class ir_arena {
+        std::vector<std::unique_ptr<uint8_t[]>> blocks;
+        std::vector<std::unique_ptr<uint8_t[]>> oversized;
+        size_t block_size;
+
+        // Block being filled, and the free part of it
+        size_t current;
+        uint8_t *pos;
+        uint8_t *end;
+
+    public:
+        explicit ir_arena(const size_t block_size = ir_default_arena_block_size);
+
+        void *allocate(const size_t size, const size_t align);
+
+        /*! \brief Make an arena string, destroyed by its last reference and given back by reset. */
+        ir_string *make_string(std::string &&value);
+
+        /*! \brief Give back everything. Nothing allocated may still be alive. */
+        void reset();
+    };
+
+    /*! \brief Allocator for std::allocate_shared, taking objects and their control blocks from an arena. */
+    template <typename T>
+    struct ir_arena_allocator {
+        using value_type = T;
+
+        ir_arena *arena;
+
+        explicit ir_arena_allocator(ir_arena *arena)
+            : arena(arena) {}
+
+        template <typename U>
+        ir_arena_allocator(const ir_arena_allocator<U> &rhs)
+            : arena(rhs.arena) {}
+
+        T *allocate(const size_t n) {
+            return static_cast<T *>(arena->allocate(n * sizeof(T), alignof(T)));
+        }
+
+        void deallocate(T *, size_t) {}
+
+        template <typename U>
+        bool operator==(const ir_arena_allocator<U> &rhs) const {
+            return arena == rhs.arena;
+        }
+
+        template <typename U>
+        bool operator!=(const ir_arena_allocator<U> &rhs) const {
+            return arena != rhs.arena;
+        }
+    };
+
+    /*! \brief Objects of an interpreter, in a table indexed by reference.
+     *
+     * A reference holds the slot index in its low half and the slot generation in its high half.
+     * Looking one up is an index and a compare, freed slots are reused first.
+     *
+     * Objects are freed by an incremental mark and sweep collection, the interpreter gives the roots.
+     * While marking, a reference stored into a heap object is marked right away, and the roots are
+     * gone through again before sweeping.
+     *
+     * While an invocation runs in arena mode, new objects come from the arena. Once it is over, what
+     * escaped is moved to the heap under the same reference and the rest is freed with the arena.
+     */
     class ir_interpreter_ref_manager {
-        std::unordered_map<uint64_t, ir_object_base_ptr> objects;
-        mutable std::atomic<uint64_t> ref_id;
+        std::vector<ir_object_slot> slots;
+        uint32_t free_head;
+        size_t object_count;
+
+        ir_gc_phase gc_phase;
+
+        // Marked, their references not gone through yet
+        std::vector<ir_object_base *> gray;
+        size_t sweep_pos;
+
+        // References of every object with pins
+        std::vector<uint64_t> pinned;
+
+        // Set while an invocation in arena mode runs
+        bool arena_active;
+        ir_arena arena;
+
+        // References of the objects allocated from the arena, and of remembered heap objects
+        std::vector<uint64_t> arena_objects;
+        std::vector<uint64_t> remembered;
+
+        friend class ir_interpreter;
 
     protected:
-        uint64_t new_id() const;
+        uint64_t add_obj(ir_object_base_ptr &&obj);
+
+        // From the arena while one is active
+        template <typename T>
+        uint64_t make_obj();
+
+        void release(const uint32_t index);
+
+        // Chain every empty slot again, lowest first
+        void rebuild_free_list();
+
+        void mark(ir_object_base *obj);
+        void mark_value(const ir_element &el);
+        void mark_values(const ir_element *begin, const ir_element *end);
+
+        // Go through the references of the object again, it changed after it was marked
+        void remark(ir_object_base *obj);
+
+        // Returns true once nothing is left to mark, or everything is swept
+        bool propagate(size_t &work);
+        bool sweep(size_t &work);
+
+        // Drop the collection in progress, every object unmarked
+        void reset_collection();
+
+        // Like get_obj, arena objects included, the pointer must be dropped before the arena is
+        ir_object_base_ptr share_obj(const uint64_t id) const;
+
+        // A heap object about to get arena values, gone through when the invocation ends
+        void remember(ir_object_base *obj) {
+            if (arena_active && !obj->in_arena && !obj->remembered) {
+                obj->remembered = true;
+                remembered.push_back(obj->id);
+            }
+        }
+
+        // Move an arena object the value refers to, or an arena string it holds, to the heap. Objects
+        // moved are added to the list, their values have to be promoted too.
+        void promote_value(ir_element &el, std::vector<ir_object_base *> &moved);
+        void promote_object(const uint64_t id, std::vector<ir_object_base *> &moved);
+        void promote_values(ir_element *begin, ir_element *end, std::vector<ir_object_base *> &moved);
+        void promote_contents(ir_object_base *obj, std::vector<ir_object_base *> &moved);
+
+        // Promote what the result, pins and remembered objects reach, free every other arena object
+        // and the arena. Not while marking.
+        void close_arena(ir_element &result);
 
     public:
         explicit ir_interpreter_ref_manager();
 
         uint64_t make_new_array();
+        uint64_t make_new_coroutine();
+
+        /*! \brief Share the object, nullptr if the reference is stale or the object is in the arena.
+         *
+         * Arena objects are freed with the arena when their invocation ends, whoever holds them.
+         */
         ir_object_base_ptr get_obj(uint64_t id);
 
-        void do_push(uint64_t ref);
-        void do_pop(uint64_t ref);
+        // Valid until the object is released
+        ir_object_base *find_obj(const uint64_t id) const;
+        ir_array *find_array(const uint64_t id) const;
+
+        size_t get_object_count() const {
+            return object_count;
+        }
+
+        /*! \brief Call when storing the value into the object, so marking can't miss it and an arena
+         * reference or string stored into a heap object is promoted.
+         */
+        void write_barrier(ir_object_base *obj, const ir_element &el) {
+            if (gc_phase == ir_gc_phase::marking && el.type == ir_element::ref) {
+                mark_value(el);
+            }
+
+            if (el.type >= ir_element::str) {
+                remember(obj);
+            }
+        }
+    };
+
+    /*! \brief Why interpret_for or interpret_until returned. */
+    enum class ir_run_status {
+        // Every frame returned
+        finished,
+
+        // Out of instructions or time, calling again goes on from the same frame and pc
+        suspended
+    };
+
+    // Instructions interpret_until runs between two looks at the clock
+    constexpr uint64_t ir_deadline_check_interval = 4096;
+
+    /*! \brief Native code of a hot loop, keyed by the instruction the loop jumps back to. */
+    struct ir_loop_trace {
+        uint32_t hit_count;
+        ir_jit_code native_code;
+    };
+
+    /*! \brief Call frames, allocated once with a fixed capacity and reused by every call. */
+    class ir_frame_arena {
+        std::vector<ir_interpreter_func_context> frames;
+        size_t frame_count;
+
+    public:
+        explicit ir_frame_arena(const size_t capacity)
+            : frames(capacity)
+            , frame_count(0) {}
+
+        bool empty() const {
+            return frame_count == 0;
+        }
+
+        size_t size() const {
+            return frame_count;
+        }
+
+        size_t capacity() const {
+            return frames.size();
+        }
+
+        ir_interpreter_func_context &top() {
+            return frames[frame_count - 1];
+        }
+
+        const ir_interpreter_func_context &top() const {
+            return frames[frame_count - 1];
+        }
+
+        // From the bottom frame up
+        ir_interpreter_func_context &operator[](const size_t idx) {
+            return frames[idx];
+        }
+
+        /*! \brief Get a new frame on top, or nullptr if the arena is full. */
+        ir_interpreter_func_context *push() {
+            return (frame_count == frames.size()) ? nullptr : &frames[frame_count++];
+        }
+
+        void pop() {
+            frame_count--;
+        }
+    };
+
+    /*! \brief Call frames and the values they live on.
+     *
+     * The host has one, every coroutine has its own. The interpreter runs one at a time, switching
+     * to another is a pointer swap.
+     */
+    struct ir_execution_stack {
+        ir_frame_arena frames;
+        std::vector<ir_element> values;
+
+        explicit ir_execution_stack(const size_t value_count, const size_t frame_count)
+            : frames(frame_count)
+            , values(value_count) {}
+    };
+
+    enum class ir_coroutine_state {
+        // Not started yet, or stopped at a yield
+        suspended,
+
+        // Running, or waiting on a coroutine it resumed
+        running,
+
+        // Returned, or stopped by an error
+        done
+    };
+
+    /*! \brief A script function running on its own stack, stopping at every yield. */
+    class ir_coroutine : public ir_object_base {
+        ir_execution_stack stack;
+        ir_coroutine_state state;
+
+        // Where yields and the return go back to
+        ir_execution_stack *resumer;
+
+        // What the last yield or the return gave, for a host resuming it
+        ir_element result;
+
+        friend class ir_interpreter;
+        friend class ir_interpreter_ref_manager;
+
+    public:
+        explicit ir_coroutine(const size_t value_count = ir_default_coroutine_value_stack_size,
+            const size_t frame_count = ir_default_coroutine_frame_count);
+
+        ir_coroutine_state get_state() const {
+            return state;
+        }
     };
 
     class ir_interpreter {
-        std::stack<ir_interpreter_func_context> func_contexts;
-        std::unordered_map<ir::opcode, std::function<void(ir_interpreter_func_context &)>> opcode_map;
+        // Every frame of a stack gets a window of its values on top of its caller. The running one is
+        // the host's own, or the stack of the innermost running coroutine.
+        ir_execution_stack main_stack;
+        ir_execution_stack *stack;
+
+        // Empty, running it stops the dispatch loop. Coroutines a host resumes go back to it.
+        ir_execution_stack idle_stack;
+
+        // Running coroutines, each resumed by the one before
+        std::vector<std::shared_ptr<ir_coroutine>> coroutines;
+
+        // What the last function entered by the host returned
+        ir_element result;
 
         snack::userspace::unit_manager *unit_mngr;
         snack::error_manager *err_manager;
 
-        ir_interpreter_func_context *last_context;
         ir_interpreter_ref_manager ref_manager;
 
+        ir_jit_mode jit_mode;
+        uint32_t jit_threshold;
+
+        int64_t budget;
+
+        // Live objects at which the next collection starts
+        size_t gc_threshold;
+        size_t gc_min_threshold;
+        double gc_growth;
+
+        // Invocations from the host allocate from the arena
+        bool arena_mode;
+
+        // Unique in the process, unlike the address of an interpreter freed and made again
+        uint64_t instance_id;
+
+        std::unordered_map<const ir_instruction *, ir_loop_trace> loop_traces;
+        std::unordered_map<const userspace::unit *, std::unique_ptr<ir_unit_instance>> unit_instances;
+
+        // Native code of the functions and traces above, only ever run by this interpreter
+        std::vector<ir_native_block> native_blocks;
+
         friend class userspace::interpreted_unit;
         friend class userspace::external_unit;
+        friend class ir_jit;
 
     protected:
         ir_interpreter_func_context &get_current_func_context();
 
+        ir_interpreter_func_context *push_func_context(ir_interpreter_func_context *caller, const size_t arg_count,
+            const size_t local_count, const size_t max_stack);
+        void pop_func_context();
+        void unwind();
+
+        ir_interpreter_func_context *enter_function(ir_interpreter_func_context *caller, ir_function_entry &func);
+
+        // The copy of a unit's function entry this interpreter runs, made with the rest of the unit the first time
+        ir_function_entry &get_local_entry(ir_function_entry &func);
+        bool resolve_call_site(ir_interpreter_func_context &context, ir_call_site &site);
+        void call_host(ir_interpreter_func_context &context, const ir_call_site &site);
+        void skip_call(ir_interpreter_func_context &context, const ir_call_site &site);
+
+        void count_hit(ir_interpreter_func_context &context);
+        void run_native(ir_interpreter_func_context &context);
+        void run_loop_trace(ir_interpreter_func_context &context);
+
+        // Run one instruction, without the dispatch loop
+        void step(ir_interpreter_func_context &context);
+
+        // Run until every frame returned, or until the budget runs out if counted. True if finished.
+        template <bool counted>
+        bool run();
+
+        std::shared_ptr<ir_coroutine> get_coroutine(const ir_element &coroutine);
+
+        // Every stack, the result and the running coroutines. Values a host function popped are not roots.
+        void mark_roots();
+
+        // Only where every value is in a frame: before an instruction that allocates
+        void collect_if_needed();
+
+        // Make the coroutine's stack the running one, going back to the current one when it yields
+        void enter_coroutine(std::shared_ptr<ir_coroutine> coroutine);
+
+        // Go back to whoever resumed the running coroutine, giving them the value
+        void leave_coroutine(ir_element &&value, const ir_coroutine_state state);
+
+        // A function left its last frame on the running stack
+        void finish_stack(ir_element &&value);
+
+        // The main stack has no frames left, what the invocation allocated from the arena goes
+        void finish_invocation();
+
+        // Enter func on the running stack with the arguments a caller would have pushed
+        ir_interpreter_func_context *enter_from_host(ir_function_entry &func, const std::vector<ir_element> &args);
+
+        void save_stack(ir_snapshot_writer &writer, ir_execution_stack &saved);
+        void save_stack_ref(ir_snapshot_writer &writer, const ir_execution_stack *saved);
+
+        void do_report(error_panic_code code, error_level level);
+        void do_report(error_panic_code code, error_level level, const std::string &arg0);
+
+        void nop(ir_interpreter_func_context &context);
+
         void ldcst(ir_interpreter_func_context &context);
         void ldlc(ir_interpreter_func_context &context);
         void ldarg(ir_interpreter_func_context &context);
@@ -168,6 +939,9 @@ namespace snack::ir::backend {
         void shl(ir_interpreter_func_context &context);
         void shr(ir_interpreter_func_context &context);
         void pwr(ir_interpreter_func_context &context);
+        void and(ir_interpreter_func_context &context);
+        void or(ir_interpreter_func_context &context);
+        void xor(ir_interpreter_func_context &context);
 
         void ceq(ir_interpreter_func_context &context);
         void cgt(ir_interpreter_func_context &context);
@@ -184,6 +958,7 @@ namespace snack::ir::backend {
         void brf(ir_interpreter_func_context &context);
         void brt(ir_interpreter_func_context &context);
 
+        void upn(ir_interpreter_func_context &context);
         void uno(ir_interpreter_func_context &context);
         void ung(ir_interpreter_func_context &context);
         void uin(ir_interpreter_func_context &context);
@@ -194,23 +969,260 @@ namespace snack::ir::backend {
         void vrs(ir_interpreter_func_context &context);
         void call(ir_interpreter_func_context &context);
 
+        // A call whose value is returned right away. A script function takes over the frame of the
+        // caller, a host function is called as usual and the ret that follows returns its value.
+        void tcall(ir_interpreter_func_context &context);
+
         void pop(ir_interpreter_func_context &context);
+        void ldnull(ir_interpreter_func_context &context);
 
         void newarr(ir_interpreter_func_context &context);
+        void newobj(ir_interpreter_func_context &context);
         void strelm(ir_interpreter_func_context &context);
         void ldelm(ir_interpreter_func_context &context);
 
         void ret(ir_interpreter_func_context &context);
+        void yield(ir_interpreter_func_context &context);
 
-        void do_opcode();
-        void init_opcode_table();
+        // Data entries are never executed, landing on them means the pc is corrupted
+        void idata(ir_interpreter_func_context &context);
+        void strdata(ir_interpreter_func_context &context);
+        void i64data(ir_interpreter_func_context &context);
+        void f64data(ir_interpreter_func_context &context);
+
+        void rmov(ir_interpreter_func_context &context);
+        void radd(ir_interpreter_func_context &context);
+        void rsub(ir_interpreter_func_context &context);
+        void rmul(ir_interpreter_func_context &context);
+        void rdiv(ir_interpreter_func_context &context);
+        void rmod(ir_interpreter_func_context &context);
+        void rand(ir_interpreter_func_context &context);
+        void ror(ir_interpreter_func_context &context);
+        void rxor(ir_interpreter_func_context &context);
+        void rpwr(ir_interpreter_func_context &context);
+        void rshl(ir_interpreter_func_context &context);
+        void rshr(ir_interpreter_func_context &context);
+
+        void rceq(ir_interpreter_func_context &context);
+        void rclt(ir_interpreter_func_context &context);
+        void rcle(ir_interpreter_func_context &context);
+        void rcgt(ir_interpreter_func_context &context);
+        void rcge(ir_interpreter_func_context &context);
+
+        void rung(ir_interpreter_func_context &context);
+        void runo(ir_interpreter_func_context &context);
+        void ruin(ir_interpreter_func_context &context);
+
+        // Superinstructions, each one a common sequence of the compiler
+        void inclc(ir_interpreter_func_context &context);
+        void addstlc(ir_interpreter_func_context &context);
+        void ldlc2(ir_interpreter_func_context &context);
+        void ldlccst(ir_interpreter_func_context &context);
+        void ldargcst(ir_interpreter_func_context &context);
+        void ldelmlc(ir_interpreter_func_context &context);
+        void bnlt(ir_interpreter_func_context &context);
+        void bnle(ir_interpreter_func_context &context);
+        void bngt(ir_interpreter_func_context &context);
+        void bnge(ir_interpreter_func_context &context);
+        void bneq(ir_interpreter_func_context &context);
+
+        // Number forms, quickened from the generic instruction once it saw two numbers
+        void addnn(ir_interpreter_func_context &context);
+        void subnn(ir_interpreter_func_context &context);
+        void mulnn(ir_interpreter_func_context &context);
+        void ceqnn(ir_interpreter_func_context &context);
+        void cltnn(ir_interpreter_func_context &context);
+        void clenn(ir_interpreter_func_context &context);
+        void cgtnn(ir_interpreter_func_context &context);
+        void cgenn(ir_interpreter_func_context &context);
+        void bnltnn(ir_interpreter_func_context &context);
+        void bnlenn(ir_interpreter_func_context &context);
+        void bngtnn(ir_interpreter_func_context &context);
+        void bngenn(ir_interpreter_func_context &context);
+        void bneqnn(ir_interpreter_func_context &context);
+
+        void push_element(ir_interpreter_func_context &context, const ir_element &arr_ref, const ir_element &index);
+
+        void bad_opcode(ir_interpreter_func_context &context);
 
     public:
-        explicit ir_interpreter(snack::error_manager &err_mngr, snack::userspace::unit_manager &manager);
+        explicit ir_interpreter(snack::error_manager &err_mngr, snack::userspace::unit_manager &manager,
+            const size_t value_stack_size = ir_default_value_stack_size, const size_t frame_count = ir_default_frame_count);
+        ~ir_interpreter();
+
         void interpret();
 
+        /*! \brief Run at most about max_instructions instructions.
+         *
+         * Stops between two instructions, the frames stay as they are. Native loops count every
+         * iteration, so the budget may be overrun by up to one iteration of a loop.
+         */
+        ir_run_status interpret_for(const uint64_t max_instructions);
+
+        /*! \brief Run until every frame returned or the deadline passed, whichever comes first.
+         *
+         * The clock is checked every ir_deadline_check_interval instructions.
+         */
+        ir_run_status interpret_until(const std::chrono::steady_clock::time_point deadline);
+
+        /*! \brief Enter a script function from the host with the given arguments, interpret runs it.
+         *
+         * Returns false if the arguments don't match or there is no room for the frame. take_result
+         * gives what it returned once it is done.
+         */
+        bool call_from_host(ir_function_entry &func, const std::vector<ir_element> &args);
+
+        /*! \brief Take what the last function entered by the host returned, none if it returned nothing. */
+        ir_element take_result();
+
+        /*! \brief Make a coroutine that runs func with the given arguments, stopped before its first instruction.
+         *
+         * Gives a reference to the coroutine, or none if the arguments don't match.
+         */
+        ir_element create_coroutine(ir_function_entry &func, const std::vector<ir_element> &args);
+
+        /*! \brief Run a coroutine until it yields or returns, and give what it yielded or returned.
+         *
+         * For the host, outside of running code or from a host function. Gives none if the coroutine is
+         * running or done already.
+         */
+        ir_element resume(const ir_element &coroutine);
+
+        /*! \brief Resume a coroutine once the host function calling this returns.
+         *
+         * For host functions called by a script. The coroutine runs in the same dispatch loop, what it
+         * yields or returns becomes the value of the call. Returns false if it can't be resumed.
+         */
+        bool resume_after_call(ir_interpreter_func_context &context, const ir_element &coroutine);
+
+        /*! \brief Turn the JIT on or off.
+         *
+         * Should be set before running code: functions compiled in differential mode stop their native
+         * code at every heap write, so the interpreter can replay it safely.
+         */
+        void set_jit_mode(const ir_jit_mode mode, const uint32_t threshold = ir_default_jit_threshold);
+
         ir_interpreter_ref_manager *get_ref_manager() {
             return &ref_manager;
         }
+
+        /*! \brief Set when collections start: once min_objects are alive, and afterwards once the heap
+         * grew growth times past what survived the last collection.
+         */
+        void set_gc_threshold(const size_t min_objects, const double growth = ir_default_gc_growth);
+
+        /*! \brief Do some of the collection work, starting a collection if none is in progress.
+         *
+         * Marks or sweeps about work objects. Returns true once the collection is done. For the host,
+         * outside of running code. Allocating code runs steps on its own once the threshold is reached.
+         */
+        bool collect_step(const size_t work);
+
+        /*! \brief Finish the collection in progress, then run a whole one. For the host, outside of running code. */
+        void collect();
+
+        /*! \brief Allocate what every invocation from the host makes from an arena, freed at once when it returns.
+         *
+         * An invocation starts when the host enters a function on an empty main stack and ends when
+         * that stack is empty again. Objects it makes and the headers of its strings come from a bump
+         * allocator, array storage and string characters still come from the heap. When it ends, what
+         * the result, pinned objects and heap objects reach is moved to the heap, keeping its
+         * reference, and the rest is dropped with the arena. Values the host keeps in any other way
+         * across the end of an invocation are not safe, get_obj gives nothing for arena objects. Takes
+         * effect from the next invocation.
+         */
+        void set_arena_mode(const bool enabled) {
+            arena_mode = enabled;
+        }
+
+        /*! \brief Keep the object the value refers to alive until it is unpinned as many times.
+         *
+         * Frames, coroutines and the result are always roots. A reference the host keeps anywhere else
+         * while code runs, or across a collection, must be pinned.
+         */
+        void pin(const ir_element &el);
+        void unpin(const ir_element &el);
+
+        /*! \brief Get the code this interpreter runs for the unit, with whatever it quickened so far.
+         *
+         * Empty if it never ran anything of the unit.
+         */
+        const std::vector<ir_instruction> &get_unit_code(const userspace::unit &unit) const;
+
+        /*! \brief Write every frame, coroutine and object of the interpreter into the buffer.
+         *
+         * Returns the size of the snapshot, which is only written if it fits in capacity: pass a null
+         * buffer to get the size. Frames keep pointing at the code of this interpreter and at interned
+         * strings, so only this interpreter can restore it. Not while running code.
+         */
+        size_t snapshot(uint8_t *buffer, const size_t capacity);
+
+        /*! \brief Go back to the state saved in a snapshot of this interpreter.
+         *
+         * Objects still alive with the same id are reused. Returns false if the buffer is not a snapshot
+         * of this interpreter or is cut short, the whole buffer is read and checked before anything
+         * changes. Not while running code.
+         */
+        bool restore(const uint8_t *buffer, const size_t size);
     };
+
+    inline ir_object_base *ir_interpreter_ref_manager::find_obj(const uint64_t id) const {
+        const uint64_t index = id & 0xFFFFFFFF;
+
+        if (index >= slots.size() || slots[index].generation != static_cast<uint32_t>(id >> 32)) {
+            return nullptr;
+        }
+
+        return slots[index].object.get();
+    }
+
+    inline ir_array *ir_interpreter_ref_manager::find_array(const uint64_t id) const {
+        ir_object_base *obj = find_obj(id);
+        return (obj && obj->get_type() == ir_object_base_type::array) ? static_cast<ir_array *>(obj) : nullptr;
+    }
+
+    inline void ir_interpreter_func_context::push(const ir_element &el) {
+        *stack_ptr++ = el;
+    }
+
+    inline void ir_interpreter_func_context::push(ir_element &&el) {
+        *stack_ptr++ = std::move(el);
+    }
+
+    inline void ir_interpreter_func_context::push(double val) {
+        *stack_ptr++ = ir_element(val);
+    }
+
+    inline void ir_interpreter_func_context::push(int64_t val) {
+        *stack_ptr++ = ir_element(val);
+    }
+
+    inline void ir_interpreter_func_context::push(const std::string &val) {
+        *stack_ptr++ = ir_element(val);
+    }
+
+    inline ir_element ir_interpreter_func_context::pop() {
+        return std::move(*--stack_ptr);
+    }
+
+    inline ir_element ir_interpreter_func_context::get_operand(const uint16_t operand) {
+        if (operand < ir::ir_operand_stack) {
+            return local_args[operand];
+        }
+
+        if (operand == ir::ir_operand_stack) {
+            return pop();
+        }
+
+        return constants[operand & ~ir::ir_operand_constant];
+    }
+
+    inline void ir_interpreter_func_context::set_operand(const uint16_t operand, ir_element &&el) {
+        if (operand == ir::ir_operand_stack) {
+            push(std::move(el));
+            return;
+        }
+
+        local_args[operand] = std::move(el);
+    }
 }
\ No newline at end of file
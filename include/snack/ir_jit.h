@@ -0,0 +1,53 @@
+#pragma once
+
+#include <snack/ir_interpreter.h>
+#include <snack/ir_opcode.h>
+
+namespace snack::ir::backend {
+    /*! \brief Baseline template JIT, for x86-64 Linux.
+     *
+     * A hot function is translated one instruction at a time: number loads, stores, arithmetic
+     * and branches get inline native templates, falling back to the interpreter handler when a
+     * value is not a number. Other simple instructions call their handler directly, without
+     * dispatch. Calls, returns and everything else that changes frames leave the native code,
+     * the interpreter runs them and enters the native code again afterwards.
+     *
+     * Native code belongs to the interpreter that compiled it. Its frames are the only ones running
+     * that copy of the code, so it is unmapped when the interpreter is destroyed.
+     */
+    class ir_jit {
+        using helper = void (*)(ir_interpreter *, ir_interpreter_func_context *);
+
+        template <void (ir_interpreter::*handler)(ir_interpreter_func_context &)>
+        static void call_handler(ir_interpreter *interpreter, ir_interpreter_func_context *context) {
+            (interpreter->*handler)(*context);
+        }
+
+        static helper get_helper(const ir::opcode op);
+
+    public:
+        /*! \brief Check if this build can generate native code. */
+        static bool is_available();
+
+        /*! \brief Check if native code leaves the given instruction to the interpreter.
+         *
+         * With isolate_heap_writes, instructions writing to arrays are left too.
+         */
+        static bool is_exit_op(const ir::opcode op, const bool isolate_heap_writes);
+
+        /*! \brief Compile a function for the given JIT mode, setting its native code on success. */
+        static bool compile(ir_interpreter &interpreter, ir_function_entry &func, const ir_jit_mode mode);
+
+        /*! \brief Record and compile the loop starting at the frame pc.
+         *
+         * The loop runs once in the interpreter while being recorded. The trace is specialized to
+         * numbers: locals stay in registers, arrays indexed by a local are read directly, and every
+         * guard that fails leaves to the interpreter at the matching instruction. Returns nullptr if
+         * the loop does something a trace can't: calls, strings, heap writes or nested loops.
+         */
+        static ir_jit_code trace_loop(ir_interpreter &interpreter, ir_interpreter_func_context &context);
+
+        /*! \brief Unmap native code, nothing may run it anymore. */
+        static void release(const ir_native_block &block);
+    };
+}
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 #include <unordered_map>
 
@@ -12,6 +13,30 @@ namespace snack::ir {
     };
 
     const char *get_op_name(opcode op);
+
+    /*! \brief Operands of the register form (rmov, radd, ...) are 2 bytes each.
+     *
+     * Below ir_operand_stack an operand is a register: arguments first, last argument at 0,
+     * then locals. ir_operand_stack takes the source from, or pushes the result to, the
+     * evaluation stack. With ir_operand_constant set, the rest is a constant index.
+     */
+    constexpr uint16_t ir_operand_stack = 0x4000;
+    constexpr uint16_t ir_operand_constant = 0x8000;
+
+    /*! \brief Check if the opcode belongs to the register form. */
+    bool is_register_op(opcode op);
+
+    /*! \brief Check if the opcode is a number form, which the interpreter quickens generic instructions into.
+     *
+     * Number forms never appear in a SIR binary, they only replace instructions of a decoded stream.
+     */
+    bool is_quickened_op(opcode op);
+
+    /*! \brief Get the generic opcode a number form was quickened from, or the opcode itself. */
+    opcode get_generic_op(opcode op);
+
+    /*! \brief Get the number of operand bytes that follow the opcode in the SIR binary. */
+    size_t get_op_operand_size(opcode op);
 }
 
 namespace std {
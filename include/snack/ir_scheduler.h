@@ -0,0 +1,146 @@
+#pragma once
+
+#include <snack/error.h>
+#include <snack/ir_interpreter.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace snack::userspace {
+    class unit;
+    class unit_manager;
+}
+
+namespace snack::ir::backend {
+    /*! \brief A script function to run on a worker, with its arguments.
+     *
+     * Arguments and results move between threads. Strings that are not interned are copied when
+     * the job is submitted and when its result is given back, objects of another interpreter can't
+     * be passed at all.
+     */
+    struct ir_job {
+        std::shared_ptr<userspace::unit> unit;
+        size_t func_idx;
+
+        std::vector<ir_element> args;
+    };
+
+    // Called on the worker that ran the job, with the index of the job in its batch
+    using ir_job_callback = std::function<void(size_t, ir_element &&)>;
+
+    /*! \brief What a worker did since the scheduler started or its statistics were reset. */
+    struct ir_worker_stats {
+        uint64_t jobs_run;
+
+        // Taken from the queue of another worker
+        uint64_t jobs_stolen;
+
+        std::chrono::nanoseconds busy_time;
+
+        // Busy time over the time elapsed, 0 to 1
+        double utilization;
+    };
+
+    /*! \brief Runs batches of jobs on a fixed pool of worker threads.
+     *
+     * Every worker owns an interpreter with its own heap, all sharing the unit manager and its
+     * units. A batch is dealt round robin over the worker queues. A worker takes jobs from the back
+     * of its own queue, and once it is empty, steals from the front of the others.
+     *
+     * Jobs run to completion with interpret, a job that never returns keeps its worker.
+     */
+    class ir_scheduler {
+        struct task {
+            ir_job job;
+
+            // One of the two is set
+            std::promise<ir_element> promise;
+            std::shared_ptr<ir_job_callback> callback;
+
+            size_t index;
+
+            // Jobs of the batch not finished yet
+            std::shared_ptr<std::atomic<size_t>> batch_left;
+        };
+
+        struct worker {
+            // Only the worker thread throws into it, until a batch is done and it is merged
+            snack::error_manager err_mngr;
+
+            std::unique_ptr<ir_interpreter> interpreter;
+            std::thread thread;
+
+            std::mutex queue_lock;
+            std::deque<task> queue;
+
+            std::atomic<uint64_t> jobs_run;
+            std::atomic<uint64_t> jobs_stolen;
+            std::atomic<int64_t> busy_ns;
+        };
+
+        std::vector<std::unique_ptr<worker>> workers;
+        snack::error_manager *err_manager;
+
+        std::mutex sleep_lock;
+        std::condition_variable wake;
+        std::condition_variable idle;
+
+        // Queued and not taken yet, and submitted and not finished yet
+        std::atomic<size_t> queued;
+        std::atomic<size_t> unfinished;
+
+        bool stopping;
+        size_t next_worker;
+
+        std::chrono::steady_clock::time_point stats_start;
+
+    protected:
+        void enqueue(std::vector<task> &&tasks);
+        std::vector<task> make_tasks(std::vector<ir_job> &&jobs);
+
+        bool take_own(worker &self, task &result);
+        bool steal(worker &self, task &result);
+
+        void run_task(worker &self, task &&job);
+        void work(worker &self);
+
+    public:
+        /*! \brief Start the workers.
+         *
+         * Every worker reports errors to its own error manager. They are all merged into the given
+         * one each time a batch is done, before its last result is given back.
+         */
+        explicit ir_scheduler(snack::error_manager &err_mngr, userspace::unit_manager &manager, const size_t worker_count,
+            const ir_jit_mode jit_mode = ir_jit_mode::off);
+
+        /*! \brief Run every job still queued, then stop the workers. */
+        ~ir_scheduler();
+
+        /*! \brief Queue a batch, each future gives what its job returned.
+         *
+         * A job that can't be started, a host function or a wrong argument count, gives none.
+         */
+        std::vector<std::future<ir_element>> submit(std::vector<ir_job> &&jobs);
+
+        /*! \brief Queue a batch, calling back with each result instead. */
+        void submit(std::vector<ir_job> &&jobs, ir_job_callback callback);
+
+        /*! \brief Wait until every job submitted so far is done. */
+        void wait_idle();
+
+        size_t get_worker_count() const {
+            return workers.size();
+        }
+
+        std::vector<ir_worker_stats> get_worker_stats() const;
+        void reset_worker_stats();
+    };
+}
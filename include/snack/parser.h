@@ -53,6 +53,7 @@ namespace snack {
         std::shared_ptr<node> parse_stmt(node_ptr parent);
         std::shared_ptr<node> parse_function(node_ptr parent);
         std::shared_ptr<node> parse_return(node_ptr parent);
+        std::shared_ptr<node> parse_yield(node_ptr parent);
 
         std::shared_ptr<var_node> parse_var(node_ptr parent);
         std::shared_ptr<if_else_node> parse_if_else(node_ptr parent);
@@ -70,7 +71,8 @@ namespace snack {
         std::shared_ptr<function_call_node> parse_function_call(node_ptr parent);
 
         type_node_ptr make_undefined_type();
-        number_node_ptr make_number(const long double num);
+        // Integer literals too big for 64 bits become doubles
+        number_node_ptr make_number(const std::string &raw);
         string_node_ptr make_string(const std::string &str);
 
         var_node_ptr get_var(node_ptr parent, const std::string &ident_name);
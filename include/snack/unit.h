@@ -2,12 +2,14 @@
 
 #include <snack/ast.h>
 #include <snack/ir_interpreter.h>
+#include <snack/unit_binding.h>
 
 #include <functional>
 #include <map>
 #include <memory>
 #include <optional>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 namespace snack::ir::backend {
@@ -24,6 +26,9 @@ namespace snack::userspace {
             = 0;
         virtual std::optional<size_t> get_function_idx(const std::string &name, size_t arg_count) = 0;
 
+        /*! \brief Point a call site cache at the function, false if there is no such function. */
+        virtual bool resolve_call(const uint8_t idx, ir::backend::ir_call_site &site) = 0;
+
         virtual const std::string &get_unit_name() const = 0;
         virtual std::optional<std::string> get_reference_unit_name(const uint8_t idx) = 0;
     };
@@ -34,16 +39,18 @@ namespace snack::userspace {
 namespace snack::userspace {
     class external_unit : public userspace::unit {
     protected:
-        using function = std::function<void(ir::backend::ir_interpreter_func_context &)>;
+        using function = ir::backend::ir_host_function;
 
         struct func_info {
-            function real_func;
+            function func;
+            void *object;
             std::string name;
             int16_t arg_count;
 
-            func_info(function func, const std::string &name, int16_t arg_count)
-                : real_func(func)
-                , name(name) 
+            func_info(function func, void *object, const std::string &name, int16_t arg_count)
+                : func(func)
+                , object(object)
+                , name(name)
                 , arg_count(arg_count) {}
         };
 
@@ -51,9 +58,42 @@ namespace snack::userspace {
 
         std::string name;
 
+        template <auto func>
+        static void call_raw(void *object, ir::backend::ir_interpreter_func_context &context) {
+            using owner = typename host_signature<decltype(func)>::owner;
+            (static_cast<owner *>(object)->*func)(context);
+        }
+
     protected:
         std::vector<func_info> functions;
 
+        /*! \brief Register a member function of this unit, marshalled from its signature.
+         *
+         * The argument count is the number of parameters, so calls with another count never link
+         * to it. See host_signature for what the generated code does.
+         */
+        template <auto func>
+        void bind(const std::string &func_name) {
+            using signature = host_signature<decltype(func)>;
+
+            functions.emplace_back(&signature::template call<func>, static_cast<typename signature::owner *>(this),
+                func_name, static_cast<int16_t>(signature::arg_count));
+        }
+
+        /*! \brief Register a member function taking only the frame, popping and pushing by itself.
+         *
+         * For what can't be typed: any number of arguments (-1), or a result that arrives later.
+         */
+        template <auto func>
+        void bind(const std::string &func_name, const int16_t arg_count) {
+            using owner = typename host_signature<decltype(func)>::owner;
+
+            static_assert(std::is_same_v<decltype(func), void (owner::*)(ir::backend::ir_interpreter_func_context &)>,
+                "Functions bound with an argument count take only the frame");
+
+            functions.emplace_back(&call_raw<func>, static_cast<owner *>(this), func_name, arg_count);
+        }
+
     public:
         external_unit() {}
         external_unit(const std::string &unit_name);
@@ -62,6 +102,7 @@ namespace snack::userspace {
 
         bool call_function(ir::backend::ir_interpreter *interpreter, const uint8_t idx,
             ir::backend::ir_interpreter_func_context *context) override;
+        bool resolve_call(const uint8_t idx, ir::backend::ir_call_site &site) override;
 
         const std::string &get_unit_name() const override {
             return name;
@@ -74,11 +115,23 @@ namespace snack::userspace {
         }
     };
 
-    class interpreted_unit : public userspace::unit {  
+    /*! \brief A loaded SIR binary.
+     *
+     * Everything is decoded when the unit is made and never written afterwards, so interpreters on
+     * several threads can run it at once. Each of them runs a copy it may change, see
+     * ir::backend::ir_unit_instance. Must be owned by a shared pointer.
+     */
+    class interpreted_unit : public userspace::unit, public std::enable_shared_from_this<interpreted_unit> {
         struct interpreted_unit_func_info {
             std::string name;
             size_t addr;
             size_t arg_count;
+
+            size_t max_stack;
+            size_t local_count;
+
+            // Index of the met instruction in the decoded stream
+            size_t entry;
         };
 
         const char *ir_bin;
@@ -87,8 +140,23 @@ namespace snack::userspace {
         std::vector<interpreted_unit_func_info> functions;
         std::vector<std::string> unit_ref_names;
 
+        // Decoded instructions of every function, back to back
+        std::vector<ir::backend::ir_instruction> code;
+
+        std::vector<ir::backend::ir_element> constants;
+        std::unordered_map<size_t, uint32_t> constant_indexes;
+
+        // One per call instruction, and the entry of every function, in function order
+        std::vector<ir::backend::ir_call_site> call_sites;
+        std::vector<ir::backend::ir_function_entry> entries;
+
     protected:
         void query_entries();
+        void decode_function(interpreted_unit_func_info &info);
+
+        // Constant pool index of a number or string data entry, loaded the first time it is asked for
+        std::optional<uint32_t> get_constant_index(const size_t data_addr, const bool number);
+        std::optional<uint16_t> decode_register_operand(const interpreted_unit_func_info &info, const uint16_t operand);
 
     public:
         interpreted_unit() {}
@@ -98,6 +166,7 @@ namespace snack::userspace {
 
         bool call_function(ir::backend::ir_interpreter *interpreter, const uint8_t idx,
             ir::backend::ir_interpreter_func_context *context) override;
+        bool resolve_call(const uint8_t idx, ir::backend::ir_call_site &site) override;
 
         const std::string &get_unit_name() const override {
             return name;
@@ -105,7 +174,18 @@ namespace snack::userspace {
 
         std::optional<size_t> get_function_idx(const std::string &name, size_t arg_count) override;
         std::optional<std::string> get_reference_unit_name(const uint8_t idx) override;
-    };
 
-#define REGISTER_UNIT_FUNC(unit, name, func, arg_count) functions.push_back(external_unit::func_info{ std::bind(&unit::##func, this, std::placeholders::_1), name, arg_count })
+        // The decoded stream as loaded, interpreters quicken their own copy
+        const std::vector<ir::backend::ir_instruction> &get_code() const {
+            return code;
+        }
+
+        const std::vector<ir::backend::ir_call_site> &get_call_sites() const {
+            return call_sites;
+        }
+
+        const std::vector<ir::backend::ir_function_entry> &get_entries() const {
+            return entries;
+        }
+    };
 }
\ No newline at end of file
@@ -5,14 +5,42 @@
 namespace snack::userspace {
     class std_unit : public external_unit {
         void print(ir::backend::ir_interpreter_func_context &context);
-        void sin(ir::backend::ir_interpreter_func_context &context);
-        void cos(ir::backend::ir_interpreter_func_context &context);
-        void tan(ir::backend::ir_interpreter_func_context &context);
+        double sin(const double num);
+        double cos(const double num);
+        double tan(const double num);
 
         void fopen(ir::backend::ir_interpreter_func_context &context);
         void fclose(ir::backend::ir_interpreter_func_context &context);
 
-        void length(ir::backend::ir_interpreter_func_context &context);
+        int64_t length(ir::backend::ir_interpreter_func_context &context, const ir::backend::ir_element &el);
+
+        ir::backend::ir_element start_coroutine(ir::backend::ir_interpreter_func_context &context,
+            const std::string &name, const std::vector<ir::backend::ir_element> &args);
+        ir::backend::ir_element coroutine(ir::backend::ir_interpreter_func_context &context, const std::string &name);
+        ir::backend::ir_element coroutine_with_arg(ir::backend::ir_interpreter_func_context &context,
+            const std::string &name, const ir::backend::ir_element &arg);
+        void resume(ir::backend::ir_interpreter_func_context &context);
+        int64_t alive(ir::backend::ir_interpreter_func_context &context, const ir::backend::ir_element &el);
+
+        // Whole array operations on numbers, vectorized over packed arrays. Elements of other types are
+        // skipped, doubles are summed in no particular order.
+        ir::backend::ir_element sum(ir::backend::ir_interpreter_func_context &context, const ir::backend::ir_element &arr);
+        ir::backend::ir_element min(ir::backend::ir_interpreter_func_context &context, const ir::backend::ir_element &arr);
+        ir::backend::ir_element max(ir::backend::ir_interpreter_func_context &context, const ir::backend::ir_element &arr);
+        ir::backend::ir_element dot(ir::backend::ir_interpreter_func_context &context, const ir::backend::ir_element &lhs,
+            const ir::backend::ir_element &rhs);
+        int64_t find(ir::backend::ir_interpreter_func_context &context, const ir::backend::ir_element &arr,
+            const ir::backend::ir_element &val);
+        int64_t count(ir::backend::ir_interpreter_func_context &context, const ir::backend::ir_element &arr,
+            const ir::backend::ir_element &val);
+
+        // Stores go through the usual element typing rules
+        void fill(ir::backend::ir_interpreter_func_context &context, const ir::backend::ir_element &arr,
+            const ir::backend::ir_element &val);
+        void copy(ir::backend::ir_interpreter_func_context &context, const ir::backend::ir_element &dst,
+            const ir::backend::ir_element &src);
+        void add_scalar(ir::backend::ir_interpreter_func_context &context, const ir::backend::ir_element &arr,
+            const ir::backend::ir_element &val);
 
     public :
         explicit std_unit();
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <snack/ir_interpreter.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+namespace snack::userspace {
+    /*! \brief How a C++ type is read from and written to a script value.
+     *
+     * Binding a function with any other parameter or return type fails to compile.
+     */
+    template <typename T, typename = void>
+    struct host_value;
+
+    template <typename T>
+    struct host_value<T, std::enable_if_t<std::is_integral_v<T>>> {
+        static bool is(const ir::backend::ir_element &el) {
+            return el.is_number();
+        }
+
+        static T get(const ir::backend::ir_element &el) {
+            return static_cast<T>(el.get_integer());
+        }
+
+        static void push(ir::backend::ir_interpreter_func_context &context, const T val) {
+            context.push(static_cast<int64_t>(val));
+        }
+    };
+
+    template <typename T>
+    struct host_value<T, std::enable_if_t<std::is_floating_point_v<T>>> {
+        static bool is(const ir::backend::ir_element &el) {
+            return el.is_number();
+        }
+
+        static T get(const ir::backend::ir_element &el) {
+            return static_cast<T>(el.get_number());
+        }
+
+        static void push(ir::backend::ir_interpreter_func_context &context, const T val) {
+            context.push(static_cast<double>(val));
+        }
+    };
+
+    template <>
+    struct host_value<std::string> {
+        static bool is(const ir::backend::ir_element &el) {
+            return el.type == ir::backend::ir_element::str;
+        }
+
+        // Valid while the popped argument is, which is the whole call
+        static const std::string &get(const ir::backend::ir_element &el) {
+            return el.get_string();
+        }
+
+        static void push(ir::backend::ir_interpreter_func_context &context, const std::string &val) {
+            context.push(val);
+        }
+    };
+
+    // Any value, checked by the function itself
+    template <>
+    struct host_value<ir::backend::ir_element> {
+        static bool is(const ir::backend::ir_element &) {
+            return true;
+        }
+
+        static const ir::backend::ir_element &get(const ir::backend::ir_element &el) {
+            return el;
+        }
+
+        static void push(ir::backend::ir_interpreter_func_context &context, ir::backend::ir_element &&val) {
+            context.push(std::move(val));
+        }
+    };
+
+    template <typename T>
+    using host_value_of = host_value<std::remove_cv_t<std::remove_reference_t<T>>>;
+
+    /*! \brief Marshalling of a typed host function, generated from its signature.
+     *
+     * Arguments are popped first to last and checked before anything is called. If one has the
+     * wrong type, the function is not called and the call gives none, like any call leaving
+     * nothing behind. A first parameter of ir_interpreter_func_context & gets the frame of the
+     * caller and takes no argument.
+     */
+    template <typename F>
+    struct host_signature;
+
+    template <typename C, typename R, typename... Args>
+    struct host_signature<R (C::*)(Args...)> {
+        using owner = C;
+        static constexpr size_t arg_count = sizeof...(Args);
+
+        template <auto func, typename... Front>
+        static void invoke(C *object, ir::backend::ir_interpreter_func_context &context, Front &...front) {
+            ir::backend::ir_element values[arg_count + 1];
+
+            for (size_t i = 0; i < arg_count; i++) {
+                values[i] = context.pop();
+            }
+
+            invoke_with<func>(object, context, values, std::index_sequence_for<Args...>{}, front...);
+        }
+
+        template <auto func, size_t... I, typename... Front>
+        static void invoke_with(C *object, ir::backend::ir_interpreter_func_context &context,
+            const ir::backend::ir_element *values, std::index_sequence<I...>, Front &...front) {
+            if (!(host_value_of<Args>::is(values[I]) && ...)) {
+                return;
+            }
+
+            if constexpr (std::is_void_v<R>) {
+                (object->*func)(front..., host_value_of<Args>::get(values[I])...);
+            } else {
+                host_value_of<R>::push(context, (object->*func)(front..., host_value_of<Args>::get(values[I])...));
+            }
+        }
+
+        template <auto func>
+        static void call(void *object, ir::backend::ir_interpreter_func_context &context) {
+            invoke<func>(static_cast<C *>(object), context);
+        }
+    };
+
+    template <typename C, typename R, typename... Args>
+    struct host_signature<R (C::*)(ir::backend::ir_interpreter_func_context &, Args...)> {
+        using owner = C;
+        static constexpr size_t arg_count = sizeof...(Args);
+
+        template <auto func>
+        static void call(void *object, ir::backend::ir_interpreter_func_context &context) {
+            host_signature<R (C::*)(Args...)>::template invoke<func>(static_cast<C *>(object), context, context);
+        }
+    };
+}
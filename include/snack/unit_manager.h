@@ -3,7 +3,9 @@
 #include <snack/error.h>
 #include <snack/unit.h>
 
+#include <atomic>
 #include <cstdio>
+#include <mutex>
 #include <string>
 #include <unordered_map>
 
@@ -12,12 +14,22 @@ namespace snack::ir::backend {
 }
 
 namespace snack::userspace {
+    /*! \brief Finds and loads units by name.
+     *
+     * Shared by every interpreter, on any thread: units are only looked up, added or replaced under
+     * the lock.
+     */
     class unit_manager {
+        std::mutex units_lock;
+
         std::unordered_map<std::string, unit_ptr> units;
         std::vector<std::string> search_paths;
 
         std::unordered_map<std::string, std::vector<char>> unit_buffer_map;
 
+        // Moves every time a unit is replaced, call sites resolved before that are stale
+        std::atomic<uint64_t> generation;
+
         snack::error_manager *err_mngr;
 
     protected:
@@ -33,5 +45,12 @@ namespace snack::userspace {
 
         void add_external_unit(unit_ptr unit);
         void add_search_path(const std::string &path);
+
+        /*! \brief Add the unit, or replace the one with the same name. */
+        void replace_unit(unit_ptr unit);
+
+        uint64_t get_generation() const {
+            return generation.load(std::memory_order_acquire);
+        }
     };
 }
\ No newline at end of file
@@ -45,13 +45,30 @@ namespace snack {
 
     number_node::number_node(node_ptr parent, const long double nval)
         : node(parent, node_type::number, token{})
-        , val(nval) {
+        , val(nval)
+        , int_val(0)
+        , integer(false) {
+    }
+
+    number_node::number_node(node_ptr parent, const int64_t nval)
+        : node(parent, node_type::number, token{})
+        , val(static_cast<long double>(nval))
+        , int_val(nval)
+        , integer(true) {
     }
 
     const long double number_node::get_value() const {
         return val;
     }
 
+    const int64_t number_node::get_integer() const {
+        return int_val;
+    }
+
+    bool number_node::is_integer() const {
+        return integer;
+    }
+
     expr_node::expr_node(node_ptr parent, token tok)
         : stmt_node(parent, node_type::expr, tok) {
     }
@@ -115,6 +132,10 @@ namespace snack {
         : stmt_node(parent, node_type::ret, tok) {
     }
 
+    yield_node::yield_node(node_ptr parent, token tok)
+        : stmt_node(parent, node_type::yield, tok) {
+    }
+
     null_node::null_node(node_ptr parent, token tok)
         : node(parent, node_type::null, tok) {
     }
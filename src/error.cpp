@@ -178,6 +178,23 @@ namespace snack {
         return true;
     }
 
+    void error_manager::merge(error_manager &from) {
+        std::map<int, error> taken;
+
+        {
+            std::lock_guard guard(from.mut);
+            taken.swap(from.errors);
+
+            actual_error += from.actual_error.exchange(0);
+        }
+
+        std::lock_guard guard(mut);
+
+        for (auto &err : taken) {
+            errors.emplace(++error_id_counter, std::move(err.second));
+        }
+    }
+
     bool error_manager::dump_all_error() {
         for (auto &hole_pair : error_dump_holes) {
             for (auto &err : errors) {
@@ -0,0 +1,76 @@
+#include <snack/ir_interpreter.h>
+
+#include <new>
+
+namespace snack::ir::backend {
+    // Set by the interpreter while it runs an invocation in arena mode
+    static thread_local ir_arena *string_arena = nullptr;
+
+    ir_string *ir_new_string(std::string &&value) {
+        return string_arena ? string_arena->make_string(std::move(value)) : new ir_string(std::move(value));
+    }
+
+    ir_arena *ir_set_string_arena(ir_arena *arena) {
+        ir_arena *const previous = string_arena;
+        string_arena = arena;
+
+        return previous;
+    }
+
+    static uint8_t *align_up(uint8_t *ptr, const size_t align) {
+        return reinterpret_cast<uint8_t *>((reinterpret_cast<uintptr_t>(ptr) + align - 1) & ~(align - 1));
+    }
+
+    ir_arena::ir_arena(const size_t block_size)
+        : block_size(block_size)
+        , current(0)
+        , pos(nullptr)
+        , end(nullptr) {
+    }
+
+    void *ir_arena::allocate(const size_t size, const size_t align) {
+        uint8_t *aligned = align_up(pos, align);
+
+        if (pos && aligned + size <= end) {
+            pos = aligned + size;
+            return aligned;
+        }
+
+        if (size + align > block_size) {
+            oversized.emplace_back(new uint8_t[size + align]);
+            return align_up(oversized.back().get(), align);
+        }
+
+        // The next block, kept from an earlier round or a new one
+        if (pos) {
+            current++;
+        }
+
+        if (current == blocks.size()) {
+            blocks.emplace_back(new uint8_t[block_size]);
+        }
+
+        pos = blocks[current].get();
+        end = pos + block_size;
+
+        aligned = align_up(pos, align);
+        pos = aligned + size;
+
+        return aligned;
+    }
+
+    ir_string *ir_arena::make_string(std::string &&value) {
+        ir_string *str = new (allocate(sizeof(ir_string), alignof(ir_string))) ir_string(std::move(value));
+        str->arena = true;
+
+        return str;
+    }
+
+    void ir_arena::reset() {
+        oversized.clear();
+        current = 0;
+
+        pos = blocks.empty() ? nullptr : blocks.front().get();
+        end = pos ? pos + block_size : nullptr;
+    }
+}
@@ -1,9 +1,29 @@
 #include <snack/ir_compiler.h>
 #include <snack/ir_opcode.h>
 
+#include <cstring>
+
 namespace snack::ir::backend {
-    ir_compiler::ir_compiler(snack::error_manager &mngr, snack::userspace::unit_manager &unit_mngr)
-        : err_mngr(&mngr)
+    ir_number_constant ir_number_constant::of_integer(const int64_t val) {
+        return ir_number_constant{ true, static_cast<uint64_t>(val) };
+    }
+
+    ir_number_constant ir_number_constant::of_node(const number_node &node) {
+        if (node.is_integer()) {
+            return of_integer(node.get_integer());
+        }
+
+        const double val = static_cast<double>(node.get_value());
+
+        ir_number_constant res{ false, 0 };
+        std::memcpy(&res.bits, &val, sizeof(val));
+
+        return res;
+    }
+
+    ir_compiler::ir_compiler(snack::error_manager &mngr, snack::userspace::unit_manager &unit_mngr, const bool register_form)
+        : register_form(register_form)
+        , err_mngr(&mngr)
         , unit_mngr(&unit_mngr) {
     }
 
@@ -25,6 +45,86 @@ namespace snack::ir::backend {
         }
     }
 
+    // How many values an opcode leaves on the operand stack, minus what it takes. Calls are not
+    // here, they take their arguments and always leave exactly one value behind.
+    static int get_stack_effect(opcode op) {
+        switch (op) {
+        case opcode::ldcst:
+        case opcode::ldcststr:
+        case opcode::ldlc:
+        case opcode::ldarg:
+        case opcode::ldnull:
+        case opcode::newarr:
+        case opcode::newobj:
+        case opcode::ldelmlc:
+            return 1;
+
+        case opcode::ldlc2:
+        case opcode::ldlccst:
+        case opcode::ldargcst:
+            return 2;
+
+        case opcode::add:
+        case opcode::sub:
+        case opcode::mul:
+        case opcode::div:
+        case opcode::mod:
+        case opcode::and:
+        case opcode::or:
+        case opcode::xor:
+        case opcode::pwr:
+        case opcode::shl:
+        case opcode::shr:
+        case opcode::ceq:
+        case opcode::clt:
+        case opcode::cle:
+        case opcode::cgt:
+        case opcode::cge:
+        case opcode::ldelm:
+        case opcode::strlc:
+        case opcode::strarg:
+        case opcode::brt:
+        case opcode::brf:
+        case opcode::ret:
+        case opcode::yield:
+        case opcode::pop:
+            return -1;
+
+        case opcode::ble:
+        case opcode::blt:
+        case opcode::bge:
+        case opcode::bgt:
+        case opcode::beq:
+        case opcode::addstlc:
+        case opcode::bnlt:
+        case opcode::bnle:
+        case opcode::bngt:
+        case opcode::bnge:
+        case opcode::bneq:
+            return -2;
+
+        case opcode::strelm:
+            return -3;
+
+        default:
+            break;
+        }
+
+        return 0;
+    }
+
+    void ir_compiler::adjust_stack_depth(int effect) {
+        ir_function &func = funcs.back();
+
+        if (effect < 0 && func.stack_depth < static_cast<size_t>(-effect)) {
+            func.stack_depth = 0;
+        } else {
+            func.stack_depth += effect;
+        }
+
+        func.max_stack_depth = std::max(func.max_stack_depth, func.stack_depth);
+    }
+
     void ir_compiler::emit(opcode op) {
         ir_op_info op_info;
         op_info.op = op;
@@ -35,6 +135,8 @@ namespace snack::ir::backend {
 
         funcs.back().crr_pc += 2;
         funcs.back().opcodes.push_back(op_info);
+
+        adjust_stack_depth(get_stack_effect(op));
     }
 
     void ir_compiler::emit(opcode op, long double value) {
@@ -48,18 +150,9 @@ namespace snack::ir::backend {
         funcs.back().crr_pc += 2;
         funcs.back().opcodes.push_back(op_info);
 
-        switch (op) {
-        case opcode::ldcst: {
-            relocate_number_list[value].push_back(op_info.bin_addr + 2);
-            funcs.back().crr_pc += sizeof(size_t);
-
-            size_t holder = 0;
-
-            ir_bin.write(reinterpret_cast<const char *>(&holder), sizeof(size_t));
-
-            break;
-        }
+        adjust_stack_depth(get_stack_effect(op));
 
+        switch (op) {
         case opcode::beq:
         case opcode::bge:
         case opcode::bgt:
@@ -67,7 +160,12 @@ namespace snack::ir::backend {
         case opcode::ble:
         case opcode::br:
         case opcode::brt:
-        case opcode::brf: {
+        case opcode::brf:
+        case opcode::bnlt:
+        case opcode::bnle:
+        case opcode::bngt:
+        case opcode::bnge:
+        case opcode::bneq: {
             size_t jump_addr = static_cast<size_t>(value);
 
             ir_bin.write(reinterpret_cast<const char *>(&jump_addr), sizeof(size_t));
@@ -78,6 +176,7 @@ namespace snack::ir::backend {
 
         case opcode::ldarg:
         case opcode::ldlc:
+        case opcode::addstlc:
         case opcode::strarg:
         case opcode::strlc:
         case opcode::vri:
@@ -89,11 +188,18 @@ namespace snack::ir::backend {
             break;
         }
 
-        case opcode::call: {
-            uint32_t idx = static_cast<uint32_t>(value);
+        case opcode::call:
+        case opcode::tcall: {
+            // Unit and function index, then the argument count in the fifth byte
+            const uint64_t call_info = static_cast<uint64_t>(value);
+            const uint32_t idx = static_cast<uint32_t>(call_info);
+            const uint8_t arg_count = static_cast<uint8_t>(call_info >> 32);
 
             ir_bin.write(reinterpret_cast<const char *>(&idx), 4);
-            funcs.back().crr_pc += 4;
+            ir_bin.write(reinterpret_cast<const char *>(&arg_count), 1);
+            funcs.back().crr_pc += 5;
+
+            adjust_stack_depth(1 - static_cast<int>(arg_count));
             break;
         }
 
@@ -113,6 +219,8 @@ namespace snack::ir::backend {
         funcs.back().crr_pc += 2;
         funcs.back().opcodes.push_back(op_info);
 
+        adjust_stack_depth(get_stack_effect(op));
+
         switch (op) {
         case opcode::ldcststr: {
             relocate_string_list[value].push_back(op_info.bin_addr + 2);
@@ -129,6 +237,26 @@ namespace snack::ir::backend {
         }
     }
 
+    void ir_compiler::emit(opcode op, const ir_number_constant &value) {
+        ir_op_info op_info;
+        op_info.op = op;
+        op_info.bin_addr = ir_bin.tellp();
+        op_info.pc_context_addr = funcs.back().crr_pc;
+
+        ir_bin.write(reinterpret_cast<const char *>(&op), 2);
+
+        // ldcst, the data address is filled in with the data section
+        relocate_number_list[value].push_back(op_info.bin_addr + 2);
+
+        size_t holder = 0;
+        ir_bin.write(reinterpret_cast<const char *>(&holder), sizeof(size_t));
+
+        funcs.back().crr_pc += 2 + sizeof(size_t);
+        funcs.back().opcodes.push_back(op_info);
+
+        adjust_stack_depth(get_stack_effect(op));
+    }
+
     void ir_compiler::emit(opcode op, long double nval, const std::string &sval) {
         ir_op_info op_info;
         op_info.op = op;
@@ -140,6 +268,8 @@ namespace snack::ir::backend {
         funcs.back().crr_pc += 2;
         funcs.back().opcodes.push_back(op_info);
 
+        adjust_stack_depth(get_stack_effect(op));
+
         switch (op) {
         case opcode::met: {
             uint16_t num_args = static_cast<uint16_t>(nval);
@@ -150,7 +280,11 @@ namespace snack::ir::backend {
             size_t holder = 0;
             ir_bin.write(reinterpret_cast<const char *>(&holder), sizeof(size_t));
 
-            funcs.back().crr_pc += sizeof(size_t) + 2;
+            // Max operand stack depth and local count, filled when the function is done
+            uint16_t frame_info[2] = { 0, 0 };
+            ir_bin.write(reinterpret_cast<const char *>(frame_info), sizeof(frame_info));
+
+            funcs.back().crr_pc += sizeof(size_t) + 2 + sizeof(frame_info);
             break;
         }
 
@@ -159,25 +293,123 @@ namespace snack::ir::backend {
         }
     }
 
+    void ir_compiler::emit(opcode op, uint16_t dest, uint16_t lhs, uint16_t rhs) {
+        ir_op_info op_info;
+        op_info.op = op;
+        op_info.bin_addr = ir_bin.tellp();
+        op_info.pc_context_addr = funcs.back().crr_pc;
+
+        const uint16_t operands[3] = { dest, lhs, rhs };
+        const size_t operand_size = get_op_operand_size(op);
+
+        ir_bin.write(reinterpret_cast<const char *>(&op), 2);
+        ir_bin.write(reinterpret_cast<const char *>(operands), operand_size);
+
+        funcs.back().crr_pc += 2 + operand_size;
+        funcs.back().opcodes.push_back(op_info);
+
+        // Stack sources are taken before the result is stored
+        int effect = 0;
+
+        for (size_t i = 1; i < operand_size / 2; i++) {
+            if (operands[i] == ir_operand_stack) {
+                effect--;
+            }
+        }
+
+        adjust_stack_depth(effect);
+
+        if (dest == ir_operand_stack) {
+            adjust_stack_depth(1);
+        }
+    }
+
+    void ir_compiler::emit_super(opcode op, size_t slot, size_t second_slot) {
+        ir_op_info op_info;
+        op_info.op = op;
+        op_info.bin_addr = ir_bin.tellp();
+        op_info.pc_context_addr = funcs.back().crr_pc;
+
+        // Two local slots
+        const uint8_t slots[2] = { static_cast<uint8_t>(slot), static_cast<uint8_t>(second_slot) };
+
+        ir_bin.write(reinterpret_cast<const char *>(&op), 2);
+        ir_bin.write(reinterpret_cast<const char *>(slots), 2);
+
+        funcs.back().crr_pc += 2 + get_op_operand_size(op);
+        funcs.back().opcodes.push_back(op_info);
+
+        adjust_stack_depth(get_stack_effect(op));
+    }
+
+    void ir_compiler::emit_super(opcode op, size_t slot, const ir_number_constant &value) {
+        ir_op_info op_info;
+        op_info.op = op;
+        op_info.bin_addr = ir_bin.tellp();
+        op_info.pc_context_addr = funcs.back().crr_pc;
+
+        const uint8_t first_slot = static_cast<uint8_t>(slot);
+
+        ir_bin.write(reinterpret_cast<const char *>(&op), 2);
+        ir_bin.write(reinterpret_cast<const char *>(&first_slot), 1);
+
+        // A local or argument slot, then a number constant like ldcst
+        relocate_number_list[value].push_back(op_info.bin_addr + 3);
+
+        size_t holder = 0;
+        ir_bin.write(reinterpret_cast<const char *>(&holder), sizeof(size_t));
+
+        funcs.back().crr_pc += 2 + get_op_operand_size(op);
+        funcs.back().opcodes.push_back(op_info);
+
+        adjust_stack_depth(get_stack_effect(op));
+    }
+
     void ir_compiler::build_function(function_node_ptr func) {
         ir_function func_ir;
         func_ir.crr_pc = 0;
+        func_ir.stack_depth = 0;
+        func_ir.max_stack_depth = 0;
 
         funcs.push_back(func_ir);
 
         emit(opcode::met, func->get_args().size(), func->get_name());
 
         for (const auto &node : func->get_childrens()) {
-            build_node(func, node);
+            build_statement(func, node);
         }
 
         emit(opcode::endmet);
+
+        const uint16_t frame_info[2] = { static_cast<uint16_t>(funcs.back().max_stack_depth),
+            static_cast<uint16_t>(func->get_local_vars().size()) };
+
+        const size_t last_pos = ir_bin.tellp();
+
+        ir_bin.seekp(funcs.back().opcodes[0].bin_addr + 4 + sizeof(size_t));
+        ir_bin.write(reinterpret_cast<const char *>(frame_info), sizeof(frame_info));
+        ir_bin.seekp(last_pos);
+    }
+
+    void ir_compiler::build_statement(function_node_ptr func, node_ptr node) {
+        build_node(func, node);
+
+        // Nobody uses the value of an expression statement, don't let it pile up on the stack
+        switch (node->get_node_type()) {
+        case node_type::function_call:
+        case node_type::caculate:
+            emit(opcode::pop);
+            break;
+
+        default:
+            break;
+        }
     }
 
     void ir_compiler::build_array_push(function_node_ptr func, std::shared_ptr<array_node> node, uint32_t arr_var_index) {
         for (size_t i = 0; i < node->get_init_elements().size(); i++) {
             emit(opcode::ldlc, arr_var_index);
-            emit(opcode::ldcst, i);
+            emit(opcode::ldcst, ir_number_constant::of_integer(static_cast<int64_t>(i)));
 
             build_push_hs(func, node->get_init_elements()[i]);
 
@@ -213,7 +445,7 @@ namespace snack::ir::backend {
         switch (nt) {
         case node_type::number: {
             std::shared_ptr<number_node> num = std::dynamic_pointer_cast<number_node>(node);
-            emit(opcode::ldcst, num->get_value());
+            emit(opcode::ldcst, ir_number_constant::of_node(*num));
 
             break;
         }
@@ -264,6 +496,15 @@ namespace snack::ir::backend {
                     emit(opcode::ldlc, idx);
                 }
             } else {
+                auto index_slot = (v->get_index() && v->get_index()->get_node_type() == node_type::var)
+                    ? get_local_slot(func, v->get_index())
+                    : std::optional<size_t>{};
+
+                if (!is_arg && index_slot) {
+                    emit_super(opcode::ldelmlc, idx, *index_slot);
+                    break;
+                }
+
                 if (is_arg) {
                     emit(opcode::ldarg, idx);
                 } else {
@@ -294,9 +535,308 @@ namespace snack::ir::backend {
         }
     }
 
+    std::optional<uint16_t> ir_compiler::get_register(function_node_ptr func, node_ptr var) {
+        const auto &args = func->get_args();
+
+        for (size_t i = 0; i < args.size(); i++) {
+            if (args[i] == var) {
+                return static_cast<uint16_t>(args.size() - 1 - i);
+            }
+        }
+
+        const auto &locals = func->get_local_vars();
+        auto local = std::find(locals.begin(), locals.end(), var);
+
+        if (local == locals.end()) {
+            return std::optional<uint16_t>{};
+        }
+
+        const size_t reg = args.size() + (local - locals.begin());
+
+        if (reg >= ir_operand_stack) {
+            return std::optional<uint16_t>{};
+        }
+
+        return static_cast<uint16_t>(reg);
+    }
+
+    std::optional<size_t> ir_compiler::get_arg_slot(function_node_ptr func, node_ptr var) {
+        const auto &args = func->get_args();
+        auto arg = std::find(args.begin(), args.end(), var);
+
+        if (arg == args.end()) {
+            return std::optional<size_t>{};
+        }
+
+        return arg - args.begin();
+    }
+
+    std::optional<size_t> ir_compiler::get_local_slot(function_node_ptr func, node_ptr var) {
+        // Arguments are in the local list too, but they are loaded from the argument slots
+        if (get_arg_slot(func, var)) {
+            return std::optional<size_t>{};
+        }
+
+        const auto &locals = func->get_local_vars();
+        auto local = std::find(locals.begin(), locals.end(), var);
+
+        if (local == locals.end()) {
+            return std::optional<size_t>{};
+        }
+
+        return local - locals.begin();
+    }
+
+    uint16_t ir_compiler::get_constant_operand(const ir_number_constant &value) {
+        auto found = register_number_constants.find(value);
+
+        if (found != register_number_constants.end()) {
+            return ir_operand_constant | found->second;
+        }
+
+        const uint16_t index = static_cast<uint16_t>(const_table.size());
+
+        // Make sure the data entry is written, its address is filled in when it is
+        relocate_number_list[value];
+        register_number_constants.emplace(value, index);
+        const_table.push_back(0);
+
+        return ir_operand_constant | index;
+    }
+
+    uint16_t ir_compiler::get_constant_operand(const std::string &value) {
+        auto found = register_string_constants.find(value);
+
+        if (found != register_string_constants.end()) {
+            return ir_operand_constant | found->second;
+        }
+
+        const uint16_t index = static_cast<uint16_t>(const_table.size());
+
+        relocate_string_list[value];
+        register_string_constants.emplace(value, index);
+        const_table.push_back(0);
+
+        return ir_operand_constant | index;
+    }
+
+    uint16_t ir_compiler::build_operand(function_node_ptr func, node_ptr node) {
+        // Constant operands have 15 bits of index, past that they go through the stack
+        const bool const_table_full = const_table.size() >= ir_operand_constant - 1;
+
+        switch (node->get_node_type()) {
+        case node_type::number: {
+            const ir_number_constant value = ir_number_constant::of_node(*std::dynamic_pointer_cast<number_node>(node));
+
+            if (!const_table_full || register_number_constants.count(value)) {
+                return get_constant_operand(value);
+            }
+
+            break;
+        }
+
+        case node_type::string: {
+            const std::string &value = std::dynamic_pointer_cast<string_node>(node)->get_string();
+
+            if (!const_table_full || register_string_constants.count(value)) {
+                return get_constant_operand(value);
+            }
+
+            break;
+        }
+
+        case node_type::var: {
+            auto reg = get_register(func, node);
+
+            if (reg) {
+                return *reg;
+            }
+
+            break;
+        }
+
+        default:
+            break;
+        }
+
+        build_push_hs(func, node);
+        return ir_operand_stack;
+    }
+
+    bool ir_compiler::build_caculate_to(function_node_ptr func, std::shared_ptr<caculate_node> node, uint16_t dest) {
+        opcode op;
+
+        switch (node->get_op()) {
+        case caculate_op::add:
+            op = opcode::radd;
+            break;
+
+        case caculate_op::sub:
+            op = opcode::rsub;
+            break;
+
+        case caculate_op::div:
+            op = opcode::rdiv;
+            break;
+
+        case caculate_op::mul:
+            op = opcode::rmul;
+            break;
+
+        case caculate_op::and:
+        case caculate_op::logical_and:
+            op = opcode::rand;
+            break;
+
+        case caculate_op:: or:
+        case caculate_op::logical_or:
+            op = opcode::ror;
+            break;
+
+        case caculate_op:: xor:
+            op = opcode::rxor;
+            break;
+
+        case caculate_op::power:
+            op = opcode::rpwr;
+            break;
+
+        case caculate_op::shl:
+            op = opcode::rshl;
+            break;
+
+        case caculate_op::shr:
+            op = opcode::rshr;
+            break;
+
+        case caculate_op::equal:
+            op = opcode::rceq;
+            break;
+
+        case caculate_op::greater:
+            op = opcode::rcgt;
+            break;
+
+        case caculate_op::greater_equal:
+            op = opcode::rcge;
+            break;
+
+        case caculate_op::less:
+            op = opcode::rclt;
+            break;
+
+        case caculate_op::less_equal:
+            op = opcode::rcle;
+            break;
+
+        default:
+            return false;
+        }
+
+        const uint16_t lhs = build_operand(func, node->get_lhs());
+        const uint16_t rhs = build_operand(func, node->get_rhs());
+
+        emit(op, dest, lhs, rhs);
+
+        return true;
+    }
+
+    bool ir_compiler::build_unary_to(function_node_ptr func, std::shared_ptr<unary_node> node, uint16_t dest) {
+        opcode op;
+
+        switch (node->get_unary_op()) {
+        case caculate_op::not:
+            op = opcode::runo;
+            break;
+
+        case caculate_op::sub:
+            op = opcode::rung;
+            break;
+
+        case caculate_op::reverse:
+            op = opcode::ruin;
+            break;
+
+        case caculate_op::add:
+            // Nothing to do on the stack, into a register it is a move
+            if (dest == ir_operand_stack) {
+                return false;
+            }
+
+            op = opcode::rmov;
+            break;
+
+        default:
+            return false;
+        }
+
+        emit(op, dest, build_operand(func, node->get_lhs()));
+
+        return true;
+    }
+
+    void ir_compiler::build_push_operands(function_node_ptr func, std::shared_ptr<caculate_node> node) {
+        node_ptr lhs = node->get_lhs();
+        node_ptr rhs = node->get_rhs();
+
+        if (lhs && rhs && lhs->get_node_type() == node_type::var) {
+            auto lhs_local = get_local_slot(func, lhs);
+            auto lhs_arg = get_arg_slot(func, lhs);
+
+            if (rhs->get_node_type() == node_type::number && (lhs_local || lhs_arg)) {
+                const ir_number_constant value = ir_number_constant::of_node(*std::dynamic_pointer_cast<number_node>(rhs));
+
+                if (lhs_local) {
+                    emit_super(opcode::ldlccst, *lhs_local, value);
+                } else {
+                    emit_super(opcode::ldargcst, *lhs_arg, value);
+                }
+
+                return;
+            }
+
+            auto rhs_local = (rhs->get_node_type() == node_type::var) ? get_local_slot(func, rhs) : std::optional<size_t>{};
+
+            if (lhs_local && rhs_local) {
+                emit_super(opcode::ldlc2, *lhs_local, *rhs_local);
+                return;
+            }
+        }
+
+        build_push_hs(func, lhs);
+        build_push_hs(func, rhs);
+    }
+
+    bool ir_compiler::build_increment(function_node_ptr func, std::shared_ptr<assign_node> node) {
+        // x = <a> + <b> into a local, x = x + <number> (i += 1) being the usual one
+        if (node->get_rhs()->get_node_type() != node_type::caculate) {
+            return false;
+        }
+
+        std::shared_ptr<caculate_node> cn = std::dynamic_pointer_cast<caculate_node>(node->get_rhs());
+        auto slot = get_local_slot(func, node->get_lhs());
+
+        if (cn->get_op() != caculate_op::add || !slot) {
+            return false;
+        }
+
+        if (cn->get_lhs() == node->get_lhs() && cn->get_rhs() && cn->get_rhs()->get_node_type() == node_type::number) {
+            emit_super(opcode::inclc, *slot, ir_number_constant::of_node(*std::dynamic_pointer_cast<number_node>(cn->get_rhs())));
+            return true;
+        }
+
+        build_push_operands(func, cn);
+        emit(opcode::addstlc, *slot);
+
+        return true;
+    }
+
     void ir_compiler::build_caculate(function_node_ptr func, std::shared_ptr<caculate_node> node) {
-        build_push_hs(func, node->get_lhs());
-        build_push_hs(func, node->get_rhs());
+        if (register_form && build_caculate_to(func, node, ir_operand_stack)) {
+            return;
+        }
+
+        build_push_operands(func, node);
 
         switch (node->get_op()) {
         case caculate_op::add:
@@ -369,6 +909,44 @@ namespace snack::ir::backend {
     void ir_compiler::build_assign(function_node_ptr func, std::shared_ptr<assign_node> node) {
         node_type ltr = node->get_lhs()->get_node_type();
 
+        if (register_form && ltr == node_type::var) {
+            // Compute straight into the variable register, no load and store around it
+            auto reg = get_register(func, node->get_lhs());
+
+            if (reg) {
+                node_ptr rhs = node->get_rhs();
+
+                switch (rhs->get_node_type()) {
+                case node_type::caculate:
+                    if (build_caculate_to(func, std::dynamic_pointer_cast<caculate_node>(rhs), *reg)) {
+                        return;
+                    }
+
+                    break;
+
+                case node_type::unary:
+                    if (build_unary_to(func, std::dynamic_pointer_cast<unary_node>(rhs), *reg)) {
+                        return;
+                    }
+
+                    break;
+
+                case node_type::number:
+                case node_type::string:
+                case node_type::var:
+                    emit(opcode::rmov, *reg, build_operand(func, rhs));
+                    return;
+
+                default:
+                    break;
+                }
+            }
+        }
+
+        if (ltr == node_type::var && build_increment(func, node)) {
+            return;
+        }
+
         switch (ltr) {
         case node_type::var:
         case node_type::array_access: {
@@ -381,7 +959,7 @@ namespace snack::ir::backend {
             bool is_arg = false;
             bool found = false;
 
-            node_type nt = node->get_node_type();
+            node_type nt = ltr;
 
             for (uint8_t i = 0; i < func->get_args().size(); i++) {
                 if ((nt == node_type::var && func->get_args()[i] == node->get_lhs())
@@ -447,7 +1025,7 @@ namespace snack::ir::backend {
         }
     }
 
-    void ir_compiler::build_function_call(function_node_ptr func, std::shared_ptr<function_call_node> func_call) {
+    void ir_compiler::build_function_call(function_node_ptr func, std::shared_ptr<function_call_node> func_call, const bool tail_call) {
         for (int i = func_call->get_args().size() - 1; i >= 0; i--) {
             build_push_hs(func, func_call->get_args()[i]);
         }
@@ -510,7 +1088,10 @@ namespace snack::ir::backend {
             return;
         }
 
-        emit(opcode::call, (index_func << 16) | index_unit);
+        const uint64_t call_info = (static_cast<uint64_t>(func_call->get_args().size()) << 32)
+            | (static_cast<uint32_t>(index_func) << 16) | static_cast<uint16_t>(index_unit);
+
+        emit(tail_call ? opcode::tcall : opcode::call, static_cast<long double>(call_info));
     }
 
     void ir_compiler::build_node(function_node_ptr func, node_ptr node) {
@@ -551,7 +1132,7 @@ namespace snack::ir::backend {
             std::shared_ptr<block_node> block = std::dynamic_pointer_cast<block_node>(node);
 
             for (const auto &child : block->get_childrens()) {
-                build_node(func, child);
+                build_statement(func, child);
             }
 
             break;
@@ -569,6 +1150,11 @@ namespace snack::ir::backend {
             break;
         }
 
+        case node_type::yield: {
+            build_yield(func, std::dynamic_pointer_cast<yield_node>(node));
+            break;
+        }
+
         default: {
             break;
         }
@@ -583,6 +1169,10 @@ namespace snack::ir::backend {
         header.magic[3] = 'L';
         header.magic[4] = '\0';
 
+        header.major = register_form ? ir_binary_version_register : ir_binary_version_stack;
+        header.minor = 0;
+        header.build = 0;
+
         ir_bin.write(reinterpret_cast<const char *>(&header), sizeof(ir_binary_header));
 
         code_addr = ir_bin.tellp();
@@ -595,6 +1185,7 @@ namespace snack::ir::backend {
         write_data_relocate_info();
         write_func_entries();
         write_unit_ref_table();
+        write_const_table();
 
         header.code_addr = code_addr;
         header.data_addr = data_addr;
@@ -603,12 +1194,18 @@ namespace snack::ir::backend {
         header.func_table_addr = func_table_addr;
         header.ref_table_addr = ref_table_addr;
         header.ref_count = unit_table.size();
+        header.const_count = const_table.size();
+        header.const_table_addr = const_table_addr;
 
         ir_bin.seekp(0);
         ir_bin.write(reinterpret_cast<const char *>(&header), sizeof(ir_binary_header));
     }
 
     void ir_compiler::build_unary(function_node_ptr func, std::shared_ptr<unary_node> node) {
+        if (register_form && build_unary_to(func, node, ir_operand_stack)) {
+            return;
+        }
+
         build_push_hs(func, node->get_lhs());
 
         switch (node->get_unary_op()) {
@@ -640,7 +1237,7 @@ namespace snack::ir::backend {
 
     void ir_compiler::build_conditional_loop(function_node_ptr func, std::shared_ptr<conditional_loop_node> node) {
         for (const auto &init_job : node->get_init_jobs()) {
-            build_node(func, init_job);
+            build_statement(func, init_job);
         }
 
         std::vector<size_t> rewrite_addrs;
@@ -648,19 +1245,16 @@ namespace snack::ir::backend {
         size_t condition_addr = funcs.back().crr_pc;
 
         for (const auto &cont_condition : node->get_continue_conditions()) {
-            build_condition(func, cont_condition);
-
             // if one of these conditions failed, it should not continue execution
-            rewrite_addrs.push_back(static_cast<size_t>(ir_bin.tellp()) + 2);
-            emit(opcode::brf, 0);
+            rewrite_addrs.push_back(build_condition_branch(func, cont_condition));
         }
 
         for (const auto &state : node->get_do_block()->get_childrens()) {
-            build_node(func, state);
+            build_statement(func, state);
         }
 
         for (const auto &end_job : node->get_end_jobs()) {
-            build_node(func, end_job);
+            build_statement(func, end_job);
         }
 
         emit(opcode::br, condition_addr);
@@ -676,13 +1270,10 @@ namespace snack::ir::backend {
     }
 
     void ir_compiler::build_if_else(function_node_ptr func, std::shared_ptr<if_else_node> node) {
-        build_condition(func, node->get_condition());
-
-        size_t rewrite_addr = static_cast<size_t>(ir_bin.tellp()) + 2;
-        emit(opcode::brf, 0);
+        size_t rewrite_addr = build_condition_branch(func, node->get_condition());
 
         for (const auto &if_blck_stmt : node->get_if_block()->get_childrens()) {
-            build_node(func, if_blck_stmt);
+            build_statement(func, if_blck_stmt);
         }
 
         size_t else_block_addr = funcs.back().crr_pc;
@@ -703,7 +1294,7 @@ namespace snack::ir::backend {
             emit(opcode::br, 0);
 
             for (const auto &else_blck_stmt : node->get_else_block()->get_childrens()) {
-                build_node(func, else_blck_stmt);
+                build_statement(func, else_blck_stmt);
             }
 
             size_t else_block_end_addr = funcs.back().crr_pc;
@@ -758,11 +1349,66 @@ namespace snack::ir::backend {
         }
     }
 
+    size_t ir_compiler::build_condition_branch(function_node_ptr func, node_ptr node) {
+        opcode branch = opcode::brf;
+
+        if (node->get_node_type() == node_type::caculate) {
+            // Compare and branch when it does not hold, in one instruction
+            switch (std::dynamic_pointer_cast<caculate_node>(node)->get_op()) {
+            case caculate_op::less:
+                branch = opcode::bnlt;
+                break;
+
+            case caculate_op::less_equal:
+                branch = opcode::bnle;
+                break;
+
+            case caculate_op::greater:
+                branch = opcode::bngt;
+                break;
+
+            case caculate_op::greater_equal:
+                branch = opcode::bnge;
+                break;
+
+            case caculate_op::equal:
+                branch = opcode::bneq;
+                break;
+
+            default:
+                break;
+            }
+        }
+
+        if (branch == opcode::brf) {
+            build_condition(func, node);
+        } else {
+            build_push_operands(func, std::dynamic_pointer_cast<caculate_node>(node));
+        }
+
+        emit(branch, 0);
+
+        // The jump target is the last operand, filled when it is known
+        return static_cast<size_t>(ir_bin.tellp()) - sizeof(size_t);
+    }
+
     void ir_compiler::build_ret(function_node_ptr func, std::shared_ptr<return_node> node) {
-        build_push_hs(func, node->get_result());
+        // ret f(...) reuses the frame for a script function. The ret stays, a host function
+        // leaves its value like any call and it is returned from here.
+        if (node->get_result() && node->get_result()->get_node_type() == node_type::function_call) {
+            build_function_call(func, std::dynamic_pointer_cast<function_call_node>(node->get_result()), true);
+        } else {
+            build_push_hs(func, node->get_result());
+        }
+
         emit(opcode::ret);
     }
 
+    void ir_compiler::build_yield(function_node_ptr func, std::shared_ptr<yield_node> node) {
+        build_push_hs(func, node->get_result());
+        emit(opcode::yield);
+    }
+
     std::string ir_compiler::get_compile_binary() {
         return ir_bin.str();
     }
@@ -783,6 +1429,12 @@ namespace snack::ir::backend {
             ir_bin.write(reinterpret_cast<const char *>(&str_len), sizeof(size_t));
             ir_bin.write(str.first.data(), str_len);
 
+            auto reg_const = register_string_constants.find(str.first);
+
+            if (reg_const != register_string_constants.end()) {
+                const_table[reg_const->second] = crr_pos;
+            }
+
             size_t cont_pos = ir_bin.tellp();
 
             for (const auto &relocate : str.second) {
@@ -796,9 +1448,15 @@ namespace snack::ir::backend {
         for (const auto &num : relocate_number_list) {
             size_t crr_pos = ir_bin.tellp();
 
-            emit(opcode::idata);
+            emit(num.first.integer ? opcode::i64data : opcode::f64data);
+
+            ir_bin.write(reinterpret_cast<const char *>(&num.first.bits), sizeof(uint64_t));
 
-            ir_bin.write(reinterpret_cast<const char *>(&num.first), sizeof(long double));
+            auto reg_const = register_number_constants.find(num.first);
+
+            if (reg_const != register_number_constants.end()) {
+                const_table[reg_const->second] = crr_pos;
+            }
 
             size_t cont_pos = ir_bin.tellp();
 
@@ -841,4 +1499,12 @@ namespace snack::ir::backend {
             ir_bin.write(name.data(), len);
         }
     }
+
+    void ir_compiler::write_const_table() {
+        const_table_addr = ir_bin.tellp();
+
+        for (const auto &data_addr : const_table) {
+            ir_bin.write(reinterpret_cast<const char *>(&data_addr), sizeof(size_t));
+        }
+    }
 }
\ No newline at end of file
@@ -51,7 +51,12 @@ namespace snack::ir::frontend {
         case opcode::ble: 
         case opcode::br: 
         case opcode::brt: 
-        case opcode::brf:  {
+        case opcode::brf:
+        case opcode::bnlt:
+        case opcode::bnle:
+        case opcode::bngt:
+        case opcode::bnge:
+        case opcode::bneq: {
             size_t off = 0;
             ir_bin.read(reinterpret_cast<char *>(&off), sizeof(size_t));
 
@@ -73,13 +78,19 @@ namespace snack::ir::frontend {
 
             std::cout << " 0x" << std::hex << off;
 
-            pc += sizeof(size_t) + 2;
+            uint16_t frame_info[2] = { 0, 0 };
+            ir_bin.read(reinterpret_cast<char *>(frame_info), sizeof(frame_info));
+
+            std::cout << std::dec << " stack " << frame_info[0] << " locals " << frame_info[1];
+
+            pc += sizeof(size_t) + 2 + sizeof(frame_info);
 
             break;
         }
 
         case opcode::ldarg:
         case opcode::ldlc:
+        case opcode::addstlc:
         case opcode::strarg:
         case opcode::strlc:
         case opcode::vri:
@@ -94,6 +105,34 @@ namespace snack::ir::frontend {
             break;
         }
 
+        case opcode::inclc:
+        case opcode::ldlccst:
+        case opcode::ldargcst: {
+            uint16_t idx = 0;
+            ir_bin.read(reinterpret_cast<char *>(&idx), 1);
+
+            size_t off = 0;
+            ir_bin.read(reinterpret_cast<char *>(&off), sizeof(size_t));
+
+            std::cout << " 0x" << std::hex << (int)idx << " 0x" << off;
+
+            pc += 1 + sizeof(size_t);
+
+            break;
+        }
+
+        case opcode::ldlc2:
+        case opcode::ldelmlc: {
+            uint8_t idx[2] = { 0, 0 };
+            ir_bin.read(reinterpret_cast<char *>(idx), 2);
+
+            std::cout << " 0x" << std::hex << (int)idx[0] << " 0x" << (int)idx[1];
+
+            pc += 2;
+
+            break;
+        }
+
         case opcode::endmet: {
             std::cout << std::endl;
             break;
@@ -109,6 +148,26 @@ namespace snack::ir::frontend {
             break;
         }
 
+        case opcode::i64data: {
+            int64_t val;
+            ir_bin.read(reinterpret_cast<char *>(&val), sizeof(int64_t));
+
+            std::cout << " " << std::dec << val;
+
+            pc += sizeof(int64_t);
+            break;
+        }
+
+        case opcode::f64data: {
+            double val;
+            ir_bin.read(reinterpret_cast<char *>(&val), sizeof(double));
+
+            std::cout << " " << val;
+
+            pc += sizeof(double);
+            break;
+        }
+
         case opcode::strdata: {
             std::string str;
             size_t str_len;
@@ -123,15 +182,48 @@ namespace snack::ir::frontend {
             break;
         }
 
-        case opcode::call: {
+        case opcode::call:
+        case opcode::tcall: {
             int16_t idx;
             ir_bin.read(reinterpret_cast<char *>(&idx), 2);
 
-            std::cout << " " << (int)idx;
+            std::cout << " " << std::hex << (int)idx;
 
             ir_bin.read(reinterpret_cast<char *>(&idx), 2);
             std::cout << " " << (int)idx;
 
+            uint8_t arg_count = 0;
+            ir_bin.read(reinterpret_cast<char *>(&arg_count), 1);
+            std::cout << " " << std::dec << (int)arg_count;
+
+            pc += 5;
+
+            break;
+        }
+
+        default: {
+            if (!is_register_op(op)) {
+                break;
+            }
+
+            const size_t operand_size = get_op_operand_size(op);
+
+            uint16_t operands[3] = { 0, 0, 0 };
+            ir_bin.read(reinterpret_cast<char *>(operands), operand_size);
+
+            for (size_t i = 0; i < operand_size / 2; i++) {
+                std::cout << (i == 0 ? " " : ", ");
+
+                if (operands[i] == ir_operand_stack) {
+                    std::cout << "s";
+                } else if (operands[i] & ir_operand_constant) {
+                    std::cout << "k" << std::dec << (operands[i] & ~ir_operand_constant);
+                } else {
+                    std::cout << "r" << std::dec << operands[i];
+                }
+            }
+
+            pc += operand_size;
             break;
         }
         }
@@ -156,4 +248,17 @@ namespace snack::ir::frontend {
             std::cout << unit_name << std::endl;
         }
     }
+
+    void ir_decompiler::dump_decoded(const std::vector<backend::ir_instruction> &code) {
+        for (size_t i = 0; i < code.size(); i++) {
+            const char *name = get_op_name(code[i].op);
+
+            std::cout << std::dec << i << ": " << (name ? name : "bad") << " " << code[i].short_operand << " "
+                      << code[i].operand << std::endl;
+
+            if (code[i].op == opcode::endmet) {
+                std::cout << std::endl;
+            }
+        }
+    }
 }
\ No newline at end of file
@@ -0,0 +1,350 @@
+#include <snack/ir_interpreter.h>
+
+#include <algorithm>
+#include <limits>
+
+namespace snack::ir::backend {
+    // Everything at or above the stack pointer of the top frame is none
+    static const ir_element *get_used_end(const ir_execution_stack &stack) {
+        return stack.frames.empty() ? stack.values.data() : stack.frames.top().stack_ptr;
+    }
+
+    static ir_element *get_used_end(ir_execution_stack &stack) {
+        return stack.frames.empty() ? stack.values.data() : stack.frames.top().stack_ptr;
+    }
+
+    void ir_interpreter_ref_manager::mark(ir_object_base *obj) {
+        if (obj && !obj->marked) {
+            obj->marked = true;
+            gray.push_back(obj);
+        }
+    }
+
+    void ir_interpreter_ref_manager::mark_value(const ir_element &el) {
+        if (el.type == ir_element::ref) {
+            mark(find_obj(el.ref_id));
+        }
+    }
+
+    void ir_interpreter_ref_manager::mark_values(const ir_element *begin, const ir_element *end) {
+        for (const ir_element *el = begin; el < end; el++) {
+            mark_value(*el);
+        }
+    }
+
+    void ir_interpreter_ref_manager::remark(ir_object_base *obj) {
+        if (gc_phase == ir_gc_phase::marking && obj->marked) {
+            gray.push_back(obj);
+        }
+    }
+
+    bool ir_interpreter_ref_manager::propagate(size_t &work) {
+        while (!gray.empty()) {
+            if (work == 0) {
+                return false;
+            }
+
+            work--;
+
+            ir_object_base *obj = gray.back();
+            gray.pop_back();
+
+            switch (obj->type) {
+            case ir_object_base_type::array: {
+                // Packed arrays hold no references, their values stay empty
+                ir_array *arr = static_cast<ir_array *>(obj);
+                mark_values(arr->elements.data(), arr->elements.data() + arr->elements.size());
+
+                break;
+            }
+
+            case ir_object_base_type::oop: {
+                for (const auto &field : static_cast<ir_oop_object *>(obj)->fields) {
+                    mark_value(field.second);
+                }
+
+                break;
+            }
+
+            case ir_object_base_type::coroutine: {
+                ir_coroutine *coroutine = static_cast<ir_coroutine *>(obj);
+
+                mark_value(coroutine->result);
+                mark_values(coroutine->stack.values.data(), get_used_end(coroutine->stack));
+
+                break;
+            }
+            }
+        }
+
+        return true;
+    }
+
+    bool ir_interpreter_ref_manager::sweep(size_t &work) {
+        for (; sweep_pos < slots.size(); sweep_pos++) {
+            if (work == 0) {
+                return false;
+            }
+
+            work--;
+
+            ir_object_base *obj = slots[sweep_pos].object.get();
+
+            if (!obj) {
+                continue;
+            }
+
+            if (obj->marked || obj->pin_count) {
+                obj->marked = false;
+            } else {
+                release(static_cast<uint32_t>(sweep_pos));
+            }
+        }
+
+        return true;
+    }
+
+    void ir_interpreter_ref_manager::reset_collection() {
+        gc_phase = ir_gc_phase::idle;
+        gray.clear();
+        sweep_pos = 0;
+
+        for (ir_object_slot &slot : slots) {
+            if (slot.object) {
+                slot.object->marked = false;
+            }
+        }
+    }
+
+    void ir_interpreter_ref_manager::promote_value(ir_element &el, std::vector<ir_object_base *> &moved) {
+        if (el.type == ir_element::str) {
+            if (el.str_data->arena) {
+                el = ir_element(new ir_string(el.str_data->value));
+            }
+
+            return;
+        }
+
+        if (el.type == ir_element::ref) {
+            promote_object(el.ref_id, moved);
+        }
+    }
+
+    void ir_interpreter_ref_manager::promote_object(const uint64_t id, std::vector<ir_object_base *> &moved) {
+        ir_object_base *obj = find_obj(id);
+
+        if (!obj || !obj->in_arena) {
+            return;
+        }
+
+        // Moved out member by member, stack frames keep pointing at the same value storage
+        ir_object_base_ptr promoted;
+
+        switch (obj->type) {
+        case ir_object_base_type::array:
+            promoted = std::make_shared<ir_array>(std::move(*static_cast<ir_array *>(obj)));
+            break;
+
+        case ir_object_base_type::oop:
+            promoted = std::make_shared<ir_oop_object>(std::move(*static_cast<ir_oop_object *>(obj)));
+            break;
+
+        case ir_object_base_type::coroutine:
+            promoted = std::make_shared<ir_coroutine>(std::move(*static_cast<ir_coroutine *>(obj)));
+            break;
+        }
+
+        promoted->in_arena = false;
+        moved.push_back(promoted.get());
+
+        slots[id & 0xFFFFFFFF].object = std::move(promoted);
+    }
+
+    void ir_interpreter_ref_manager::promote_values(ir_element *begin, ir_element *end,
+        std::vector<ir_object_base *> &moved) {
+        for (ir_element *el = begin; el < end; el++) {
+            promote_value(*el, moved);
+        }
+    }
+
+    void ir_interpreter_ref_manager::promote_contents(ir_object_base *obj, std::vector<ir_object_base *> &moved) {
+        switch (obj->type) {
+        case ir_object_base_type::array: {
+            std::vector<ir_element> &elements = static_cast<ir_array *>(obj)->elements;
+            promote_values(elements.data(), elements.data() + elements.size(), moved);
+
+            break;
+        }
+
+        case ir_object_base_type::oop: {
+            for (auto &field : static_cast<ir_oop_object *>(obj)->fields) {
+                promote_value(field.second, moved);
+            }
+
+            break;
+        }
+
+        case ir_object_base_type::coroutine: {
+            ir_coroutine *coroutine = static_cast<ir_coroutine *>(obj);
+
+            promote_value(coroutine->result, moved);
+            promote_values(coroutine->stack.values.data(), get_used_end(coroutine->stack), moved);
+
+            break;
+        }
+        }
+    }
+
+    void ir_interpreter_ref_manager::close_arena(ir_element &result) {
+        std::vector<ir_object_base *> moved;
+
+        promote_value(result, moved);
+
+        for (const uint64_t id : pinned) {
+            promote_object(id, moved);
+        }
+
+        // Heap objects only get arena values through stores and running coroutines, they were remembered
+        for (const uint64_t id : remembered) {
+            if (ir_object_base *obj = find_obj(id)) {
+                obj->remembered = false;
+                promote_contents(obj, moved);
+            }
+        }
+
+        while (!moved.empty()) {
+            ir_object_base *obj = moved.back();
+            moved.pop_back();
+
+            promote_contents(obj, moved);
+        }
+
+        // Nothing else can reach what is left, the generation moves on like for any freed slot
+        for (const uint64_t id : arena_objects) {
+            ir_object_base *obj = find_obj(id);
+
+            if (obj && obj->in_arena) {
+                release(static_cast<uint32_t>(id & 0xFFFFFFFF));
+            }
+        }
+
+        arena_objects.clear();
+        remembered.clear();
+
+        arena_active = false;
+        arena.reset();
+    }
+
+    void ir_interpreter::mark_roots() {
+        const auto mark_stack = [this](const ir_execution_stack &roots) {
+            ref_manager.mark_values(roots.values.data(), get_used_end(roots));
+        };
+
+        mark_stack(main_stack);
+        mark_stack(idle_stack);
+
+        // Already marked ones may have run since, their stacks are gone through again
+        for (const auto &coroutine : coroutines) {
+            ref_manager.mark(coroutine.get());
+            mark_stack(coroutine->stack);
+        }
+
+        ref_manager.mark_value(result);
+
+        for (const uint64_t id : ref_manager.pinned) {
+            ref_manager.mark(ref_manager.find_obj(id));
+        }
+    }
+
+    void ir_interpreter::collect_if_needed() {
+        if (ref_manager.gc_phase != ir_gc_phase::idle || ref_manager.object_count >= gc_threshold) {
+            collect_step(ir_gc_step_work);
+        }
+    }
+
+    bool ir_interpreter::collect_step(const size_t work) {
+        size_t work_left = work;
+
+        if (ref_manager.gc_phase == ir_gc_phase::idle) {
+            ref_manager.gc_phase = ir_gc_phase::marking;
+            mark_roots();
+        }
+
+        if (ref_manager.gc_phase == ir_gc_phase::marking) {
+            if (!ref_manager.propagate(work_left)) {
+                return false;
+            }
+
+            // The roots kept changing while marking went on bit by bit, finish them all at once
+            size_t no_limit = std::numeric_limits<size_t>::max();
+
+            mark_roots();
+            ref_manager.propagate(no_limit);
+
+            ref_manager.gc_phase = ir_gc_phase::sweeping;
+            ref_manager.sweep_pos = 0;
+        }
+
+        if (!ref_manager.sweep(work_left)) {
+            return false;
+        }
+
+        ref_manager.gc_phase = ir_gc_phase::idle;
+        gc_threshold = std::max(gc_min_threshold, static_cast<size_t>(ref_manager.object_count * gc_growth));
+
+        return true;
+    }
+
+    void ir_interpreter::finish_invocation() {
+        // Marking holds on to objects that are about to move or go
+        if (ref_manager.gc_phase == ir_gc_phase::marking) {
+            collect_step(std::numeric_limits<size_t>::max());
+        }
+
+        ref_manager.close_arena(result);
+    }
+
+    void ir_interpreter::collect() {
+        const size_t no_limit = std::numeric_limits<size_t>::max();
+
+        // What became garbage while a collection was going on is only found by the next one
+        if (ref_manager.gc_phase != ir_gc_phase::idle) {
+            collect_step(no_limit);
+        }
+
+        collect_step(no_limit);
+    }
+
+    void ir_interpreter::set_gc_threshold(const size_t min_objects, const double growth) {
+        gc_min_threshold = min_objects;
+        gc_threshold = min_objects;
+        gc_growth = growth;
+    }
+
+    void ir_interpreter::pin(const ir_element &el) {
+        ir_object_base *obj = (el.type == ir_element::ref) ? ref_manager.find_obj(el.ref_id) : nullptr;
+
+        if (!obj) {
+            return;
+        }
+
+        if (obj->pin_count++ == 0) {
+            ref_manager.pinned.push_back(obj->id);
+        }
+
+        if (ref_manager.gc_phase == ir_gc_phase::marking) {
+            ref_manager.mark(obj);
+        }
+    }
+
+    void ir_interpreter::unpin(const ir_element &el) {
+        ir_object_base *obj = (el.type == ir_element::ref) ? ref_manager.find_obj(el.ref_id) : nullptr;
+
+        if (!obj || obj->pin_count == 0 || --obj->pin_count != 0) {
+            return;
+        }
+
+        auto &pinned = ref_manager.pinned;
+        pinned.erase(std::find(pinned.begin(), pinned.end(), obj->id));
+    }
+}
@@ -1,613 +1,608 @@
 #include <snack/ir_interpreter.h>
+#include <snack/ir_jit.h>
 #include <snack/ir_opcode.h>
 #include <snack/unit_manager.h>
 
-namespace snack::ir::backend {
-    void ir_interpreter::pop(ir_interpreter_func_context &context) {
-        context.pop();
-        context.pc += 2;
-    }
+#include <algorithm>
+#include <cmath>
+#include <atomic>
+#include <limits>
+#include <mutex>
 
-    void ir_interpreter::ldcst(ir_interpreter_func_context &context) {
-        context.pc += 2;
+namespace snack::ir::backend {
+    ir_string *ir_intern_string(const std::string &value) {
+        // Interned strings outlive every unit and value pointing at them, never destroy the table
+        static std::mutex table_lock;
+        static auto *table = new std::unordered_map<std::string, ir_string *>();
 
-        const size_t data_addr = *reinterpret_cast<const size_t *>(context.ir_bin + context.pc);
-        const opcode op = *reinterpret_cast<const opcode *>(context.ir_global_bin + data_addr);
+        std::lock_guard guard(table_lock);
+        auto &str = (*table)[value];
 
-        if (op != opcode::idata) {
-            // report
-            return;
+        if (!str) {
+            str = new ir_string(value);
+            str->interned = true;
         }
 
-        ir_element element;
-        element.type = ir_element::num;
-        element.num_data = *reinterpret_cast<const long double *>(context.ir_global_bin + data_addr + 2);
-
-        context.pc += 8;
-
-        context.push(element);
+        return str;
     }
 
-    void ir_interpreter::ldarg(ir_interpreter_func_context &context) {
-        context.pc += 2;
-        char idx = *(context.ir_bin + context.pc);
-
-        if (idx >= context.local_args.size()) {
-            // throw error to error manager
-            return;
+    static bool is_string_equal(const ir_element &el1, const ir_element &el2) {
+        if (el1.type == ir_element::str && el2.type == ir_element::str && el1.str_data->interned
+            && el2.str_data->interned) {
+            return el1.str_data == el2.str_data;
         }
 
-        context.pc += 1;
-
-        context.push(context.local_args[idx]);
+        return el1.get_string() == el2.get_string();
     }
 
-    void ir_interpreter::ldcststr(ir_interpreter_func_context &context) {
-        context.pc += 2;
-
-        const size_t data_addr = *reinterpret_cast<const size_t *>(context.ir_bin + context.pc);
-        const opcode op = *reinterpret_cast<const opcode *>(context.ir_global_bin + data_addr);
-
-        if (op != opcode::strdata) {
-            // report
-            return;
-        }
-
-        ir_element element;
-        element.type = ir_element::str;
-
-        char *str = const_cast<char *>(context.ir_global_bin) + data_addr + 2;
-        size_t len = *reinterpret_cast<size_t *>(str);
+    void ir_interpreter::pop(ir_interpreter_func_context &context) {
+        context.pop();
+        context.pc++;
+    }
 
-        element.str_data.resize(len);
-        str += sizeof(size_t);
+    void ir_interpreter::ldcst(ir_interpreter_func_context &context) {
+        const ir_instruction &inst = context.code[context.pc++];
+        context.push(context.constants[inst.operand]);
+    }
 
-        std::copy(str, str + len, element.str_data.begin());
+    void ir_interpreter::ldarg(ir_interpreter_func_context &context) {
+        const ir_instruction &inst = context.code[context.pc++];
+        context.push(context.local_args[inst.short_operand]);
+    }
 
-        context.pc += 8;
-        context.push(std::move(element));
+    void ir_interpreter::ldcststr(ir_interpreter_func_context &context) {
+        const ir_instruction &inst = context.code[context.pc++];
+        context.push(context.constants[inst.operand]);
     }
 
     void ir_interpreter::ldlc(ir_interpreter_func_context &context) {
-        context.pc += 2;
-        char idx = *(context.ir_bin + context.pc);
-
-        if (idx >= context.local_slots.size()) {
-            // throw error to error manager
-            return;
-        }
-
-        context.pc += 1;
+        const ir_instruction &inst = context.code[context.pc++];
+        context.push(context.local_slots[inst.short_operand]);
+    }
 
-        context.push(context.local_slots[idx]);
+    // What the operators do to values, shared by the stack and the register form. Strings only
+    // make sense with add and the comparisons, anything else with a string gives none. Without a
+    // double on either side, arithmetic stays on integers and wraps around on overflow.
+    static bool is_integer_operation(const ir_element &lhs, const ir_element &rhs) {
+        return lhs.type != ir_element::num && rhs.type != ir_element::num;
     }
 
-    void ir_interpreter::add(ir_interpreter_func_context &context) {
-        context.pc += 2;
+    static int64_t wrap_integer(const uint64_t val) {
+        return static_cast<int64_t>(val);
+    }
 
-        ir_element el1 = context.pop();
-        ir_element el2 = context.pop();
+    static ir_element add_values(ir_element &&lhs, ir_element &&rhs) {
+        if (lhs.type == ir_element::str || rhs.type == ir_element::str) {
+            // Reuse an operand when the result is the same string, or when nobody else can see it
+            if (rhs.get_string().empty() && lhs.type == ir_element::str) {
+                return std::move(lhs);
+            }
 
-        if (el1.type == ir_element::str || el2.type == ir_element::str) {
-            ir_element el_ret;
-            el_ret.type = ir_element::str;
-            el_ret.str_data = el2.str_data + el1.str_data;
+            if (lhs.get_string().empty() && rhs.type == ir_element::str) {
+                return std::move(rhs);
+            }
 
-            context.push(el_ret);
+            if (lhs.type == ir_element::str && !lhs.str_data->interned && lhs.str_data->ref_count == 1) {
+                lhs.str_data->value += rhs.get_string();
+                return std::move(lhs);
+            }
 
-            return;
+            return ir_element(lhs.get_string() + rhs.get_string());
         }
 
-        ir_element el_ret;
-        el_ret.type = ir_element::num;
-        el_ret.num_data = el1.num_data + el2.num_data;
+        if (is_integer_operation(lhs, rhs)) {
+            return wrap_integer(static_cast<uint64_t>(lhs.get_integer()) + static_cast<uint64_t>(rhs.get_integer()));
+        }
 
-        context.push(el_ret);
+        return lhs.get_number() + rhs.get_number();
     }
 
-    void ir_interpreter::sub(ir_interpreter_func_context &context) {
-        context.pc += 2;
-
-        ir_element el1 = context.pop();
-        ir_element el2 = context.pop();
+#define IR_NUMBER_OPERATION(name, int_expr, num_expr)                                  \
+    static ir_element name(ir_element &&lhs, ir_element &&rhs) {                       \
+        if (lhs.type == ir_element::str || rhs.type == ir_element::str) {              \
+            return ir_element();                                                       \
+        }                                                                              \
+        if (is_integer_operation(lhs, rhs)) {                                          \
+            const uint64_t a = static_cast<uint64_t>(lhs.get_integer());               \
+            const uint64_t b = static_cast<uint64_t>(rhs.get_integer());               \
+            return wrap_integer(int_expr);                                             \
+        }                                                                              \
+        const double a = lhs.get_number();                                             \
+        const double b = rhs.get_number();                                             \
+        return static_cast<double>(num_expr);                                          \
+    }
 
-        if (el1.type == ir_element::str || el2.type == ir_element::str) {
-            // throw error
-            return;
-        }
+    IR_NUMBER_OPERATION(sub_values, a - b, a - b)
+    IR_NUMBER_OPERATION(mul_values, a * b, a * b)
 
-        ir_element el_ret;
-        el_ret.type = ir_element::num;
-        el_ret.num_data = el2.num_data - el1.num_data;
+#undef IR_NUMBER_OPERATION
 
-        context.push(el_ret);
+    // Always a double, whatever the operands are
+#define IR_DOUBLE_OPERATION(name, expr)                                                \
+    static ir_element name(ir_element &&lhs, ir_element &&rhs) {                       \
+        if (lhs.type == ir_element::str || rhs.type == ir_element::str) {              \
+            return ir_element();                                                       \
+        }                                                                              \
+        const double a = lhs.get_number();                                             \
+        const double b = rhs.get_number();                                             \
+        return static_cast<double>(expr);                                              \
     }
 
-    void ir_interpreter::mul(ir_interpreter_func_context &context) {
-        context.pc += 2;
+    IR_DOUBLE_OPERATION(div_values, a / b)
+    IR_DOUBLE_OPERATION(pwr_values, std::pow(a, b))
 
-        ir_element el1 = context.pop();
-        ir_element el2 = context.pop();
-
-        if (el1.type == ir_element::str || el2.type == ir_element::str) {
-            // throw error
-            return;
-        }
+#undef IR_DOUBLE_OPERATION
 
-        ir_element el_ret;
-        el_ret.type = ir_element::num;
-        el_ret.num_data = el1.num_data * el2.num_data;
+    // Always an integer, doubles are truncated first. Shift counts wrap at 64 like the hardware's.
+#define IR_INTEGER_OPERATION(name, expr)                                               \
+    static ir_element name(ir_element &&lhs, ir_element &&rhs) {                       \
+        if (lhs.type == ir_element::str || rhs.type == ir_element::str) {              \
+            return ir_element();                                                       \
+        }                                                                              \
+        const int64_t a = lhs.get_integer();                                           \
+        const int64_t b = rhs.get_integer();                                           \
+        return static_cast<int64_t>(expr);                                             \
+    }
 
-        context.push(el_ret);
+    // Modulo by zero has no value. By -1 it is always 0, and INT64_MIN % -1 would trap.
+    IR_INTEGER_OPERATION(mod_values, (b == 0 || b == -1) ? 0 : a % b)
+    IR_INTEGER_OPERATION(shl_values, wrap_integer(static_cast<uint64_t>(a) << (b & 63)))
+    IR_INTEGER_OPERATION(shr_values, a >> (b & 63))
+    IR_INTEGER_OPERATION(and_values, a & b)
+    IR_INTEGER_OPERATION(or_values, a | b)
+    IR_INTEGER_OPERATION(xor_values, a ^ b)
+
+#undef IR_INTEGER_OPERATION
+
+    // Comparisons give integer 0 or 1. Two integers compare exactly, anything else as doubles.
+#define IR_COMPARE_OPERATION(name, op)                                                 \
+    static ir_element name(ir_element &&lhs, ir_element &&rhs) {                       \
+        if (lhs.type == ir_element::str || rhs.type == ir_element::str) {              \
+            return static_cast<int64_t>(lhs.get_string() op rhs.get_string());         \
+        }                                                                              \
+        if (lhs.type == ir_element::integer && rhs.type == ir_element::integer) {      \
+            return static_cast<int64_t>(lhs.int_data op rhs.int_data);                 \
+        }                                                                              \
+        return static_cast<int64_t>(lhs.get_number() op rhs.get_number());             \
     }
 
-    void ir_interpreter::div(ir_interpreter_func_context &context) {
-        context.pc += 2;
+    IR_COMPARE_OPERATION(cgt_values, >)
+    IR_COMPARE_OPERATION(cge_values, >=)
+    IR_COMPARE_OPERATION(clt_values, <)
+    IR_COMPARE_OPERATION(cle_values, <=)
 
-        ir_element el1 = context.pop();
-        ir_element el2 = context.pop();
+#undef IR_COMPARE_OPERATION
 
-        if (el1.type == ir_element::str || el2.type == ir_element::str) {
-            // throw error
-            return;
+    static ir_element ceq_values(ir_element &&lhs, ir_element &&rhs) {
+        if (lhs.type == ir_element::str || rhs.type == ir_element::str) {
+            return static_cast<int64_t>(is_string_equal(lhs, rhs));
         }
 
-        ir_element el_ret;
-        el_ret.type = ir_element::num;
-        el_ret.num_data = el2.num_data / el1.num_data;
+        if (lhs.type == ir_element::integer && rhs.type == ir_element::integer) {
+            return static_cast<int64_t>(lhs.int_data == rhs.int_data);
+        }
 
-        context.push(el_ret);
+        return static_cast<int64_t>(lhs.get_number() == rhs.get_number());
     }
 
-    void ir_interpreter::mod(ir_interpreter_func_context &context) {
-        context.pc += 2;
-
-        ir_element el1 = context.pop();
-        ir_element el2 = context.pop();
+    // None is integer zero, anything else but numbers can't be used with unary operators
+    static bool is_unary_operand(const ir_element &val) {
+        return val.is_number() || val.type == ir_element::none;
+    }
 
-        if (el1.type == ir_element::str || el2.type == ir_element::str) {
-            // throw error
-            return;
+    static ir_element uno_value(ir_element &&val) {
+        if (!is_unary_operand(val)) {
+            return ir_element();
         }
 
-        ir_element el_ret;
-        el_ret.type = ir_element::num;
-        el_ret.num_data = (int64_t)el2.num_data % (int64_t)el1.num_data;
-
-        context.push(el_ret);
+        return static_cast<int64_t>((val.type == ir_element::num) ? !val.num_data : !val.get_integer());
     }
 
-    void ir_interpreter::shl(ir_interpreter_func_context &context) {
-        context.pc += 2;
-
-        ir_element el1 = context.pop();
-        ir_element el2 = context.pop();
+    static ir_element ung_value(ir_element &&val) {
+        if (!is_unary_operand(val)) {
+            return ir_element();
+        }
 
-        if (el1.type == ir_element::str || el2.type == ir_element::str) {
-            // throw error
-            return;
+        if (val.type == ir_element::num) {
+            return -val.num_data;
         }
 
-        ir_element el_ret;
-        el_ret.type = ir_element::num;
-        el_ret.num_data = (int64_t)el2.num_data << (int64_t)(el1.num_data);
+        return wrap_integer(0 - static_cast<uint64_t>(val.get_integer()));
+    }
+
+    static ir_element uin_value(ir_element &&val) {
+        if (!is_unary_operand(val)) {
+            return ir_element();
+        }
 
-        context.push(el_ret);
+        return ~val.get_integer();
     }
 
-    void ir_interpreter::shr(ir_interpreter_func_context &context) {
-        context.pc += 2;
+    using ir_binary_operation = ir_element (*)(ir_element &&, ir_element &&);
+    using ir_unary_operation = ir_element (*)(ir_element &&);
 
-        ir_element el1 = context.pop();
-        ir_element el2 = context.pop();
+    template <ir_binary_operation operation>
+    static void run_stack_op(ir_interpreter_func_context &context) {
+        context.pc++;
 
-        if (el1.type == ir_element::str || el2.type == ir_element::str) {
-            // throw error
-            return;
-        }
+        ir_element rhs = context.pop();
+        ir_element lhs = context.pop();
 
-        ir_element el_ret;
-        el_ret.type = ir_element::num;
-        el_ret.num_data = (int64_t)el2.num_data >> (int64_t)(el1.num_data);
+        context.push(operation(std::move(lhs), std::move(rhs)));
+    }
 
-        context.push(el_ret);
+    template <ir_unary_operation operation>
+    static void run_stack_op(ir_interpreter_func_context &context) {
+        context.pc++;
+        context.push(operation(context.pop()));
     }
 
-    void ir_interpreter::pwr(ir_interpreter_func_context &context) {
-        context.pc += 2;
+    template <ir_binary_operation operation>
+    static void run_register_op(ir_interpreter_func_context &context) {
+        const ir_instruction &inst = context.code[context.pc++];
 
-        ir_element el1 = context.pop();
-        ir_element el2 = context.pop();
+        // With both sources on the stack, the right one is on top
+        ir_element rhs = context.get_operand(static_cast<uint16_t>(inst.operand >> 16));
+        ir_element lhs = context.get_operand(static_cast<uint16_t>(inst.operand));
 
-        if (el1.type == ir_element::str || el2.type == ir_element::str) {
-            // throw error
-            return;
-        }
+        context.set_operand(inst.short_operand, operation(std::move(lhs), std::move(rhs)));
+    }
 
-        ir_element el_ret;
-        el_ret.type = ir_element::num;
-        el_ret.num_data = std::pow(el2.num_data, el1.num_data);
+    template <ir_unary_operation operation>
+    static void run_register_op(ir_interpreter_func_context &context) {
+        const ir_instruction &inst = context.code[context.pc++];
+        context.set_operand(inst.short_operand, operation(context.get_operand(static_cast<uint16_t>(inst.operand))));
+    }
 
-        context.push(el_ret);
+#define IR_OPERATION_HANDLERS(name, operation)                                         \
+    void ir_interpreter::name(ir_interpreter_func_context &context) {                  \
+        run_stack_op<operation>(context);                                              \
+    }                                                                                  \
+                                                                                       \
+    void ir_interpreter::r##name(ir_interpreter_func_context &context) {               \
+        run_register_op<operation>(context);                                           \
     }
 
-    void ir_interpreter::met(ir_interpreter_func_context &context) {
-        context.pc += 2;
-        const uint16_t arg_count = *reinterpret_cast<const uint16_t *>(context.ir_bin + context.pc);
-
-        if (arg_count && last_context) {
-            for (size_t i = 0; i < arg_count; i++) {
-                ir_element el = std::move(last_context->evaluation_stack.top());
-                last_context->evaluation_stack.pop();
-                context.local_args[i] = std::move(el);
-            }
+    IR_OPERATION_HANDLERS(div, div_values)
+    IR_OPERATION_HANDLERS(mod, mod_values)
+    IR_OPERATION_HANDLERS(shl, shl_values)
+    IR_OPERATION_HANDLERS(shr, shr_values)
+    IR_OPERATION_HANDLERS(pwr, pwr_values)
+    IR_OPERATION_HANDLERS(and, and_values)
+    IR_OPERATION_HANDLERS(or, or_values)
+    IR_OPERATION_HANDLERS(xor, xor_values)
+    IR_OPERATION_HANDLERS(uno, uno_value)
+    IR_OPERATION_HANDLERS(ung, ung_value)
+    IR_OPERATION_HANDLERS(uin, uin_value)
+
+#undef IR_OPERATION_HANDLERS
+
+    // Quickening: a generic instruction seeing two numbers rewrites itself into its number form,
+    // which skips the string checks. The first time a number form sees anything else it goes back
+    // to the generic form for good, marked in the short operand these instructions don't use. The
+    // number form then returns without moving the pc, so the generic form runs next.
+    constexpr uint16_t ir_never_quicken = 1;
+
+    static void quicken(ir_instruction &inst, const ir::opcode number_op, const ir_element &lhs, const ir_element &rhs) {
+        if (inst.short_operand != ir_never_quicken && lhs.is_number() && rhs.is_number()) {
+            inst.op = number_op;
         }
-
-        context.pc += 10;
     }
 
-    void ir_interpreter::strlc(ir_interpreter_func_context &context) {
-        context.pc += 2;
-        const char idx = *reinterpret_cast<const char *>(context.ir_bin + context.pc);
-
-        if (idx >= context.local_slots.size()) {
-            // throw error
-            return;
+    static bool deoptimize(ir_instruction &inst, const ir_element &lhs, const ir_element &rhs) {
+        if (lhs.is_number() && rhs.is_number()) {
+            return false;
         }
 
-        context.pc += 1;
+        inst.op = ir::get_generic_op(inst.op);
+        inst.short_operand = ir_never_quicken;
 
-        context.local_slots[idx] = std::move(context.evaluation_stack.top());
-        
+        return true;
     }
 
-    void ir_interpreter::strarg(ir_interpreter_func_context &context) {
-        context.pc += 2;
-        const char idx = *reinterpret_cast<const char *>(context.ir_bin + context.pc);
+    // Operations on two numbers, the result goes into the left one
+#define IR_NUMBER_FORM(name, expr)                                                     \
+    static void name(ir_element &lhs, const ir_element &rhs) {                         \
+        if (lhs.type == ir_element::integer && rhs.type == ir_element::integer) {      \
+            const uint64_t a = static_cast<uint64_t>(lhs.int_data);                    \
+            const uint64_t b = static_cast<uint64_t>(rhs.int_data);                    \
+            lhs.int_data = wrap_integer(expr);                                         \
+            return;                                                                    \
+        }                                                                              \
+        const double a = lhs.get_number();                                             \
+        const double b = rhs.get_number();                                             \
+        lhs = ir_element(static_cast<double>(expr));                                   \
+    }
 
-        if (idx >= context.local_args.size()) {
-            // throw error
-            return;
-        }
+    IR_NUMBER_FORM(add_numbers, a + b)
+    IR_NUMBER_FORM(sub_numbers, a - b)
+    IR_NUMBER_FORM(mul_numbers, a * b)
 
-        context.pc += 1;
+#undef IR_NUMBER_FORM
 
-        context.local_args[idx] = std::move(context.evaluation_stack.top());
-        
+#define IR_NUMBER_COMPARE(name, op)                                                    \
+    static bool name(const ir_element &lhs, const ir_element &rhs) {                   \
+        if (lhs.type == ir_element::integer && rhs.type == ir_element::integer) {      \
+            return lhs.int_data op rhs.int_data;                                       \
+        }                                                                              \
+        return lhs.get_number() op rhs.get_number();                                   \
     }
 
-    void ir_interpreter::vri(ir_interpreter_func_context &context) {
-        context.pc += 2;
-        const char idx = *reinterpret_cast<const char *>(context.ir_bin + context.pc);
+    IR_NUMBER_COMPARE(ceq_numbers, ==)
+    IR_NUMBER_COMPARE(clt_numbers, <)
+    IR_NUMBER_COMPARE(cle_numbers, <=)
+    IR_NUMBER_COMPARE(cgt_numbers, >)
+    IR_NUMBER_COMPARE(cge_numbers, >=)
 
-        if (idx >= context.local_slots.size()) {
-            // throw error
-            return;
-        }
+#undef IR_NUMBER_COMPARE
+
+    using ir_number_operation = void (*)(ir_element &, const ir_element &);
+    using ir_number_compare = bool (*)(const ir_element &, const ir_element &);
 
-        context.local_args[idx].type = ir_element::num;
-        context.local_args[idx].num_data = 0;
+    template <ir_binary_operation operation, ir::opcode number_op>
+    static void run_quickening_op(ir_interpreter_func_context &context) {
+        quicken(context.code[context.pc], number_op, context.stack_ptr[-2], context.stack_ptr[-1]);
+        run_stack_op<operation>(context);
     }
 
-    void ir_interpreter::vrs(ir_interpreter_func_context &context) {
-        context.pc += 2;
-        const char idx = *reinterpret_cast<const char *>(context.ir_bin + context.pc);
+    template <ir_number_operation operation>
+    static void run_number_op(ir_interpreter_func_context &context) {
+        ir_element &lhs = context.stack_ptr[-2];
+        ir_element &rhs = context.stack_ptr[-1];
 
-        if (idx >= context.local_slots.size()) {
-            // throw error
+        if (deoptimize(context.code[context.pc], lhs, rhs)) {
             return;
         }
 
-        context.local_args[idx].type = ir_element::str;
-        context.local_args[idx].str_data = "";
-    }
-
-    void ir_interpreter::ceq(ir_interpreter_func_context &context) {
-        context.pc += 2;
-
-        ir_element el1 = context.pop();
-        ir_element el2 = context.pop();
+        context.pc++;
+        operation(lhs, rhs);
 
-        if (el1.type == ir_element::str || el2.type == ir_element::str) {
-            ir_element el_ret;
-            el_ret.type = ir_element::str;
-            el_ret.num_data = (el2.str_data == el1.str_data);
+        // Nothing to release, numbers only
+        context.stack_ptr--;
+        rhs.type = ir_element::none;
+    }
 
-            context.push(el_ret);
+    template <ir_number_compare compare>
+    static void run_number_op(ir_interpreter_func_context &context) {
+        ir_element &lhs = context.stack_ptr[-2];
+        ir_element &rhs = context.stack_ptr[-1];
 
+        if (deoptimize(context.code[context.pc], lhs, rhs)) {
             return;
         }
 
-        ir_element el_ret;
-        el_ret.type = ir_element::num;
-        el_ret.num_data = (el2.num_data == el1.num_data);
+        context.pc++;
+        lhs = ir_element(static_cast<int64_t>(compare(lhs, rhs)));
 
-        context.push(el_ret);
+        context.stack_ptr--;
+        rhs.type = ir_element::none;
     }
 
-    void ir_interpreter::cgt(ir_interpreter_func_context &context) {
-        context.pc += 2;
+#define IR_QUICKENING_HANDLERS(name, operation, number_operation)                      \
+    void ir_interpreter::name(ir_interpreter_func_context &context) {                  \
+        run_quickening_op<operation, ir::opcode::name##nn>(context);                   \
+    }                                                                                  \
+                                                                                       \
+    void ir_interpreter::name##nn(ir_interpreter_func_context &context) {              \
+        run_number_op<number_operation>(context);                                      \
+    }                                                                                  \
+                                                                                       \
+    void ir_interpreter::r##name(ir_interpreter_func_context &context) {               \
+        run_register_op<operation>(context);                                           \
+    }
 
-        ir_element el1 = context.pop();
-        ir_element el2 = context.pop();
+    IR_QUICKENING_HANDLERS(add, add_values, add_numbers)
+    IR_QUICKENING_HANDLERS(sub, sub_values, sub_numbers)
+    IR_QUICKENING_HANDLERS(mul, mul_values, mul_numbers)
+    IR_QUICKENING_HANDLERS(ceq, ceq_values, ceq_numbers)
+    IR_QUICKENING_HANDLERS(cgt, cgt_values, cgt_numbers)
+    IR_QUICKENING_HANDLERS(cge, cge_values, cge_numbers)
+    IR_QUICKENING_HANDLERS(clt, clt_values, clt_numbers)
+    IR_QUICKENING_HANDLERS(cle, cle_values, cle_numbers)
 
-        if (el1.type == ir_element::str || el2.type == ir_element::str) {
-            ir_element el_ret;
-            el_ret.type = ir_element::str;
-            el_ret.num_data = (el2.str_data > el1.str_data);
+#undef IR_QUICKENING_HANDLERS
 
-            context.push(el_ret);
+    void ir_interpreter::rmov(ir_interpreter_func_context &context) {
+        const ir_instruction &inst = context.code[context.pc++];
+        context.set_operand(inst.short_operand, context.get_operand(static_cast<uint16_t>(inst.operand)));
+    }
 
-            return;
-        }
+    template <ir_binary_operation compare>
+    static void run_branch_unless(ir_interpreter_func_context &context) {
+        const size_t jump_pc = context.code[context.pc++].operand;
 
-        ir_element el_ret;
-        el_ret.type = ir_element::num;
-        el_ret.num_data = (el2.num_data > el1.num_data);
+        ir_element rhs = context.pop();
+        ir_element lhs = context.pop();
 
-        context.push(el_ret);
+        if (!compare(std::move(lhs), std::move(rhs)).int_data) {
+            context.pc = jump_pc;
+        }
     }
 
-    void ir_interpreter::cge(ir_interpreter_func_context &context) {
-        context.pc += 2;
+    template <ir_binary_operation compare>
+    static void run_branch_if(ir_interpreter_func_context &context) {
+        const size_t jump_pc = context.code[context.pc++].operand;
 
-        ir_element el1 = context.pop();
-        ir_element el2 = context.pop();
-
-        if (el1.type == ir_element::str || el2.type == ir_element::str) {
-            ir_element el_ret;
-            el_ret.type = ir_element::str;
-            el_ret.num_data = (el2.str_data >= el1.str_data);
+        ir_element rhs = context.pop();
+        ir_element lhs = context.pop();
 
-            context.push(el_ret);
-
-            return;
+        if (compare(std::move(lhs), std::move(rhs)).int_data) {
+            context.pc = jump_pc;
         }
-
-        ir_element el_ret;
-        el_ret.type = ir_element::num;
-        el_ret.num_data = (el2.num_data >= el1.num_data);
-
-        context.push(el_ret);
     }
 
-    void ir_interpreter::clt(ir_interpreter_func_context &context) {
-        context.pc += 2;
-
-        ir_element el1 = context.pop();
-        ir_element el2 = context.pop();
-
-        if (el1.type == ir_element::str || el2.type == ir_element::str) {
-            ir_element el_ret;
-            el_ret.type = ir_element::str;
-            el_ret.num_data = (el2.str_data < el1.str_data);
+    template <ir_binary_operation compare, ir::opcode number_op>
+    static void run_quickening_branch_unless(ir_interpreter_func_context &context) {
+        quicken(context.code[context.pc], number_op, context.stack_ptr[-2], context.stack_ptr[-1]);
+        run_branch_unless<compare>(context);
+    }
 
-            context.push(el_ret);
+    template <ir_number_compare compare>
+    static void run_number_branch_unless(ir_interpreter_func_context &context) {
+        ir_element &lhs = context.stack_ptr[-2];
+        ir_element &rhs = context.stack_ptr[-1];
 
+        if (deoptimize(context.code[context.pc], lhs, rhs)) {
             return;
         }
 
-        ir_element el_ret;
-        el_ret.type = ir_element::num;
-        el_ret.num_data = (el2.num_data < el1.num_data);
-
-        context.push(el_ret);
-    }
+        const bool taken = !compare(lhs, rhs);
 
-    void ir_interpreter::cle(ir_interpreter_func_context &context) {
-        context.pc += 2;
+        context.stack_ptr -= 2;
+        lhs.type = ir_element::none;
+        rhs.type = ir_element::none;
 
-        ir_element el1 = context.pop();
-        ir_element el2 = context.pop();
+        context.pc = taken ? context.code[context.pc].operand : context.pc + 1;
+    }
 
-        if (el1.type == ir_element::str || el2.type == ir_element::str) {
-            ir_element el_ret;
-            el_ret.type = ir_element::str;
-            el_ret.num_data = (el2.str_data <= el1.str_data);
+#define IR_QUICKENING_BRANCH_HANDLERS(name, compare, number_compare)                   \
+    void ir_interpreter::name(ir_interpreter_func_context &context) {                  \
+        run_quickening_branch_unless<compare, ir::opcode::name##nn>(context);          \
+    }                                                                                  \
+                                                                                       \
+    void ir_interpreter::name##nn(ir_interpreter_func_context &context) {              \
+        run_number_branch_unless<number_compare>(context);                             \
+    }
 
-            context.push(el_ret);
+    IR_QUICKENING_BRANCH_HANDLERS(bnlt, clt_values, clt_numbers)
+    IR_QUICKENING_BRANCH_HANDLERS(bnle, cle_values, cle_numbers)
+    IR_QUICKENING_BRANCH_HANDLERS(bngt, cgt_values, cgt_numbers)
+    IR_QUICKENING_BRANCH_HANDLERS(bnge, cge_values, cge_numbers)
+    IR_QUICKENING_BRANCH_HANDLERS(bneq, ceq_values, ceq_numbers)
 
-            return;
-        }
+#undef IR_QUICKENING_BRANCH_HANDLERS
 
-        ir_element el_ret;
-        el_ret.type = ir_element::num;
-        el_ret.num_data = (el2.num_data <= el1.num_data);
+    void ir_interpreter::inclc(ir_interpreter_func_context &context) {
+        const ir_instruction &inst = context.code[context.pc++];
+        ir_element &local = context.local_slots[inst.short_operand];
 
-        context.push(el_ret);
+        local = add_values(std::move(local), ir_element(context.constants[inst.operand]));
     }
 
-    void ir_interpreter::ble(ir_interpreter_func_context &context) {
-        context.pc += 2;
+    void ir_interpreter::addstlc(ir_interpreter_func_context &context) {
+        const ir_instruction &inst = context.code[context.pc++];
 
-        const size_t jump_pc = *reinterpret_cast<const size_t *>(context.ir_bin + context.pc);
+        ir_element rhs = context.pop();
+        ir_element lhs = context.pop();
 
-        context.pc += sizeof(size_t);
+        context.local_slots[inst.short_operand] = add_values(std::move(lhs), std::move(rhs));
+    }
 
-        ir_element el1 = context.pop();
-        ir_element el2 = context.pop();
+    void ir_interpreter::ldlc2(ir_interpreter_func_context &context) {
+        const ir_instruction &inst = context.code[context.pc++];
 
-        if (el1.type == ir_element::str || el2.type == ir_element::str) {
-            if (el2.str_data <= el1.str_data) {
-                context.pc = jump_pc;
-            }
+        context.push(context.local_slots[inst.short_operand]);
+        context.push(context.local_slots[inst.operand]);
+    }
 
-            return;
-        }
+    void ir_interpreter::ldlccst(ir_interpreter_func_context &context) {
+        const ir_instruction &inst = context.code[context.pc++];
 
-        if (el2.num_data <= el1.num_data) {
-            context.pc = jump_pc;
-        }
+        context.push(context.local_slots[inst.short_operand]);
+        context.push(context.constants[inst.operand]);
     }
 
-    void ir_interpreter::blt(ir_interpreter_func_context &context) {
-        context.pc += 2;
-
-        const size_t jump_pc = *reinterpret_cast<const size_t *>(context.ir_bin + context.pc);
+    void ir_interpreter::ldargcst(ir_interpreter_func_context &context) {
+        const ir_instruction &inst = context.code[context.pc++];
 
-        context.pc += sizeof(size_t);
+        context.push(context.local_args[inst.short_operand]);
+        context.push(context.constants[inst.operand]);
+    }
 
-        ir_element el1 = context.pop();
-        ir_element el2 = context.pop();
+    void ir_interpreter::ldelmlc(ir_interpreter_func_context &context) {
+        const ir_instruction &inst = context.code[context.pc++];
+        push_element(context, context.local_slots[inst.short_operand], context.local_slots[inst.operand]);
+    }
 
-        if (el1.type == ir_element::str || el2.type == ir_element::str) {
-            if (el2.str_data < el1.str_data) {
-                context.pc = jump_pc;
-            }
+    void ir_interpreter::met(ir_interpreter_func_context &context) {
+        // The frame is fully set up by the call already, arguments are used in place
+        context.pc++;
+    }
 
-            return;
-        }
+    void ir_interpreter::strlc(ir_interpreter_func_context &context) {
+        const ir_instruction &inst = context.code[context.pc++];
+        context.local_slots[inst.short_operand] = std::move(*--context.stack_ptr);
+    }
 
-        if (el2.num_data < el1.num_data) {
-            context.pc = jump_pc;
-        }
+    void ir_interpreter::strarg(ir_interpreter_func_context &context) {
+        const ir_instruction &inst = context.code[context.pc++];
+        context.local_args[inst.short_operand] = std::move(*--context.stack_ptr);
     }
 
-    void ir_interpreter::beq(ir_interpreter_func_context &context) {
-        context.pc += 2;
+    void ir_interpreter::vri(ir_interpreter_func_context &context) {
+        const ir_instruction &inst = context.code[context.pc++];
 
-        const size_t jump_pc = *reinterpret_cast<const size_t *>(context.ir_bin + context.pc);
+        context.local_args[inst.short_operand] = ir_element(static_cast<int64_t>(0));
+    }
 
-        context.pc += sizeof(size_t);
+    void ir_interpreter::vrs(ir_interpreter_func_context &context) {
+        const ir_instruction &inst = context.code[context.pc++];
 
-        ir_element el1 = context.pop();
-        ir_element el2 = context.pop();
+        context.local_args[inst.short_operand] = ir_element(std::string());
+    }
 
-        if (el1.type == ir_element::str || el2.type == ir_element::str) {
-            if (el2.str_data == el1.str_data) {
-                context.pc = jump_pc;
-            }
+    void ir_interpreter::ble(ir_interpreter_func_context &context) {
+        run_branch_if<cle_values>(context);
+    }
 
-            return;
-        }
+    void ir_interpreter::blt(ir_interpreter_func_context &context) {
+        run_branch_if<clt_values>(context);
+    }
 
-        if (el2.num_data == el1.num_data) {
-            context.pc = jump_pc;
-        }
+    void ir_interpreter::beq(ir_interpreter_func_context &context) {
+        run_branch_if<ceq_values>(context);
     }
 
     void ir_interpreter::bge(ir_interpreter_func_context &context) {
-        context.pc += 2;
-
-        const size_t jump_pc = *reinterpret_cast<const size_t *>(context.ir_bin + context.pc);
-
-        context.pc += sizeof(size_t);
-
-        ir_element el1 = context.pop();
-        ir_element el2 = context.pop();
-
-        if (el1.type == ir_element::str || el2.type == ir_element::str) {
-            if (el2.str_data >= el1.str_data) {
-                context.pc = jump_pc;
-            }
-
-            return;
-        }
-
-        if (el2.num_data >= el1.num_data) {
-            context.pc = jump_pc;
-        }
+        run_branch_if<cge_values>(context);
     }
 
     void ir_interpreter::bgt(ir_interpreter_func_context &context) {
-        context.pc += 2;
+        run_branch_if<cgt_values>(context);
+    }
 
-        const size_t jump_pc = *reinterpret_cast<const size_t *>(context.ir_bin + context.pc);
+    void ir_interpreter::br(ir_interpreter_func_context &context) {
+        const size_t jump_pc = context.code[context.pc].operand;
 
-        context.pc += sizeof(size_t);
+        // Loops close with a backward br, so a function looping long enough gets compiled too
+        if (jump_pc <= context.pc && jit_mode != ir_jit_mode::off) {
+            count_hit(context);
+            context.pc = jump_pc;
 
-        ir_element el1 = context.pop();
-        ir_element el2 = context.pop();
-        
-        if (el1.type == ir_element::str || el2.type == ir_element::str) {
-            if (el2.str_data > el1.str_data) {
-                context.pc = jump_pc;
+            if (jit_mode == ir_jit_mode::tracing) {
+                run_loop_trace(context);
             }
 
             return;
         }
 
-        if (el2.num_data > el1.num_data) {
-            context.pc = jump_pc;
-        }
-    }
-
-    void ir_interpreter::br(ir_interpreter_func_context &context) {
-        context.pc += 2;
-        const size_t jump_pc = *reinterpret_cast<const size_t *>(context.ir_bin + context.pc);
-
         context.pc = jump_pc;
     }
 
     void ir_interpreter::brt(ir_interpreter_func_context &context) {
-        context.pc += 2;
-
-        const size_t jump_pc = *reinterpret_cast<const size_t *>(context.ir_bin + context.pc);
-
-        context.pc += sizeof(size_t);
+        const size_t jump_pc = context.code[context.pc++].operand;
 
         ir_element el1 = context.pop();
 
-        if (el1.type == ir_element::num && el1.num_data) {
+        if ((el1.type == ir_element::num && el1.num_data) || (el1.type == ir_element::integer && el1.int_data)) {
             context.pc = jump_pc;
         }
     }
 
     void ir_interpreter::brf(ir_interpreter_func_context &context) {
-        context.pc += 2;
-
-        const size_t jump_pc = *reinterpret_cast<const size_t *>(context.ir_bin + context.pc);
-
-        context.pc += sizeof(size_t);
+        const size_t jump_pc = context.code[context.pc++].operand;
 
         ir_element el1 = context.pop();
         
-        if (el1.type == ir_element::num && !el1.num_data) {
+        if ((el1.type == ir_element::num && !el1.num_data) || (el1.type == ir_element::integer && !el1.int_data)) {
             context.pc = jump_pc;
         }
     }
 
-    void ir_interpreter::uno(ir_interpreter_func_context &context) {
-        context.pc += 2;
-
-        ir_element el1 = context.pop();
-
-        if (el1.type != ir_element::str) {
-            el1.num_data = !(el1.num_data);
-            context.push(el1);
-        } else {
-            // report
-        }
-    }
-
-    void ir_interpreter::ung(ir_interpreter_func_context &context) {
-        context.pc += 2;
-
-        ir_element el1 = context.pop();
-
-        if (el1.type != ir_element::str) {
-            el1.num_data = -(el1.num_data);
-            context.push(el1);
-        } else {
-            // report
-        }
-    }
-
-    void ir_interpreter::uin(ir_interpreter_func_context &context) {
-        context.pc += 2;
-
-        ir_element el1 = context.pop();
-
-        if (el1.type != ir_element::str) {
-            el1.num_data = ~(int64_t)(el1.num_data);
-            context.push(el1);
-        } else {
-            // report
-        }
-    }
-
     void ir_interpreter::newarr(ir_interpreter_func_context &context) {
-        context.pc += 2;
+        collect_if_needed();
+
+        context.pc++;
 
         uint64_t arr = ref_manager.make_new_array();
 
@@ -618,8 +613,23 @@ namespace snack::ir::backend {
         context.push(std::move(el));
     }
 
+    // Arrays are indexed by numbers from 0, doubles are truncated
+    static bool get_array_index(const ir_element &index, size_t &idx) {
+        if (index.type == ir_element::integer && index.int_data >= 0) {
+            idx = static_cast<size_t>(index.int_data);
+            return true;
+        }
+
+        if (index.type == ir_element::num && index.num_data >= 0) {
+            idx = static_cast<size_t>(index.num_data);
+            return true;
+        }
+
+        return false;
+    }
+
     void ir_interpreter::strelm(ir_interpreter_func_context &context) {
-        context.pc += 2;
+        context.pc++;
 
         ir_element val = context.pop();
         ir_element index = context.pop();
@@ -631,23 +641,25 @@ namespace snack::ir::backend {
             return;
         }
 
-        ir_object_base_ptr obj = ref_manager.get_obj(arr_ref.ref_id);
+        ir_object_base *obj = ref_manager.find_obj(arr_ref.ref_id);
 
         if (!obj) {
             // report
             return;
         }
 
-        ir_element *el_arr;
-
         switch (obj->get_type()) {
         case ir_object_base_type::array: {
-            if (index.type != ir_element::num) {
+            size_t idx;
+
+            if (!get_array_index(index, idx)) {
                 // report
                 return;
             }
 
-            el_arr = &(std::dynamic_pointer_cast<ir_array>(obj))->get_element(index.num_data);
+            ref_manager.write_barrier(obj, val);
+            static_cast<ir_array *>(obj)->store_element(idx, std::move(val));
+
             break;
         }
 
@@ -658,33 +670,31 @@ namespace snack::ir::backend {
             return;
         }
         }
-
-        if (el_arr->type == ir_element::none) {
-            el_arr->type = val.type;
-            el_arr->num_data = val.num_data;
-            el_arr->str_data = val.str_data;
-        } else if (el_arr->type == ir_element::str) {
-            el_arr->str_data = val.str_data;
-        } else if (el_arr->type == ir_element::num) {
-            el_arr->num_data = val.num_data;
-        }
     }
 
     void ir_interpreter::ldelm(ir_interpreter_func_context &context) {
-        context.pc += 2;
+        context.pc++;
 
         ir_element index = context.pop();
         ir_element arr_ref = context.pop();
 
+        push_element(context, arr_ref, index);
+    }
+
+    void ir_interpreter::push_element(ir_interpreter_func_context &context, const ir_element &arr_ref,
+        const ir_element &index) {
+        // Leaves one value like any load, none if there is nothing to read
         if (arr_ref.type != ir_element::ref) {
             // report
+            context.push(ir_element());
             return;
         }
 
-        ir_object_base_ptr obj = ref_manager.get_obj(arr_ref.ref_id);
+        ir_object_base *obj = ref_manager.find_obj(arr_ref.ref_id);
 
         if (!obj) {
             // report
+            context.push(ir_element());
             return;
         }
 
@@ -692,12 +702,22 @@ namespace snack::ir::backend {
 
         switch (obj->get_type()) {
         case ir_object_base_type::array: {
-            if (index.type != ir_element::num) {
+            size_t idx;
+
+            if (!get_array_index(index, idx)) {
                 // report
+                context.push(ir_element());
                 return;
             }
 
-            context.push((std::dynamic_pointer_cast<ir_array>(obj))->get_element(index.num_data));
+            ir_array *arr = static_cast<ir_array *>(obj);
+
+            // Reading past the end grows the array with none
+            if (idx >= arr->get_array_length()) {
+                arr->grow(idx + 1);
+            }
+
+            context.push(arr->get_element(idx));
 
             break;
         }
@@ -706,156 +726,835 @@ namespace snack::ir::backend {
             // Operator overload, call functions
 
             //report
+            context.push(ir_element());
             return;
         }
         }
     }
 
     void ir_interpreter::ret(ir_interpreter_func_context &context) {
-        context.pc += 2;
+        context.pc++;
 
-        if (context.evaluation_stack.size() > 1) {
+        if (context.get_stack_size() > 1) {
             // throw error
             return;
         }
 
-        if (context.evaluation_stack.size() == 1) {
-            ir_element el = context.pop();
-            
-
-            func_contexts.pop();
-            func_contexts.top().evaluation_stack.push(std::move(el));
+        // Every call leaves exactly one value for the caller, none if nothing is returned
+        ir_element el;
 
-            return;
+        if (context.get_stack_size() == 1) {
+            el = context.pop();
         }
 
-        func_contexts.pop();
+        pop_func_context();
+        finish_stack(std::move(el));
     }
 
-    void ir_interpreter::call(ir_interpreter_func_context &context) {
-        context.pc += 2;
+    void ir_interpreter::yield(ir_interpreter_func_context &context) {
+        context.pc++;
 
-        uint16_t unit_jump = *reinterpret_cast<const uint16_t *>(context.ir_bin + context.pc);
-        uint16_t func_jump = *reinterpret_cast<const uint16_t *>(context.ir_bin + context.pc + 2);
+        ir_element el = context.pop();
 
-        context.pc += 4;
-        last_context = &context;
+        if (coroutines.empty()) {
+            do_report(error_panic_code::yield_outside_coroutine, error_level::warn);
+            return;
+        }
 
-        if (unit_jump == 0x7FFF) {
-            bool res = context.owning_unit->call_function(this, func_jump, &context);
+        leave_coroutine(std::move(el), ir_coroutine_state::suspended);
+    }
 
-            if (!res) {
-                // do report
-                return;
-            }
-        } else {
-            auto unit_name = context.owning_unit->get_reference_unit_name(unit_jump);
+    void ir_interpreter::finish_stack(ir_element &&value) {
+        if (!stack->frames.empty()) {
+            stack->frames.top().push(std::move(value));
+            return;
+        }
+
+        // The first function of a coroutine returned, it is done
+        if (!coroutines.empty()) {
+            leave_coroutine(std::move(value), ir_coroutine_state::done);
+            return;
+        }
+
+        result = std::move(value);
+
+        if (ref_manager.arena_active) {
+            finish_invocation();
+        }
+    }
+
+    std::shared_ptr<ir_coroutine> ir_interpreter::get_coroutine(const ir_element &coroutine) {
+        if (coroutine.type != ir_element::ref) {
+            return nullptr;
+        }
+
+        ir_object_base_ptr obj = ref_manager.share_obj(coroutine.ref_id);
+
+        if (!obj || obj->get_type() != ir_object_base_type::coroutine) {
+            return nullptr;
+        }
+
+        return std::static_pointer_cast<ir_coroutine>(obj);
+    }
+
+    void ir_interpreter::enter_coroutine(std::shared_ptr<ir_coroutine> coroutine) {
+        // Its stack changes from now on
+        ref_manager.remark(coroutine.get());
+
+        ref_manager.remember(coroutine.get());
+
+        coroutine->state = ir_coroutine_state::running;
+        coroutine->resumer = stack;
+
+        stack = &coroutine->stack;
+        coroutines.push_back(std::move(coroutine));
+    }
+
+    void ir_interpreter::leave_coroutine(ir_element &&value, const ir_coroutine_state state) {
+        std::shared_ptr<ir_coroutine> coroutine = std::move(coroutines.back());
+        coroutines.pop_back();
+
+        coroutine->state = state;
+        stack = coroutine->resumer;
+        coroutine->resumer = nullptr;
+
+        ref_manager.remark(coroutine.get());
+
+        // A script resuming it left a placeholder for the value of its call, a host takes the result
+        if (stack->frames.empty()) {
+            coroutine->result = std::move(value);
+            return;
+        }
+
+        ir_interpreter_func_context &resumer = stack->frames.top();
+        resumer.stack_ptr--;
+        resumer.push(std::move(value));
+    }
+
+    ir_interpreter_func_context *ir_interpreter::enter_from_host(ir_function_entry &func, const std::vector<ir_element> &args) {
+        ir_interpreter_func_context *context = enter_function(nullptr, get_local_entry(func));
+
+        if (!context) {
+            return nullptr;
+        }
+
+        // Last argument first, like a caller would have pushed them
+        for (size_t i = 0; i < args.size(); i++) {
+            context->local_args[args.size() - 1 - i] = args[i];
+        }
+
+        return context;
+    }
+
+    bool ir_interpreter::call_from_host(ir_function_entry &func, const std::vector<ir_element> &args) {
+        if (args.size() != func.arg_count) {
+            return false;
+        }
+
+        return enter_from_host(func, args) != nullptr;
+    }
+
+    ir_element ir_interpreter::take_result() {
+        return std::move(result);
+    }
+
+    ir_element ir_interpreter::create_coroutine(ir_function_entry &func, const std::vector<ir_element> &args) {
+        if (args.size() != func.arg_count) {
+            return ir_element();
+        }
+
+        ir_element el;
+        el.type = ir_element::ref;
+        el.ref_id = ref_manager.make_new_coroutine();
+
+        std::shared_ptr<ir_coroutine> coroutine = get_coroutine(el);
+
+        // The first frame is set up on the coroutine stack right away, with nobody to take arguments from
+        ir_execution_stack *const running = stack;
+        stack = &coroutine->stack;
+
+        if (!enter_from_host(func, args)) {
+            coroutine->state = ir_coroutine_state::done;
+        }
+
+        stack = running;
+        return el;
+    }
+
+    ir_element ir_interpreter::resume(const ir_element &coroutine) {
+        std::shared_ptr<ir_coroutine> target = get_coroutine(coroutine);
+
+        if (!target || target->state != ir_coroutine_state::suspended) {
+            return ir_element();
+        }
+
+        // The idle stack takes the place of the running one, so the loop below stops once the
+        // coroutine gives control back. Native loops charge the budget, don't let them run out.
+        ir_execution_stack *const running = stack;
+        const int64_t running_budget = budget;
+
+        stack = &idle_stack;
+        budget = std::numeric_limits<int64_t>::max();
+
+        enter_coroutine(target);
+        run<false>();
+
+        stack = running;
+        budget = running_budget;
+
+        return std::move(target->result);
+    }
+
+    bool ir_interpreter::resume_after_call(ir_interpreter_func_context &context, const ir_element &coroutine) {
+        std::shared_ptr<ir_coroutine> target = get_coroutine(coroutine);
+
+        if (!target || target->state != ir_coroutine_state::suspended) {
+            return false;
+        }
+
+        // Replaced by the value the coroutine gives back
+        context.push(ir_element());
+
+        enter_coroutine(std::move(target));
+        return true;
+    }
+
+    void ir_interpreter::call(ir_interpreter_func_context &context) {
+        const ir_instruction &inst = context.code[context.pc++];
+        ir_call_site &site = context.call_sites[inst.operand];
+
+        if (site.generation != unit_mngr->get_generation() && !resolve_call_site(context, site)) {
+            // do report
+            skip_call(context, site);
+            return;
+        }
+
+        if (site.script_func) {
+            enter_function(&context, *site.script_func);
+            return;
+        }
+
+        call_host(context, site);
+    }
+
+    void ir_interpreter::skip_call(ir_interpreter_func_context &context, const ir_call_site &site) {
+        // The arguments are still taken and one value left, so the code after the call finds its stack as expected
+        for (uint16_t i = 0; i < site.arg_count; i++) {
+            context.pop();
+        }
+
+        context.push(ir_element());
+    }
+
+    void ir_interpreter::call_host(ir_interpreter_func_context &context, const ir_call_site &site) {
+        const ir_element *args_base = context.stack_ptr - site.arg_count;
+
+        site.host_func(site.host_object, context);
+
+        // Host functions are done already. Like script functions, they must leave one value behind
+        if (context.stack_ptr == args_base) {
+            context.push(ir_element());
+        }
+    }
+
+    void ir_interpreter::tcall(ir_interpreter_func_context &context) {
+        const ir_instruction &inst = context.code[context.pc++];
+        ir_call_site &site = context.call_sites[inst.operand];
+
+        if (site.generation != unit_mngr->get_generation() && !resolve_call_site(context, site)) {
+            // do report
+            skip_call(context, site);
+            return;
+        }
+
+        if (!site.script_func) {
+            call_host(context, site);
+            return;
+        }
+
+        ir_function_entry &func = *site.script_func;
+
+        // Only the arguments may be left, anything else is for the ret after us to complain about
+        if (context.get_stack_size() != func.arg_count) {
+            enter_function(&context, func);
+            return;
+        }
+
+        ir_element *args = context.stack_ptr - func.arg_count;
+        ir_element *locals = context.local_args + func.arg_count;
+
+        if (locals + func.local_count + func.max_stack + ir_value_stack_slack > stack->values.data() + stack->values.size()) {
+            do_report(error_panic_code::stack_overflow, error_level::critical);
+            unwind();
+
+            return;
+        }
+
+        // The arguments move down over our own, in order, then the rest of the old window is cleared
+        if (args != context.local_args) {
+            for (size_t i = 0; i < func.arg_count; i++) {
+                context.local_args[i] = std::move(args[i]);
+            }
+        }
+
+        for (ir_element *el = locals; el < context.stack_ptr; el++) {
+            *el = ir_element();
+        }
+
+        context.local_slots = locals;
+        context.stack_base = locals + func.local_count;
+        context.stack_ptr = context.stack_base;
+        context.pc = func.entry;
+        context.func_name = func.name;
+        context.code = func.code;
+        context.constants = func.constants;
+        context.call_sites = func.call_sites;
+        context.owning_unit = func.owning_unit;
+        context.func = &func;
+        context.native_code = nullptr;
+
+        if (jit_mode != ir_jit_mode::off) {
+            count_hit(context);
+        }
+    }
+
+    bool ir_interpreter::resolve_call_site(ir_interpreter_func_context &context, ir_call_site &site) {
+        userspace::unit_ptr call_unit;
+        userspace::unit *callee = context.owning_unit;
+
+        // Taken first, a unit replaced while resolving makes the site stale again
+        const uint64_t generation = unit_mngr->get_generation();
+
+        if (site.unit_ref != 0x7FFF) {
+            auto unit_name = context.owning_unit->get_reference_unit_name(static_cast<uint8_t>(site.unit_ref));
 
             if (!unit_name) {
-                // do report
-                return;
+                return false;
             }
 
-            userspace::unit_ptr call_unit = unit_mngr->use_unit(*unit_name);
+            call_unit = unit_mngr->use_unit(*unit_name);
 
             if (!call_unit) {
-                // do report
+                return false;
+            }
+
+            callee = call_unit.get();
+        }
+
+        if (!callee->resolve_call(static_cast<uint8_t>(site.func_idx), site)) {
+            return false;
+        }
+
+        if (site.script_func) {
+            site.script_func = &get_local_entry(*site.script_func);
+        }
+
+        site.unit = std::move(call_unit);
+        site.generation = generation;
+
+        return true;
+    }
+
+    ir_function_entry &ir_interpreter::get_local_entry(ir_function_entry &func) {
+        // Only interpreted units have script functions
+        userspace::interpreted_unit *unit = static_cast<userspace::interpreted_unit *>(func.owning_unit);
+        std::unique_ptr<ir_unit_instance> &instance = unit_instances[unit];
+
+        if (!instance) {
+            instance = std::make_unique<ir_unit_instance>();
+            instance->unit = unit->shared_from_this();
+            instance->code = unit->get_code();
+            instance->call_sites = unit->get_call_sites();
+            instance->entries = unit->get_entries();
+
+            for (ir_function_entry &entry : instance->entries) {
+                entry.code = instance->code.data();
+                entry.call_sites = instance->call_sites.data();
+            }
+        }
+
+        std::vector<ir_function_entry> &entries = instance->entries;
+
+        if (&func >= entries.data() && &func < entries.data() + entries.size()) {
+            return func;
+        }
+
+        return entries[&func - unit->get_entries().data()];
+    }
+
+    const std::vector<ir_instruction> &ir_interpreter::get_unit_code(const userspace::unit &unit) const {
+        static const std::vector<ir_instruction> no_code;
+        auto instance = unit_instances.find(&unit);
+
+        return (instance == unit_instances.end()) ? no_code : instance->second->code;
+    }
+
+    ir_interpreter_func_context *ir_interpreter::enter_function(ir_interpreter_func_context *caller,
+        ir_function_entry &func) {
+        const bool starts_invocation = !caller && arena_mode && stack == &main_stack && main_stack.frames.empty();
+        ir_interpreter_func_context *context = push_func_context(caller, func.arg_count, func.local_count, func.max_stack);
+
+        if (!context) {
+            return nullptr;
+        }
+
+        if (starts_invocation) {
+            ref_manager.arena_active = true;
+        }
+
+        context->pc = func.entry;
+        context->func_name = func.name;
+        context->code = func.code;
+        context->constants = func.constants;
+        context->call_sites = func.call_sites;
+        context->owning_unit = func.owning_unit;
+        context->func = &func;
+
+        if (jit_mode != ir_jit_mode::off) {
+            count_hit(*context);
+        }
+
+        return context;
+    }
+
+    void ir_interpreter::count_hit(ir_interpreter_func_context &context) {
+        ir_function_entry *func = context.func;
+
+        if (!func) {
+            return;
+        }
+
+        // A function the JIT can't handle stays at the threshold and is never tried again
+        if (!func->native_code && func->hit_count < jit_threshold && ++func->hit_count == jit_threshold) {
+            ir_jit::compile(*this, *func, jit_mode);
+        }
+
+        context.native_code = func->native_code;
+    }
+
+    void ir_interpreter::run_loop_trace(ir_interpreter_func_context &context) {
+        // Traces start on an empty evaluation stack
+        if (context.stack_ptr != context.stack_base) {
+            return;
+        }
+
+        ir_loop_trace &trace = loop_traces[&context.code[context.pc]];
+
+        if (!trace.native_code) {
+            if (trace.hit_count >= jit_threshold || ++trace.hit_count < jit_threshold) {
                 return;
             }
 
-            bool res = call_unit->call_function(this, func_jump, &context);
+            // Recording runs one iteration, which may stop anywhere if the loop can't be traced
+            const size_t header = context.pc;
+            trace.native_code = ir_jit::trace_loop(*this, context);
 
-            if (!res) {
-                // do report
+            if (!trace.native_code || context.pc != header) {
                 return;
             }
         }
+
+        trace.native_code(this, &context);
+    }
+
+    static bool is_same_value(const ir_element &el1, const ir_element &el2) {
+        if (el1.type != el2.type) {
+            return false;
+        }
+
+        switch (el1.type) {
+        case ir_element::num:
+            return (el1.num_data == el2.num_data) || (std::isnan(el1.num_data) && std::isnan(el2.num_data));
+
+        case ir_element::integer:
+            return el1.int_data == el2.int_data;
+
+        case ir_element::str:
+            return el1.get_string() == el2.get_string();
+
+        case ir_element::ref:
+            return el1.ref_id == el2.ref_id;
+
+        default:
+            return true;
+        }
+    }
+
+    void ir_interpreter::run_native(ir_interpreter_func_context &context) {
+        if (jit_mode != ir_jit_mode::differential) {
+            context.native_code(this, &context);
+            return;
+        }
+
+        const size_t start_pc = context.pc;
+        const std::vector<ir_element> start_state(context.local_args, context.stack_ptr);
+
+        // The interpreter goes first, then the frame is put back and the native code does the same
+        // work for real. Native code compiled for this mode never writes to the heap, so replaying
+        // it is safe.
+        while (!ir_jit::is_exit_op(context.code[context.pc].op, true)) {
+            step(context);
+        }
+
+        const size_t expected_pc = context.pc;
+        const std::vector<ir_element> expected_state(context.local_args, context.stack_ptr);
+
+        while (context.stack_ptr != context.local_args) {
+            *--context.stack_ptr = ir_element();
+        }
+
+        for (const auto &el : start_state) {
+            *context.stack_ptr++ = el;
+        }
+
+        context.pc = start_pc;
+        context.native_code(this, &context);
+
+        bool same = (context.pc == expected_pc)
+            && (static_cast<size_t>(context.stack_ptr - context.local_args) == expected_state.size());
+
+        for (size_t i = 0; same && i < expected_state.size(); i++) {
+            same = is_same_value(context.local_args[i], expected_state[i]);
+        }
+
+        if (!same) {
+            do_report(error_panic_code::jit_mismatch, error_level::critical,
+                *context.func_name + " from instruction " + std::to_string(start_pc - context.func->entry));
+        }
+    }
+
+    void ir_interpreter::set_jit_mode(const ir_jit_mode mode, const uint32_t threshold) {
+        jit_mode = ir_jit::is_available() ? mode : ir_jit_mode::off;
+        jit_threshold = threshold;
     }
 
     ir_interpreter_func_context &ir_interpreter::get_current_func_context() {
-        return func_contexts.top();
+        return stack->frames.top();
     }
 
     void ir_interpreter::endmet(ir_interpreter_func_context &context) {
-        context.pc += 2;
-
-        func_contexts.pop();
-    }
-
-#define BRIDGE(a) std::bind(&ir_interpreter::##a, this, std::placeholders::_1)
-
-    void ir_interpreter::init_opcode_table() {
-        opcode_map = {
-            { ir::opcode::add, BRIDGE(add) },
-            { ir::opcode::sub, BRIDGE(sub) },
-            { ir::opcode::mul, BRIDGE(mul) },
-            { ir::opcode::div, BRIDGE(div) },
-            { ir::opcode::mod, BRIDGE(mod) },
-            { ir::opcode::shl, BRIDGE(shl) },
-            { ir::opcode::shr, BRIDGE(shr) },
-            { ir::opcode::pwr, BRIDGE(pwr) },
-            { ir::opcode::ldcst, BRIDGE(ldcst) },
-            { ir::opcode::ldcststr, BRIDGE(ldcststr) },
-            { ir::opcode::ldlc, BRIDGE(ldlc) },
-            { ir::opcode::met, BRIDGE(met) },
-            { ir::opcode::strlc, BRIDGE(strlc) },
-            { ir::opcode::vri, BRIDGE(vri) },
-            { ir::opcode::vrs, BRIDGE(vrs) },
-            { ir::opcode::call, BRIDGE(call) },
-            { ir::opcode::endmet, BRIDGE(endmet) },
-            { ir::opcode::ceq, BRIDGE(ceq) },
-            { ir::opcode::clt, BRIDGE(clt) },
-            { ir::opcode::cle, BRIDGE(cle) },
-            { ir::opcode::cgt, BRIDGE(cgt) },
-            { ir::opcode::cge, BRIDGE(cge) },
-            { ir::opcode::beq, BRIDGE(beq) },
-            { ir::opcode::bge, BRIDGE(bge) },
-            { ir::opcode::bgt, BRIDGE(bgt) },
-            { ir::opcode::ble, BRIDGE(ble) },
-            { ir::opcode::blt, BRIDGE(blt) },
-            { ir::opcode::br, BRIDGE(br) },
-            { ir::opcode::brt, BRIDGE(brt) },
-            { ir::opcode::brf, BRIDGE(brf) },
-            { ir::opcode::uno, BRIDGE(uno) },
-            { ir::opcode::uin, BRIDGE(uin) },
-            { ir::opcode::ung, BRIDGE(ung) },
-            { ir::opcode::newarr, BRIDGE(newarr) },
-            { ir::opcode::strelm, BRIDGE(strelm) },
-            { ir::opcode::ldelm, BRIDGE(ldelm) },
-            { ir::opcode::ret, BRIDGE(ret) },
-            { ir::opcode::ldarg, BRIDGE(ldarg) },
-            { ir::opcode::strarg, BRIDGE(strarg) }
-        };
+        context.pc++;
+
+        pop_func_context();
+        finish_stack(ir_element());
+    }
+
+    void ir_interpreter::nop(ir_interpreter_func_context &context) {
+        context.pc++;
+    }
+
+    void ir_interpreter::upn(ir_interpreter_func_context &context) {
+        context.pc++;
+    }
+
+    void ir_interpreter::ldnull(ir_interpreter_func_context &context) {
+        context.pc++;
+
+        ir_element el;
+        context.push(el);
+    }
+
+    void ir_interpreter::newobj(ir_interpreter_func_context &context) {
+        // No object layout yet, class table is reserved
+        bad_opcode(context);
+    }
+
+    void ir_interpreter::idata(ir_interpreter_func_context &context) {
+        bad_opcode(context);
+    }
+
+    void ir_interpreter::strdata(ir_interpreter_func_context &context) {
+        bad_opcode(context);
+    }
+
+    void ir_interpreter::i64data(ir_interpreter_func_context &context) {
+        bad_opcode(context);
+    }
+
+    void ir_interpreter::f64data(ir_interpreter_func_context &context) {
+        bad_opcode(context);
+    }
+
+    void ir_interpreter::bad_opcode(ir_interpreter_func_context &context) {
+        const uint16_t op = static_cast<uint16_t>(context.code[context.pc].op);
+        const char *name = get_op_name(static_cast<ir::opcode>(op));
+
+        do_report(error_panic_code::invalid_opcode, error_level::critical, name ? name : std::to_string(op));
+
+        // Nothing sane to continue with
+        unwind();
+    }
+
+    ir_interpreter_func_context *ir_interpreter::push_func_context(ir_interpreter_func_context *caller,
+        const size_t arg_count, const size_t local_count, const size_t max_stack) {
+        ir_element *base = stack->frames.empty() ? stack->values.data() : stack->frames.top().stack_ptr;
+
+        // The caller pushed the arguments last, take them over where they are. The host has nothing
+        // to pass, give it empty slots.
+        const bool args_in_place = caller && (caller->stack_ptr - caller->stack_base >= static_cast<ptrdiff_t>(arg_count));
+
+        ir_element *args = args_in_place ? base - arg_count : base;
+        ir_element *locals = args + arg_count;
+
+        if (locals + local_count + max_stack + ir_value_stack_slack > stack->values.data() + stack->values.size()) {
+            do_report(error_panic_code::stack_overflow, error_level::critical);
+            unwind();
+
+            return nullptr;
+        }
+
+        ir_interpreter_func_context *context = stack->frames.push();
+
+        if (!context) {
+            do_report(error_panic_code::stack_overflow, error_level::critical);
+            unwind();
+
+            return nullptr;
+        }
+
+        if (args_in_place) {
+            caller->stack_ptr -= arg_count;
+        }
+
+        context->local_args = args;
+        context->local_slots = locals;
+        context->stack_base = locals + local_count;
+        context->stack_ptr = context->stack_base;
+        context->ref_manager = &ref_manager;
+        context->func = nullptr;
+        context->native_code = nullptr;
+        context->budget = &budget;
+        context->interpreter = this;
+
+        return context;
+    }
+
+    void ir_interpreter::pop_func_context() {
+        ir_interpreter_func_context &context = stack->frames.top();
+
+        // Keep everything above the caller stack pointer none
+        while (context.stack_ptr != context.local_args) {
+            *--context.stack_ptr = ir_element();
+        }
+
+        stack->frames.pop();
+    }
+
+    void ir_interpreter::unwind() {
+        while (!stack->frames.empty()) {
+            pop_func_context();
+        }
+
+        // A coroutine going down takes down whoever resumed it, up to the host
+        while (!coroutines.empty()) {
+            leave_coroutine(ir_element(), ir_coroutine_state::done);
+
+            while (!stack->frames.empty()) {
+                pop_func_context();
+            }
+        }
+
+        if (stack == &main_stack && ref_manager.arena_active) {
+            finish_invocation();
+        }
+    }
+
+    void ir_interpreter::do_report(error_panic_code code, error_level level) {
+        if (err_manager) {
+            err_manager->throw_error(error_category::interpreter, level, code, 0, 0);
+        }
+    }
+
+    void ir_interpreter::do_report(error_panic_code code, error_level level, const std::string &arg0) {
+        if (err_manager) {
+            err_manager->throw_error(error_category::interpreter, level, code, 0, 0, arg0);
+        }
+    }
+
+    ir_interpreter::ir_interpreter(snack::error_manager &err_mngr, snack::userspace::unit_manager &manager,
+        const size_t value_stack_size, const size_t frame_count)
+        : main_stack(value_stack_size, frame_count)
+        , stack(&main_stack)
+        , idle_stack(0, 0)
+        , err_manager(&err_mngr)
+        , unit_mngr(&manager)
+        , jit_mode(ir_jit_mode::off)
+        , jit_threshold(ir_default_jit_threshold)
+        , budget(0)
+        , gc_threshold(ir_default_gc_threshold)
+        , gc_min_threshold(ir_default_gc_threshold)
+        , gc_growth(ir_default_gc_growth)
+        , arena_mode(false) {
+        static std::atomic<uint64_t> next_instance_id{ 1 };
+        instance_id = next_instance_id++;
+    }
+
+    ir_interpreter::~ir_interpreter() {
+        for (const ir_native_block &block : native_blocks) {
+            ir_jit::release(block);
+        }
+    }
+
+    // Opcode handlers can push (call) or pop (ret, endmet) the function context stack, so the current
+    // context is refetched after every instruction. Everything else stays in one loop: no hashing, no
+    // type-erased functors, just an indexed jump.
+#define FETCH_OPCODE() static_cast<uint16_t>(context->code[context->pc].op)
+
+    // Compiled frames run their native code until it reaches an instruction it leaves to us
+#if SNACK_JIT
+#define RUN_NATIVE()                                                                   \
+        if (context->native_code) {                                                    \
+            run_native(*context);                                                      \
+        }
+#else
+#define RUN_NATIVE()
+#endif
+
+    void ir_interpreter::step(ir_interpreter_func_context &context) {
+        switch (context.code[context.pc].op) {
+            #define IR_OP_DEF(a)       \
+                case ir::opcode::a:    \
+                    a(context);        \
+                    break;
+            #include <snack/ir_opcode.def>
+            #undef IR_OP_DEF
+
+        default:
+            bad_opcode(context);
+            break;
+        }
     }
 
-    void ir_interpreter::do_opcode() {
-        ir_interpreter_func_context &context = get_current_func_context();
-        const ir::opcode op = *reinterpret_cast<const ir::opcode *>(context.ir_bin + context.pc);
+    // Counted runs stop before an instruction once the budget is spent, the frames are left for
+    // the next run. Native code charges the budget directly.
+#define CHARGE_BUDGET()                                                                \
+        if (counted && budget-- <= 0) {                                                \
+            return false;                                                              \
+        }
+
+    // New strings come from the arena while an invocation in arena mode runs
+    struct string_arena_scope {
+        ir_arena *previous;
+
+        explicit string_arena_scope(ir_arena *arena)
+            : previous(ir_set_string_arena(arena)) {}
+
+        ~string_arena_scope() {
+            ir_set_string_arena(previous);
+        }
+    };
+
+#if SNACK_THREADED_DISPATCH
+    template <bool counted>
+    bool ir_interpreter::run() {
+        const string_arena_scope string_scope(ref_manager.arena_active ? &ref_manager.arena : nullptr);
+
+        static void *const dispatch_table[] = {
+            #define IR_OP_DEF(a) &&op_##a,
+            #include <snack/ir_opcode.def>
+            #undef IR_OP_DEF
+            &&op_bad_opcode
+        };
 
-        opcode_map[op](context);
+        ir_interpreter_func_context *context = nullptr;
+        uint16_t op = 0;
+
+#define DISPATCH()                                                                     \
+        if (stack->frames.empty()) {                                                   \
+            return true;                                                               \
+        }                                                                              \
+        CHARGE_BUDGET();                                                               \
+        context = &stack->frames.top();                                                \
+        RUN_NATIVE();                                                                  \
+        op = FETCH_OPCODE();                                                           \
+        goto *dispatch_table[op < static_cast<uint16_t>(ir::opcode::total_opcode)      \
+                ? op                                                                   \
+                : static_cast<uint16_t>(ir::opcode::total_opcode)];
+
+        DISPATCH();
+
+        #define IR_OP_DEF(a) \
+            op_##a:          \
+                a(*context); \
+                DISPATCH();
+        #include <snack/ir_opcode.def>
+        #undef IR_OP_DEF
+
+    op_bad_opcode:
+        bad_opcode(*context);
+        DISPATCH();
+
+#undef DISPATCH
     }
+#else
+    template <bool counted>
+    bool ir_interpreter::run() {
+        const string_arena_scope string_scope(ref_manager.arena_active ? &ref_manager.arena : nullptr);
+
+        while (!stack->frames.empty()) {
+            CHARGE_BUDGET();
+
+            ir_interpreter_func_context *context = &stack->frames.top();
+            RUN_NATIVE();
+
+            switch (static_cast<ir::opcode>(FETCH_OPCODE())) {
+                #define IR_OP_DEF(a)       \
+                    case ir::opcode::a:    \
+                        a(*context);       \
+                        break;
+                #include <snack/ir_opcode.def>
+                #undef IR_OP_DEF
+
+            default:
+                bad_opcode(*context);
+                break;
+            }
+        }
 
-    ir_interpreter::ir_interpreter(snack::error_manager &err_mngr, snack::userspace::unit_manager &manager)
-        : err_manager(&err_mngr)
-        , unit_mngr(&manager) {
-        init_opcode_table();
+        return true;
     }
+#endif
 
     void ir_interpreter::interpret() {
-        while (!func_contexts.empty()) {
-            do_opcode();
+        // Native loops still charge the budget, make sure they never run out
+        budget = std::numeric_limits<int64_t>::max();
+        run<false>();
+    }
+
+    ir_run_status ir_interpreter::interpret_for(const uint64_t max_instructions) {
+        budget = static_cast<int64_t>(std::min<uint64_t>(max_instructions, std::numeric_limits<int64_t>::max()));
+        return run<true>() ? ir_run_status::finished : ir_run_status::suspended;
+    }
+
+    ir_run_status ir_interpreter::interpret_until(const std::chrono::steady_clock::time_point deadline) {
+        while (std::chrono::steady_clock::now() < deadline) {
+            if (interpret_for(ir_deadline_check_interval) == ir_run_status::finished) {
+                return ir_run_status::finished;
+            }
         }
+
+        return stack->frames.empty() ? ir_run_status::finished : ir_run_status::suspended;
     }
 
+#undef CHARGE_BUDGET
+#undef RUN_NATIVE
+#undef FETCH_OPCODE
+
     ir_object_base::ir_object_base(const ir_object_base_type type)
         : type(type)
         , id(0)
-        , ref_counter(1) {
+        , pin_count(0)
+        , marked(false)
+        , in_arena(false)
+        , remembered(false) {
     }
 
     ir_object_base::ir_object_base()
         : id(0)
-        , ref_counter(1) {
+        , pin_count(0)
+        , marked(false)
+        , in_arena(false)
+        , remembered(false) {
     }
 
     ir_oop_object::ir_oop_object()
@@ -863,87 +1562,209 @@ namespace snack::ir::backend {
     }
 
     ir_array::ir_array()
-        : ir_object_base(ir_object_base_type::array) {
+        : ir_object_base(ir_object_base_type::array)
+        , storage(ir_array_storage::integers) {
+    }
+
+    ir_coroutine::ir_coroutine(const size_t value_count, const size_t frame_count)
+        : ir_object_base(ir_object_base_type::coroutine)
+        , stack(value_count, frame_count)
+        , state(ir_coroutine_state::suspended)
+        , resumer(nullptr) {
+    }
+
+    ir_element ir_array::get_element(const size_t idx) const {
+        switch (storage) {
+        case ir_array_storage::integers:
+            return (idx < integers.size()) ? ir_element(integers[idx]) : ir_element();
+
+        case ir_array_storage::numbers:
+            return (idx < numbers.size()) ? ir_element(numbers[idx]) : ir_element();
+
+        default:
+            return (idx < elements.size()) ? elements[idx] : ir_element();
+        }
     }
 
-    ir_element &ir_array::get_element(int idx) {
+    void ir_array::store_element(const size_t idx, ir_element &&val) {
+        switch (storage) {
+        case ir_array_storage::integers:
+            if (idx < integers.size()) {
+                // A double turns the element into one, anything else but an integer resets it
+                if (val.type != ir_element::num) {
+                    integers[idx] = (val.type == ir_element::integer) ? val.int_data : 0;
+                    return;
+                }
+            } else if (idx == integers.size() && val.type == ir_element::integer) {
+                integers.push_back(val.int_data);
+                return;
+            } else if (idx == 0 && val.type == ir_element::num) {
+                storage = ir_array_storage::numbers;
+                numbers.push_back(val.num_data);
+                return;
+            }
+
+            break;
+
+        case ir_array_storage::numbers:
+            if (idx < numbers.size()) {
+                if (val.type != ir_element::integer) {
+                    numbers[idx] = (val.type == ir_element::num) ? val.num_data : 0.0;
+                    return;
+                }
+            } else if (idx == numbers.size() && val.type == ir_element::num) {
+                numbers.push_back(val.num_data);
+                return;
+            }
+
+            break;
+
+        default:
+            break;
+        }
+
+        make_generic();
+
         if (elements.size() < idx + 1) {
             elements.resize(idx + 1);
         }
 
-        return elements[idx];
+        ir_element &el = elements[idx];
+
+        if (el.type == ir_element::none || el.type == val.type || (el.is_number() && val.is_number())) {
+            el = std::move(val);
+        } else if (el.type == ir_element::str) {
+            // Interned, so there is nothing to allocate or to free
+            static ir_string *const empty_string = ir_intern_string(std::string());
+            el = ir_element(empty_string);
+        } else if (el.type == ir_element::num) {
+            el.num_data = 0;
+        } else if (el.type == ir_element::integer) {
+            el.int_data = 0;
+        }
     }
 
-    size_t ir_array::get_array_length() {
-        return elements.size();
-    }
+    void ir_array::grow(const size_t length) {
+        if (length <= get_array_length()) {
+            return;
+        }
 
-    ir_interpreter_ref_manager::ir_interpreter_ref_manager()
-        : ref_id(0) {
+        make_generic();
+        elements.resize(length);
     }
 
-    uint64_t ir_interpreter_ref_manager::new_id() const {
-        ref_id++;
-        return ref_id.load();
+    void ir_array::make_generic() {
+        if (storage == ir_array_storage::generic) {
+            return;
+        }
+
+        elements.reserve(get_array_length());
+
+        for (const int64_t val : integers) {
+            elements.emplace_back(val);
+        }
+
+        for (const double val : numbers) {
+            elements.emplace_back(val);
+        }
+
+        std::vector<int64_t>().swap(integers);
+        std::vector<double>().swap(numbers);
+
+        storage = ir_array_storage::generic;
     }
 
-    uint64_t ir_interpreter_ref_manager::make_new_array() {
-        const uint64_t id = new_id();
-        objects.emplace(id, std::move(std::make_shared<ir_array>()));
+    // Ends the free list
+    static constexpr uint32_t no_free_slot = 0xFFFFFFFF;
 
-        return id;
+    ir_interpreter_ref_manager::ir_interpreter_ref_manager()
+        : free_head(no_free_slot)
+        , object_count(0)
+        , gc_phase(ir_gc_phase::idle)
+        , sweep_pos(0)
+        , arena_active(false) {
     }
 
-    ir_object_base_ptr ir_interpreter_ref_manager::get_obj(uint64_t id) {
-        if (objects.find(id) != objects.end()) {
-            return objects[id];
+    uint64_t ir_interpreter_ref_manager::add_obj(ir_object_base_ptr &&obj) {
+        uint32_t index = free_head;
+
+        if (index != no_free_slot) {
+            free_head = slots[index].next_free;
+        } else {
+            index = static_cast<uint32_t>(slots.size());
+            slots.push_back(ir_object_slot{ nullptr, 1, no_free_slot });
         }
 
-        return nullptr;
+        ir_object_slot &slot = slots[index];
+
+        // A slot the sweep has yet to reach must survive it, the sweep unmarks it
+        obj->id = (static_cast<uint64_t>(slot.generation) << 32) | index;
+        obj->marked = (gc_phase == ir_gc_phase::sweeping) && (index >= sweep_pos);
+
+        slot.object = std::move(obj);
+        object_count++;
+
+        return slot.object->id;
     }
 
-    void ir_interpreter_func_context::push(ir_element &el) {
-        evaluation_stack.push(std::move(el));
+    void ir_interpreter_ref_manager::release(const uint32_t index) {
+        ir_object_slot &slot = slots[index];
+
+        // Destroyed once the slot is free again
+        ir_object_base_ptr dead = std::move(slot.object);
 
-        if (el.type == ir_element::ref) {
-            ref_manager->do_push(el.ref_id);
+        // Generation 0 is never used, references are never 0
+        if (++slot.generation == 0) {
+            slot.generation = 1;
         }
-    }
 
-    void ir_interpreter_func_context::push(long double val) {
-        ir_element el(val);
-        push(el);
-    }
+        slot.next_free = free_head;
+        free_head = index;
 
-    void ir_interpreter_func_context::push(const std::string &val) {
-        ir_element el(val);
-        push(el);
+        object_count--;
     }
 
-    ir_element ir_interpreter_func_context::pop() {
-        ir_element el = std::move(evaluation_stack.top());
-        evaluation_stack.pop();
+    void ir_interpreter_ref_manager::rebuild_free_list() {
+        free_head = no_free_slot;
 
-        if (el.type == ir_element::ref) {
-            ref_manager->do_pop(el.ref_id);
+        for (size_t i = slots.size(); i-- > 0;) {
+            if (!slots[i].object) {
+                slots[i].next_free = free_head;
+                free_head = static_cast<uint32_t>(i);
+            }
         }
-
-        return el;
     }
 
-    void ir_interpreter_ref_manager::do_push(uint64_t ref) {
-        if (objects.find(ref) != objects.end()) {
-            objects[ref]->ref_counter += 1;
+    template <typename T>
+    uint64_t ir_interpreter_ref_manager::make_obj() {
+        if (!arena_active) {
+            return add_obj(std::make_shared<T>());
         }
+
+        // The control block comes from the arena too, so one bump pays for both
+        ir_object_base_ptr obj = std::allocate_shared<T>(ir_arena_allocator<T>(&arena));
+        obj->in_arena = true;
+
+        const uint64_t id = add_obj(std::move(obj));
+        arena_objects.push_back(id);
+
+        return id;
     }
 
-    void ir_interpreter_ref_manager::do_pop(uint64_t ref) {
-        if (objects.find(ref) != objects.end()) {
-            objects[ref]->ref_counter -= 1;
+    uint64_t ir_interpreter_ref_manager::make_new_array() {
+        return make_obj<ir_array>();
+    }
 
-            if (objects[ref]->ref_counter == 0) {
-                objects.erase(ref);
-            }
-        }
+    uint64_t ir_interpreter_ref_manager::make_new_coroutine() {
+        return make_obj<ir_coroutine>();
+    }
+
+    ir_object_base_ptr ir_interpreter_ref_manager::get_obj(uint64_t id) {
+        ir_object_base *obj = find_obj(id);
+        return (obj && !obj->in_arena) ? slots[id & 0xFFFFFFFF].object : nullptr;
+    }
+
+    ir_object_base_ptr ir_interpreter_ref_manager::share_obj(const uint64_t id) const {
+        return find_obj(id) ? slots[id & 0xFFFFFFFF].object : nullptr;
     }
 }
\ No newline at end of file
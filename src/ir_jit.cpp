@@ -0,0 +1,2293 @@
+#include <snack/ir_jit.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <initializer_list>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#if SNACK_JIT
+#include <sys/mman.h>
+#endif
+
+namespace snack::ir::backend {
+    // Number forms are compiled like the generic instruction, the templates check types anyway
+    static ir::opcode get_op(const ir_instruction &inst) {
+        return ir::get_generic_op(inst.op);
+    }
+
+    ir_jit::helper ir_jit::get_helper(const ir::opcode op) {
+        switch (op) {
+            #define IR_OP_DEF(a)                                       \
+                case ir::opcode::a:                                    \
+                    return &call_handler<&ir_interpreter::a>;
+            #include <snack/ir_opcode.def>
+            #undef IR_OP_DEF
+
+        default:
+            return &call_handler<&ir_interpreter::bad_opcode>;
+        }
+    }
+
+    bool ir_jit::is_exit_op(const ir::opcode op, const bool isolate_heap_writes) {
+        switch (ir::get_generic_op(op)) {
+        // These push or pop frames, switch stacks or unwind everything
+        case ir::opcode::call:
+        case ir::opcode::tcall:
+        case ir::opcode::ret:
+        case ir::opcode::endmet:
+        case ir::opcode::newobj:
+        case ir::opcode::idata:
+        case ir::opcode::strdata:
+        case ir::opcode::i64data:
+        case ir::opcode::f64data:
+        case ir::opcode::yield:
+            return true;
+
+        case ir::opcode::newarr:
+        case ir::opcode::strelm:
+            return isolate_heap_writes;
+
+        default:
+            return op >= ir::opcode::total_opcode;
+        }
+    }
+
+#if SNACK_JIT
+    bool ir_jit::is_available() {
+        return true;
+    }
+
+    namespace {
+        bool is_branch_op(const ir::opcode op) {
+            switch (op) {
+            case ir::opcode::br:
+            case ir::opcode::brf:
+            case ir::opcode::brt:
+            case ir::opcode::blt:
+            case ir::opcode::ble:
+            case ir::opcode::bgt:
+            case ir::opcode::bge:
+            case ir::opcode::beq:
+            case ir::opcode::bnlt:
+            case ir::opcode::bnle:
+            case ir::opcode::bngt:
+            case ir::opcode::bnge:
+            case ir::opcode::bneq:
+                return true;
+
+            default:
+                return false;
+            }
+        }
+
+        enum x64_reg : uint8_t {
+            rax = 0,
+            rcx = 1,
+            rdx = 2,
+            rbx = 3,
+            rbp = 5,
+            rsi = 6,
+            rdi = 7,
+            r8 = 8,
+            r9 = 9,
+            r10 = 10,
+            r11 = 11,
+            r12 = 12,
+            r15 = 15
+        };
+
+        enum x64_cond : uint8_t {
+            below = 0x2,
+            above_equal = 0x3,
+            equal = 0x4,
+            not_equal = 0x5,
+            below_equal = 0x6,
+            above = 0x7,
+            parity = 0xA,
+            less = 0xC,
+            greater_equal = 0xD,
+            less_equal = 0xE,
+            greater = 0xF
+        };
+
+        // Integer instructions, op reg, r/m64 opcodes after REX.W
+        enum x64_int_op : uint8_t {
+            int_add = 0x03,
+            int_sub = 0x2B,
+            int_cmp = 0x3B,
+            int_imul = 0xAF
+        };
+
+        // SSE scalar double opcodes, after F2 0F
+        enum x64_sd_op : uint8_t {
+            addsd = 0x58,
+            mulsd = 0x59,
+            subsd = 0x5C,
+            divsd = 0x5E
+        };
+
+        // SSE instruction prefixes
+        constexpr uint8_t sse_none = 0x00;
+        constexpr uint8_t sse_pd = 0x66;
+        constexpr uint8_t sse_sd = 0xF2;
+
+        /*! \brief Just the handful of x86-64 encodings the templates need. */
+        class x64_assembler {
+            std::vector<uint8_t> code;
+            std::vector<ptrdiff_t> labels;
+
+            // Position of a rel32 field, and the label it points to
+            std::vector<std::pair<size_t, size_t>> fixups;
+
+            // REX.W, with the high bits of the ModRM reg and rm fields
+            void rex_w(const uint8_t reg, const uint8_t rm) {
+                code.push_back(static_cast<uint8_t>(0x48 | ((reg & 8) ? 0x04 : 0) | ((rm & 8) ? 0x01 : 0)));
+            }
+
+            void int_op_code(const x64_int_op op, const uint8_t reg, const uint8_t rm) {
+                rex_w(reg, rm);
+
+                if (op == int_imul) {
+                    code.push_back(0x0F);
+                }
+
+                code.push_back(op);
+            }
+
+            void emit32(const uint32_t val) {
+                for (int i = 0; i < 4; i++) {
+                    code.push_back(static_cast<uint8_t>(val >> (i * 8)));
+                }
+            }
+
+            void emit64(const uint64_t val) {
+                emit32(static_cast<uint32_t>(val));
+                emit32(static_cast<uint32_t>(val >> 32));
+            }
+
+            // [base + disp32] memory operand, base can't be rsp or r12
+            void mem(const uint8_t reg, const x64_reg base, const int32_t disp) {
+                code.push_back(static_cast<uint8_t>(0x80 | ((reg & 7) << 3) | (base & 7)));
+                emit32(static_cast<uint32_t>(disp));
+            }
+
+            void reg_reg(const uint8_t reg, const uint8_t rm) {
+                code.push_back(static_cast<uint8_t>(0xC0 | ((reg & 7) << 3) | (rm & 7)));
+            }
+
+            void rel32(const size_t label) {
+                fixups.emplace_back(code.size(), label);
+                emit32(0);
+            }
+
+        public:
+            const std::vector<uint8_t> &get_code() const {
+                return code;
+            }
+
+            size_t new_label() {
+                labels.push_back(-1);
+                return labels.size() - 1;
+            }
+
+            void bind(const size_t label) {
+                labels[label] = code.size();
+            }
+
+            ptrdiff_t get_label_pos(const size_t label) const {
+                return labels[label];
+            }
+
+            void emit(std::initializer_list<uint8_t> bytes) {
+                code.insert(code.end(), bytes);
+            }
+
+            void data32(const int32_t val) {
+                emit32(static_cast<uint32_t>(val));
+            }
+
+            void align(const size_t boundary) {
+                while (code.size() % boundary) {
+                    code.push_back(0xCC);
+                }
+            }
+
+            void load(const x64_reg dst, const x64_reg base, const int32_t disp) {
+                rex_w(dst, base);
+                code.push_back(0x8B);
+                mem(dst, base, disp);
+            }
+
+            void store(const x64_reg base, const int32_t disp, const x64_reg src) {
+                rex_w(src, base);
+                code.push_back(0x89);
+                mem(src, base, disp);
+            }
+
+            void move(const x64_reg dst, const x64_reg src) {
+                rex_w(src, dst);
+                code.push_back(0x89);
+                reg_reg(src, dst);
+            }
+
+            void store_imm(const x64_reg base, const int32_t disp, const int32_t imm) {
+                rex_w(0, base);
+                code.push_back(0xC7);
+                mem(0, base, disp);
+                emit32(static_cast<uint32_t>(imm));
+            }
+
+            void cmp_byte(const x64_reg base, const int32_t disp, const uint8_t imm) {
+                emit({ 0x80 });
+                mem(7, base, disp);
+                code.push_back(imm);
+            }
+
+            void store_byte(const x64_reg base, const int32_t disp, const uint8_t imm) {
+                emit({ 0xC6 });
+                mem(0, base, disp);
+                code.push_back(imm);
+            }
+
+            void mov_imm(const x64_reg dst, const uint64_t imm) {
+                rex_w(0, dst);
+                code.push_back(static_cast<uint8_t>(0xB8 + (dst & 7)));
+                emit64(imm);
+            }
+
+            void add_imm(const x64_reg reg, const int8_t imm) {
+                rex_w(0, reg);
+                emit({ 0x83, static_cast<uint8_t>(0xC0 | (reg & 7)), static_cast<uint8_t>(imm) });
+            }
+
+            void sub_imm(const x64_reg reg, const int32_t imm) {
+                rex_w(0, reg);
+                emit({ 0x81, static_cast<uint8_t>(0xE8 | (reg & 7)) });
+                emit32(static_cast<uint32_t>(imm));
+            }
+
+            // op reg, [base + disp]
+            void int_op(const x64_int_op op, const x64_reg reg, const x64_reg base, const int32_t disp) {
+                int_op_code(op, reg, base);
+                mem(reg, base, disp);
+            }
+
+            // op dst, src
+            void int_op(const x64_int_op op, const x64_reg dst, const x64_reg src) {
+                int_op_code(op, dst, src);
+                reg_reg(dst, src);
+            }
+
+            void neg(const x64_reg reg) {
+                rex_w(0, reg);
+                emit({ 0xF7, static_cast<uint8_t>(0xD8 | (reg & 7)) });
+            }
+
+            void test(const x64_reg reg) {
+                rex_w(reg, reg);
+                code.push_back(0x85);
+                reg_reg(reg, reg);
+            }
+
+            // sub qword [base + disp], imm
+            void sub_mem_imm(const x64_reg base, const int32_t disp, const int32_t imm) {
+                rex_w(0, base);
+                code.push_back(0x81);
+                mem(5, base, disp);
+                emit32(static_cast<uint32_t>(imm));
+            }
+
+            void cmp_imm(const x64_reg reg, const int32_t imm) {
+                rex_w(0, reg);
+                emit({ 0x81, static_cast<uint8_t>(0xF8 | (reg & 7)) });
+                emit32(static_cast<uint32_t>(imm));
+            }
+
+            // Register to register SSE instruction, xmm8 to xmm15 need a REX prefix
+            void sse(const uint8_t prefix, const uint8_t op, const uint8_t reg, const uint8_t rm, const bool wide = false) {
+                if (prefix != sse_none) {
+                    code.push_back(prefix);
+                }
+
+                const uint8_t rex = (wide ? 0x08 : 0) | ((reg & 8) ? 0x04 : 0) | ((rm & 8) ? 0x01 : 0);
+
+                if (rex) {
+                    code.push_back(0x40 | rex);
+                }
+
+                emit({ 0x0F, op, static_cast<uint8_t>(0xC0 | ((reg & 7) << 3) | (rm & 7)) });
+            }
+
+            void sse_mem(const uint8_t prefix, const uint8_t op, const uint8_t reg, const x64_reg base, const int32_t disp) {
+                if (prefix != sse_none) {
+                    code.push_back(prefix);
+                }
+
+                if (reg & 8) {
+                    code.push_back(0x44);
+                }
+
+                emit({ 0x0F, op });
+                mem(reg, base, disp);
+            }
+
+            // movsd xmm, [base + disp]
+            void load_sd(const uint8_t xmm, const x64_reg base, const int32_t disp) {
+                sse_mem(sse_sd, 0x10, xmm, base, disp);
+            }
+
+            // movsd [base + disp], xmm
+            void store_sd(const x64_reg base, const int32_t disp, const uint8_t xmm) {
+                sse_mem(sse_sd, 0x11, xmm, base, disp);
+            }
+
+            void op_sd(const x64_sd_op op, const uint8_t xmm, const x64_reg base, const int32_t disp) {
+                sse_mem(sse_sd, op, xmm, base, disp);
+            }
+
+            void op_sd(const x64_sd_op op, const uint8_t dst, const uint8_t src) {
+                sse(sse_sd, op, dst, src);
+            }
+
+            // movapd xmm, xmm
+            void move_sd(const uint8_t dst, const uint8_t src) {
+                sse(sse_pd, 0x28, dst, src);
+            }
+
+            // movq xmm, r64
+            void move_to_sd(const uint8_t xmm, const x64_reg src) {
+                sse(sse_pd, 0x6E, xmm, src, true);
+            }
+
+            // movq r64, xmm
+            void move_from_sd(const x64_reg dst, const uint8_t xmm) {
+                sse(sse_pd, 0x7E, xmm, dst, true);
+            }
+
+            // xorpd xmm, xmm
+            void xor_sd(const uint8_t dst, const uint8_t src) {
+                sse(sse_pd, 0x57, dst, src);
+            }
+
+            void zero_sd(const uint8_t xmm) {
+                xor_sd(xmm, xmm);
+            }
+
+            void ucomisd(const uint8_t lhs, const uint8_t rhs) {
+                sse(sse_pd, 0x2E, lhs, rhs);
+            }
+
+            // cvttsd2si r64, xmm, truncating like a cast to int
+            void truncate_sd(const x64_reg dst, const uint8_t xmm) {
+                sse(sse_sd, 0x2C, dst, xmm, true);
+            }
+
+            // cvtsi2sd xmm, r64
+            void convert_to_sd(const uint8_t xmm, const x64_reg src) {
+                sse(sse_sd, 0x2A, xmm, src, true);
+            }
+
+            // A whole 16 bytes element through xmm0, movups both ways
+            void copy_element(const x64_reg dst, const int32_t dst_disp, const x64_reg src, const int32_t src_disp) {
+                emit({ 0x0F, 0x10 });
+                mem(0, src, src_disp);
+                emit({ 0x0F, 0x11 });
+                mem(0, dst, dst_disp);
+            }
+
+            void call_abs(const void *func) {
+                mov_imm(rax, reinterpret_cast<uint64_t>(func));
+                emit({ 0xFF, 0xD0 });
+            }
+
+            void jmp(const size_t label) {
+                emit({ 0xE9 });
+                rel32(label);
+            }
+
+            void jcc(const x64_cond cond, const size_t label) {
+                emit({ 0x0F, static_cast<uint8_t>(0x80 | cond) });
+                rel32(label);
+            }
+
+            // lea reg, [rip + label]
+            void lea_label(const x64_reg dst, const size_t label) {
+                emit({ 0x48, 0x8D, static_cast<uint8_t>((dst << 3) | 5) });
+                rel32(label);
+            }
+
+            bool resolve() {
+                for (const auto &[pos, label] : fixups) {
+                    if (labels[label] < 0) {
+                        return false;
+                    }
+
+                    const int32_t rel = static_cast<int32_t>(labels[label] - static_cast<ptrdiff_t>(pos + 4));
+                    std::memcpy(&code[pos], &rel, sizeof(rel));
+                }
+
+                return true;
+            }
+        };
+
+        x64_int_op get_int_op(const x64_sd_op op) {
+            switch (op) {
+            case subsd:
+                return int_sub;
+
+            case mulsd:
+                return int_imul;
+
+            default:
+                return int_add;
+            }
+        }
+
+        // Signed condition a comparison holds on, or a branch is taken on, after cmp lhs, rhs. For
+        // brt and brf, after test.
+        x64_cond get_int_cond(const ir::opcode op) {
+            switch (op) {
+            case ir::opcode::blt:
+            case ir::opcode::clt:
+            case ir::opcode::bnge:
+                return less;
+
+            case ir::opcode::ble:
+            case ir::opcode::cle:
+            case ir::opcode::bngt:
+                return less_equal;
+
+            case ir::opcode::bgt:
+            case ir::opcode::cgt:
+            case ir::opcode::bnle:
+                return greater;
+
+            case ir::opcode::bge:
+            case ir::opcode::cge:
+            case ir::opcode::bnlt:
+                return greater_equal;
+
+            case ir::opcode::beq:
+            case ir::opcode::ceq:
+            case ir::opcode::brf:
+                return equal;
+
+            default:
+                return not_equal;
+            }
+        }
+
+        x64_cond invert(const x64_cond cond) {
+            return static_cast<x64_cond>(cond ^ 1);
+        }
+
+        // Where the templates find the frame and element fields
+        constexpr int32_t pc_offset = offsetof(ir_interpreter_func_context, pc);
+        constexpr int32_t stack_ptr_offset = offsetof(ir_interpreter_func_context, stack_ptr);
+        constexpr int32_t local_args_offset = offsetof(ir_interpreter_func_context, local_args);
+        constexpr int32_t local_slots_offset = offsetof(ir_interpreter_func_context, local_slots);
+        constexpr int32_t budget_offset = offsetof(ir_interpreter_func_context, budget);
+
+        constexpr int32_t element_size = sizeof(ir_element);
+        constexpr int32_t payload_offset = offsetof(ir_element, num_data);
+
+        static_assert(offsetof(ir_element, type) == 0, "Templates expect the element tag first");
+        static_assert(payload_offset == 8, "Templates expect the element payload at offset 8");
+
+        using helper_getter = ir_jit_code (*)(const ir::opcode);
+
+        /*! \brief Native code of one function.
+         *
+         * rbx holds the frame and r12 the interpreter. The stack pointer stays in the frame, so
+         * handlers called in between see it as usual.
+         */
+        class x64_function_builder {
+            x64_assembler as;
+
+            const ir_function_entry &func;
+            helper_getter get_helper;
+            const bool isolate_heap_writes;
+            const bool trace_loops;
+
+            std::vector<size_t> inst_labels;
+            size_t exit_label;
+            size_t table_label;
+
+            // Out of line handler calls, for values the inline templates don't handle
+            struct slow_path {
+                size_t label;
+                size_t pc;
+            };
+
+            std::vector<slow_path> slow_paths;
+
+            // Instructions from a loop header to its furthest back edge, 0 if not a header, and
+            // where headers leave once the budget runs out
+            std::vector<uint32_t> loop_costs;
+            std::vector<slow_path> budget_exits;
+
+            size_t label_of(const size_t pc) const {
+                return inst_labels[pc - func.entry];
+            }
+
+            size_t add_slow_path(const size_t pc) {
+                const size_t label = as.new_label();
+                slow_paths.push_back(slow_path{ label, pc });
+
+                return label;
+            }
+
+            static int32_t slot_disp(const size_t slot) {
+                return static_cast<int32_t>(slot * element_size);
+            }
+
+            // The tag and payload of a constant, if it can be copied without touching a reference count
+            bool get_constant(const uint32_t idx, uint8_t &type, uint64_t &bits) const {
+                const ir_element &cst = func.constants[idx];
+
+                switch (cst.type) {
+                case ir_element::num:
+                    std::memcpy(&bits, &cst.num_data, sizeof(bits));
+                    break;
+
+                case ir_element::integer:
+                    bits = static_cast<uint64_t>(cst.int_data);
+                    break;
+
+                case ir_element::str:
+                    if (!cst.str_data->interned) {
+                        return false;
+                    }
+
+                    bits = reinterpret_cast<uint64_t>(cst.str_data);
+                    break;
+
+                default:
+                    return false;
+                }
+
+                type = cst.type;
+                return true;
+            }
+
+            void store_constant(const x64_reg base, const int32_t disp, const uint8_t type, const uint64_t bits) {
+                as.store_byte(base, disp, type);
+                as.mov_imm(rax, bits);
+                as.store(base, disp + payload_offset, rax);
+            }
+
+            void exit_at(const size_t pc) {
+                as.store_imm(rbx, pc_offset, static_cast<int32_t>(pc));
+                as.jmp(exit_label);
+            }
+
+            // Every loop iteration is charged at its header, leaving before it when nothing is left
+            void charge_budget(const size_t pc) {
+                const size_t label = as.new_label();
+                budget_exits.push_back(slow_path{ label, pc });
+
+                as.load(rax, rbx, budget_offset);
+                as.sub_mem_imm(rax, 0, static_cast<int32_t>(loop_costs[pc - func.entry]));
+                as.jcc(less_equal, label);
+            }
+
+            void emit_handler_call(const size_t pc) {
+                as.store_imm(rbx, pc_offset, static_cast<int32_t>(pc));
+
+                // mov rdi, r12 / mov rsi, rbx
+                as.emit({ 0x4C, 0x89, 0xE7 });
+                as.emit({ 0x48, 0x89, 0xDE });
+
+                as.call_abs(reinterpret_cast<const void *>(get_helper(get_op(func.code[pc]))));
+
+                // A branch handler moved the pc, follow it
+                if (is_branch_op(get_op(func.code[pc]))) {
+                    const uint32_t target = func.code[pc].operand;
+
+                    as.load(rax, rbx, pc_offset);
+                    as.cmp_imm(rax, static_cast<int32_t>(target));
+                    as.jcc(equal, label_of(target));
+                }
+            }
+
+            // Jump to fail unless the two top values have the given tag, rdx holds the stack pointer
+            void check_types(const uint8_t type, const size_t fail) {
+                as.cmp_byte(rdx, -2 * element_size, type);
+                as.jcc(not_equal, fail);
+                as.cmp_byte(rdx, -element_size, type);
+                as.jcc(not_equal, fail);
+            }
+
+            // Two integers or two doubles on top go in rax or xmm0, with the operation done. Mixed
+            // operands go to slow. Integers wrap around like the interpreter's.
+            void build_top_operation(const x64_sd_op op, const size_t slow, const size_t done_int) {
+                const size_t not_integers = as.new_label();
+
+                as.load(rdx, rbx, stack_ptr_offset);
+                check_types(ir_element::integer, not_integers);
+
+                as.load(rax, rdx, -2 * element_size + payload_offset);
+                as.int_op(get_int_op(op), rax, rdx, -element_size + payload_offset);
+                as.jmp(done_int);
+
+                as.bind(not_integers);
+                check_types(ir_element::num, slow);
+
+                as.load_sd(0, rdx, -2 * element_size + payload_offset);
+                as.op_sd(op, 0, rdx, -element_size + payload_offset);
+            }
+
+            void pop_numbers(const int count) {
+                for (int i = 1; i <= count; i++) {
+                    as.store_byte(rdx, -i * element_size, ir_element::none);
+                }
+
+                as.sub_imm(rdx, count * element_size);
+                as.store(rbx, stack_ptr_offset, rdx);
+            }
+
+            void build_load(const size_t pc, const int32_t base_offset) {
+                const size_t slow = add_slow_path(pc);
+                const int32_t disp = slot_disp(func.code[pc].short_operand);
+
+                // Numbers and none are plain copies, anything else is counted
+                as.load(rcx, rbx, base_offset);
+                as.cmp_byte(rcx, disp, ir_element::str);
+                as.jcc(above_equal, slow);
+
+                as.load(rdx, rbx, stack_ptr_offset);
+                as.copy_element(rdx, 0, rcx, disp);
+                as.add_imm(rdx, element_size);
+                as.store(rbx, stack_ptr_offset, rdx);
+            }
+
+            bool build_load_constant(const size_t pc) {
+                uint8_t type;
+                uint64_t bits;
+
+                if (!get_constant(func.code[pc].operand, type, bits)) {
+                    return false;
+                }
+
+                as.load(rdx, rbx, stack_ptr_offset);
+                store_constant(rdx, 0, type, bits);
+                as.add_imm(rdx, element_size);
+                as.store(rbx, stack_ptr_offset, rdx);
+
+                return true;
+            }
+
+            bool build_load_with_constant(const size_t pc, const int32_t base_offset) {
+                uint8_t type;
+                uint64_t bits;
+
+                if (!get_constant(func.code[pc].operand, type, bits)) {
+                    return false;
+                }
+
+                const size_t slow = add_slow_path(pc);
+                const int32_t disp = slot_disp(func.code[pc].short_operand);
+
+                as.load(rcx, rbx, base_offset);
+                as.cmp_byte(rcx, disp, ir_element::str);
+                as.jcc(above_equal, slow);
+
+                as.load(rdx, rbx, stack_ptr_offset);
+                as.copy_element(rdx, 0, rcx, disp);
+                store_constant(rdx, element_size, type, bits);
+                as.add_imm(rdx, 2 * element_size);
+                as.store(rbx, stack_ptr_offset, rdx);
+
+                return true;
+            }
+
+            void build_load_pair(const size_t pc) {
+                const size_t slow = add_slow_path(pc);
+                const int32_t disp1 = slot_disp(func.code[pc].short_operand);
+                const int32_t disp2 = slot_disp(func.code[pc].operand);
+
+                as.load(rcx, rbx, local_slots_offset);
+                as.cmp_byte(rcx, disp1, ir_element::str);
+                as.jcc(above_equal, slow);
+                as.cmp_byte(rcx, disp2, ir_element::str);
+                as.jcc(above_equal, slow);
+
+                as.load(rdx, rbx, stack_ptr_offset);
+                as.copy_element(rdx, 0, rcx, disp1);
+                as.copy_element(rdx, element_size, rcx, disp2);
+                as.add_imm(rdx, 2 * element_size);
+                as.store(rbx, stack_ptr_offset, rdx);
+            }
+
+            void build_store(const size_t pc, const int32_t base_offset) {
+                const size_t slow = add_slow_path(pc);
+                const int32_t disp = slot_disp(func.code[pc].short_operand);
+
+                // The old value must not need releasing, the new one is moved like the handler does
+                as.load(rcx, rbx, base_offset);
+                as.cmp_byte(rcx, disp, ir_element::str);
+                as.jcc(above_equal, slow);
+
+                as.load(rdx, rbx, stack_ptr_offset);
+                as.add_imm(rdx, -element_size);
+                as.copy_element(rcx, disp, rdx, 0);
+                as.store_byte(rdx, 0, ir_element::none);
+                as.store(rbx, stack_ptr_offset, rdx);
+            }
+
+            void build_pop(const size_t pc) {
+                const size_t slow = add_slow_path(pc);
+
+                as.load(rdx, rbx, stack_ptr_offset);
+                as.cmp_byte(rdx, -element_size, ir_element::str);
+                as.jcc(above_equal, slow);
+
+                pop_numbers(1);
+            }
+
+            void build_arithmetic(const size_t pc, const x64_sd_op op) {
+                const size_t slow = add_slow_path(pc);
+
+                // Division always gives a double, integers take the handler
+                if (op == divsd) {
+                    as.load(rdx, rbx, stack_ptr_offset);
+                    check_types(ir_element::num, slow);
+
+                    as.load_sd(0, rdx, -2 * element_size + payload_offset);
+                    as.op_sd(op, 0, rdx, -element_size + payload_offset);
+                    as.store_sd(rdx, -2 * element_size + payload_offset, 0);
+
+                    pop_numbers(1);
+                    return;
+                }
+
+                const size_t done_int = as.new_label();
+                const size_t done = as.new_label();
+
+                // The left hand side keeps its tag
+                build_top_operation(op, slow, done_int);
+                as.store_sd(rdx, -2 * element_size + payload_offset, 0);
+                as.jmp(done);
+
+                as.bind(done_int);
+                as.store(rdx, -2 * element_size + payload_offset, rax);
+
+                as.bind(done);
+                pop_numbers(1);
+            }
+
+            void build_add_store(const size_t pc) {
+                const size_t slow = add_slow_path(pc);
+                const int32_t disp = slot_disp(func.code[pc].short_operand);
+
+                const size_t done_int = as.new_label();
+                const size_t done = as.new_label();
+
+                as.load(rcx, rbx, local_slots_offset);
+                as.cmp_byte(rcx, disp, ir_element::str);
+                as.jcc(above_equal, slow);
+
+                build_top_operation(addsd, slow, done_int);
+                as.store_byte(rcx, disp, ir_element::num);
+                as.store_sd(rcx, disp + payload_offset, 0);
+                as.jmp(done);
+
+                as.bind(done_int);
+                as.store_byte(rcx, disp, ir_element::integer);
+                as.store(rcx, disp + payload_offset, rax);
+
+                as.bind(done);
+                pop_numbers(2);
+            }
+
+            bool build_increment(const size_t pc) {
+                uint8_t type;
+                uint64_t bits;
+
+                if (!get_constant(func.code[pc].operand, type, bits) || (type != ir_element::num && type != ir_element::integer)) {
+                    return false;
+                }
+
+                const size_t slow = add_slow_path(pc);
+                const int32_t disp = slot_disp(func.code[pc].short_operand);
+
+                // Same kinds only, anything else changes the local's tag
+                as.load(rcx, rbx, local_slots_offset);
+                as.cmp_byte(rcx, disp, type);
+                as.jcc(not_equal, slow);
+
+                if (type == ir_element::integer) {
+                    as.load(rdx, rcx, disp + payload_offset);
+                    as.mov_imm(rax, bits);
+                    as.int_op(int_add, rax, rdx);
+                    as.store(rcx, disp + payload_offset, rax);
+
+                    return true;
+                }
+
+                as.load_sd(0, rcx, disp + payload_offset);
+                as.mov_imm(rax, bits);
+                as.move_to_sd(1, rax);
+                as.op_sd(addsd, 0, 1);
+                as.store_sd(rcx, disp + payload_offset, 0);
+
+                return true;
+            }
+
+            void build_compare_branch(const size_t pc) {
+                const ir::opcode op = get_op(func.code[pc]);
+                const size_t target = label_of(func.code[pc].operand);
+                const size_t next = label_of(pc + 1);
+                const size_t slow = add_slow_path(pc);
+                const size_t not_integers = as.new_label();
+
+                as.load(rdx, rbx, stack_ptr_offset);
+                check_types(ir_element::integer, not_integers);
+
+                // rax is the left hand side, rcx the right hand side, which was on top
+                as.load(rax, rdx, -2 * element_size + payload_offset);
+                as.load(rcx, rdx, -element_size + payload_offset);
+
+                pop_numbers(2);
+
+                as.int_op(int_cmp, rax, rcx);
+                as.jcc(get_int_cond(op), target);
+                as.jmp(next);
+
+                as.bind(not_integers);
+                check_types(ir_element::num, slow);
+
+                // xmm0 is the left hand side, xmm1 the right hand side, which was on top
+                as.load_sd(0, rdx, -2 * element_size + payload_offset);
+                as.load_sd(1, rdx, -element_size + payload_offset);
+
+                pop_numbers(2);
+
+                // ucomisd sets CF on below or unordered, so NaN never satisfies a comparison
+                switch (op) {
+                case ir::opcode::blt:
+                    as.ucomisd(1, 0);
+                    as.jcc(above, target);
+                    break;
+
+                case ir::opcode::ble:
+                    as.ucomisd(1, 0);
+                    as.jcc(above_equal, target);
+                    break;
+
+                case ir::opcode::bgt:
+                    as.ucomisd(0, 1);
+                    as.jcc(above, target);
+                    break;
+
+                case ir::opcode::bge:
+                    as.ucomisd(0, 1);
+                    as.jcc(above_equal, target);
+                    break;
+
+                case ir::opcode::beq:
+                    as.ucomisd(0, 1);
+                    as.jcc(parity, next);
+                    as.jcc(equal, target);
+                    break;
+
+                case ir::opcode::bnlt:
+                    as.ucomisd(1, 0);
+                    as.jcc(below_equal, target);
+                    break;
+
+                case ir::opcode::bnle:
+                    as.ucomisd(1, 0);
+                    as.jcc(below, target);
+                    break;
+
+                case ir::opcode::bngt:
+                    as.ucomisd(0, 1);
+                    as.jcc(below_equal, target);
+                    break;
+
+                case ir::opcode::bnge:
+                    as.ucomisd(0, 1);
+                    as.jcc(below, target);
+                    break;
+
+                case ir::opcode::bneq:
+                    as.ucomisd(0, 1);
+                    as.jcc(not_equal, target);
+                    as.jcc(parity, target);
+                    break;
+
+                default:
+                    break;
+                }
+            }
+
+            void build_test_branch(const size_t pc) {
+                const bool on_true = (get_op(func.code[pc]) == ir::opcode::brt);
+                const size_t target = label_of(func.code[pc].operand);
+                const size_t slow = add_slow_path(pc);
+                const size_t not_integer = as.new_label();
+
+                // Only a number can be true or false, the handler pops anything else
+                as.load(rdx, rbx, stack_ptr_offset);
+                as.cmp_byte(rdx, -element_size, ir_element::integer);
+                as.jcc(not_equal, not_integer);
+
+                as.load(rax, rdx, -element_size + payload_offset);
+                pop_numbers(1);
+
+                as.test(rax);
+                as.jcc(on_true ? not_equal : equal, target);
+                as.jmp(label_of(pc + 1));
+
+                as.bind(not_integer);
+                as.cmp_byte(rdx, -element_size, ir_element::num);
+                as.jcc(not_equal, slow);
+
+                as.load_sd(0, rdx, -element_size + payload_offset);
+                pop_numbers(1);
+
+                as.zero_sd(1);
+                as.ucomisd(0, 1);
+
+                // NaN is true
+                if (on_true) {
+                    as.jcc(parity, target);
+                    as.jcc(not_equal, target);
+                } else {
+                    as.jcc(parity, label_of(pc + 1));
+                    as.jcc(equal, target);
+                }
+            }
+
+            bool build_instruction(const size_t pc) {
+                const ir_instruction &inst = func.code[pc];
+
+                if (ir_jit::is_exit_op(get_op(inst), isolate_heap_writes)) {
+                    exit_at(pc);
+                    return true;
+                }
+
+                // Only exits may end a function
+                if (pc + 1 >= func.end) {
+                    return false;
+                }
+
+                if (is_branch_op(get_op(inst)) && (inst.operand < func.entry || inst.operand >= func.end)) {
+                    return false;
+                }
+
+                bool inlined = true;
+
+                switch (get_op(inst)) {
+                case ir::opcode::nop:
+                case ir::opcode::upn:
+                case ir::opcode::met:
+                    break;
+
+                case ir::opcode::ldcst:
+                case ir::opcode::ldcststr:
+                    inlined = build_load_constant(pc);
+                    break;
+
+                case ir::opcode::ldlc:
+                    build_load(pc, local_slots_offset);
+                    break;
+
+                case ir::opcode::ldarg:
+                    build_load(pc, local_args_offset);
+                    break;
+
+                case ir::opcode::ldlc2:
+                    build_load_pair(pc);
+                    break;
+
+                case ir::opcode::ldlccst:
+                    inlined = build_load_with_constant(pc, local_slots_offset);
+                    break;
+
+                case ir::opcode::ldargcst:
+                    inlined = build_load_with_constant(pc, local_args_offset);
+                    break;
+
+                case ir::opcode::strlc:
+                    build_store(pc, local_slots_offset);
+                    break;
+
+                case ir::opcode::strarg:
+                    build_store(pc, local_args_offset);
+                    break;
+
+                case ir::opcode::pop:
+                    build_pop(pc);
+                    break;
+
+                case ir::opcode::add:
+                    build_arithmetic(pc, addsd);
+                    break;
+
+                case ir::opcode::sub:
+                    build_arithmetic(pc, subsd);
+                    break;
+
+                case ir::opcode::mul:
+                    build_arithmetic(pc, mulsd);
+                    break;
+
+                case ir::opcode::div:
+                    build_arithmetic(pc, divsd);
+                    break;
+
+                case ir::opcode::addstlc:
+                    build_add_store(pc);
+                    break;
+
+                case ir::opcode::inclc:
+                    inlined = build_increment(pc);
+                    break;
+
+                case ir::opcode::br:
+                    // With tracing, back edges go through the handler, which may run a whole trace
+                    // and come back anywhere
+                    if (trace_loops && inst.operand <= pc) {
+                        emit_handler_call(pc);
+                        as.jmp(exit_label);
+                    } else {
+                        as.jmp(label_of(inst.operand));
+                    }
+
+                    break;
+
+                case ir::opcode::brf:
+                case ir::opcode::brt:
+                    build_test_branch(pc);
+                    break;
+
+                case ir::opcode::blt:
+                case ir::opcode::ble:
+                case ir::opcode::bgt:
+                case ir::opcode::bge:
+                case ir::opcode::beq:
+                case ir::opcode::bnlt:
+                case ir::opcode::bnle:
+                case ir::opcode::bngt:
+                case ir::opcode::bnge:
+                case ir::opcode::bneq:
+                    build_compare_branch(pc);
+                    break;
+
+                default:
+                    inlined = false;
+                    break;
+                }
+
+                if (!inlined) {
+                    emit_handler_call(pc);
+                }
+
+                return true;
+            }
+
+        public:
+            explicit x64_function_builder(const ir_function_entry &func, helper_getter get_helper, const ir_jit_mode mode)
+                : func(func)
+                , get_helper(get_helper)
+                , isolate_heap_writes(mode == ir_jit_mode::differential)
+                , trace_loops(mode == ir_jit_mode::tracing) {
+                loop_costs.resize(func.end - func.entry);
+
+                for (size_t pc = func.entry; pc < func.end; pc++) {
+                    inst_labels.push_back(as.new_label());
+
+                    const uint32_t target = func.code[pc].operand;
+
+                    if (is_branch_op(get_op(func.code[pc])) && target >= func.entry && target <= pc) {
+                        uint32_t &cost = loop_costs[target - func.entry];
+                        cost = std::max(cost, static_cast<uint32_t>(pc - target + 1));
+                    }
+                }
+
+                exit_label = as.new_label();
+                table_label = as.new_label();
+            }
+
+            bool build() {
+                // push rbx / push r12 / sub rsp, 8, keeping calls 16 bytes aligned
+                as.emit({ 0x53, 0x41, 0x54, 0x48, 0x83, 0xEC, 0x08 });
+
+                // mov rbx, rsi / mov r12, rdi
+                as.emit({ 0x48, 0x89, 0xF3, 0x49, 0x89, 0xFC });
+
+                // Start at the frame pc, through a table of 32 bits offsets
+                as.load(rax, rbx, pc_offset);
+                as.sub_imm(rax, static_cast<int32_t>(func.entry));
+                as.lea_label(rcx, table_label);
+
+                // movsxd rax, [rcx + rax * 4] / add rax, rcx / jmp rax
+                as.emit({ 0x48, 0x63, 0x04, 0x81, 0x48, 0x01, 0xC8, 0xFF, 0xE0 });
+
+                for (size_t pc = func.entry; pc < func.end; pc++) {
+                    as.bind(label_of(pc));
+
+                    // Differential runs check native stretches against the interpreter, which only
+                    // stops between them, so they can't stop halfway for the budget
+                    if (loop_costs[pc - func.entry] && !isolate_heap_writes) {
+                        charge_budget(pc);
+                    }
+
+                    if (!build_instruction(pc)) {
+                        return false;
+                    }
+                }
+
+                for (const auto &path : slow_paths) {
+                    as.bind(path.label);
+                    emit_handler_call(path.pc);
+                    as.jmp(label_of(path.pc + 1));
+                }
+
+                for (const auto &path : budget_exits) {
+                    as.bind(path.label);
+                    exit_at(path.pc);
+                }
+
+                // add rsp, 8 / pop r12 / pop rbx / ret
+                as.bind(exit_label);
+                as.emit({ 0x48, 0x83, 0xC4, 0x08, 0x41, 0x5C, 0x5B, 0xC3 });
+
+                as.align(4);
+                as.bind(table_label);
+
+                for (const size_t label : inst_labels) {
+                    as.data32(static_cast<int32_t>(as.get_label_pos(label) - as.get_label_pos(table_label)));
+                }
+
+                return as.resolve();
+            }
+
+            const std::vector<uint8_t> &get_code() const {
+                return as.get_code();
+            }
+        };
+
+        ir_jit_code make_executable(const std::vector<uint8_t> &code, std::vector<ir_native_block> &blocks) {
+            void *mem = mmap(nullptr, code.size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+            if (mem == MAP_FAILED) {
+                return nullptr;
+            }
+
+            std::memcpy(mem, code.data(), code.size());
+
+            // Never writable and executable at once
+            if (mprotect(mem, code.size(), PROT_READ | PROT_EXEC) != 0) {
+                munmap(mem, code.size());
+                return nullptr;
+            }
+
+            blocks.push_back(ir_native_block{ mem, code.size() });
+
+            return reinterpret_cast<ir_jit_code>(mem);
+        }
+
+        constexpr size_t max_trace_length = 512;
+
+        // Trace registers: xmm0 to xmm5 hold the evaluation stack, xmm6 is scratch, xmm8 to xmm13
+        // hold the locals and arguments the loop uses. Integers use general registers at the same
+        // positions instead, there are only four of them for the stack. r13 and r14 are the data
+        // of up to two arrays, their lengths are kept on the native stack.
+        constexpr size_t trace_stack_regs = 6;
+        constexpr uint8_t trace_scratch_reg = 6;
+        constexpr uint8_t trace_first_var_reg = 8;
+        constexpr size_t trace_max_vars = 6;
+        constexpr size_t trace_max_arrays = 2;
+
+        constexpr x64_reg trace_int_stack_regs[] = { rdx, r12, r15, rbp };
+        constexpr x64_reg trace_int_var_regs[] = { rsi, rdi, r8, r9, r10, r11 };
+
+        struct trace_step {
+            size_t pc;
+
+            // For branches, if the recorded iteration took it
+            bool taken;
+
+            // For ldelmlc, the tag of the element the recorded iteration read and how its array was stored
+            uint8_t kind;
+            ir_array_storage storage;
+        };
+
+        ir_array *get_traced_array(ir_interpreter_ref_manager *ref_manager, const uint64_t id) {
+            // The manager keeps it alive
+            return ref_manager->find_array(id);
+        }
+
+        // Returned in rax:rdx
+        struct trace_array_view {
+            const void *data;
+            size_t length;
+        };
+
+        // Null unless the array is stored the way it was when recording, traces don't write arrays so it stays that way
+        trace_array_view get_array_view(ir_interpreter *interpreter, const uint64_t id, const uint64_t storage) {
+            ir_array *arr = get_traced_array(interpreter->get_ref_manager(), id);
+
+            if (!arr || !arr->get_array_length() || arr->get_storage() != static_cast<ir_array_storage>(storage)) {
+                return trace_array_view{ nullptr, 0 };
+            }
+
+            switch (arr->get_storage()) {
+            case ir_array_storage::integers:
+                return trace_array_view{ arr->get_integers(), arr->get_array_length() };
+
+            case ir_array_storage::numbers:
+                return trace_array_view{ arr->get_numbers(), arr->get_array_length() };
+
+            default:
+                return trace_array_view{ arr->get_elements(), arr->get_array_length() };
+            }
+        }
+
+        // Everything a trace reads from the frame must be a number, the stack then only ever holds numbers
+        bool can_trace(ir_interpreter_ref_manager *ref_manager, const ir_interpreter_func_context &context,
+            const ir_instruction &inst) {
+            const auto is_num = [](const ir_element &el) {
+                return el.is_number();
+            };
+
+            const ir_element *constants = context.constants;
+
+            switch (get_op(inst)) {
+            case ir::opcode::nop:
+            case ir::opcode::upn:
+            case ir::opcode::met:
+            case ir::opcode::pop:
+            case ir::opcode::add:
+            case ir::opcode::sub:
+            case ir::opcode::mul:
+            case ir::opcode::div:
+            case ir::opcode::ceq:
+            case ir::opcode::clt:
+            case ir::opcode::cle:
+            case ir::opcode::cgt:
+            case ir::opcode::cge:
+            case ir::opcode::ung:
+                return true;
+
+            case ir::opcode::ldcst:
+            case ir::opcode::ldcststr:
+                return is_num(constants[inst.operand]);
+
+            case ir::opcode::ldlc:
+            case ir::opcode::strlc:
+            case ir::opcode::addstlc:
+                return is_num(context.local_slots[inst.short_operand]);
+
+            case ir::opcode::ldarg:
+            case ir::opcode::strarg:
+                return is_num(context.local_args[inst.short_operand]);
+
+            case ir::opcode::ldlc2:
+                return is_num(context.local_slots[inst.short_operand]) && is_num(context.local_slots[inst.operand]);
+
+            case ir::opcode::ldlccst:
+            case ir::opcode::inclc:
+                return is_num(context.local_slots[inst.short_operand]) && is_num(constants[inst.operand]);
+
+            case ir::opcode::ldargcst:
+                return is_num(context.local_args[inst.short_operand]) && is_num(constants[inst.operand]);
+
+            case ir::opcode::ldelmlc: {
+                const ir_element &arr_ref = context.local_slots[inst.short_operand];
+                const ir_element &index = context.local_slots[inst.operand];
+
+                ir_array *arr = (arr_ref.type == ir_element::ref) ? get_traced_array(ref_manager, arr_ref.ref_id) : nullptr;
+
+                if (!arr || !is_num(index) || index.get_number() < 0 || index.get_number() >= arr->get_array_length()) {
+                    return false;
+                }
+
+                return is_num(arr->get_element(static_cast<size_t>(index.get_integer())));
+            }
+
+            default:
+                return is_branch_op(get_op(inst));
+            }
+        }
+
+        /*! \brief Native code of a recorded loop iteration.
+         *
+         * The evaluation stack lives in registers, its depth and the tag of every value in it are
+         * known at every instruction. Locals are loaded once, checked to have the tag they had when
+         * recording, and written back on the way out.
+         */
+        class x64_trace_builder {
+            x64_assembler as;
+
+            const ir_interpreter_func_context &context;
+            const size_t header;
+            const std::vector<trace_step> &steps;
+
+            // Frame slots, by offset from the first argument
+            std::vector<size_t> vars;
+            std::vector<bool> var_written;
+            std::vector<size_t> arrays;
+            std::vector<ir_array_storage> array_storages;
+
+            // Tags of the locals on entry, and at the current step. The loop must close on the tags it started with.
+            std::vector<uint8_t> entry_kinds;
+            std::vector<uint8_t> var_kinds;
+
+            // Tags of the evaluation stack registers
+            std::vector<uint8_t> stack_kinds;
+
+            struct side_exit {
+                size_t label;
+                size_t pc;
+                std::vector<uint8_t> var_kinds;
+                std::vector<uint8_t> stack_kinds;
+            };
+
+            std::vector<side_exit> side_exits;
+
+            size_t entry_exit_label;
+            size_t epilogue_label;
+            size_t loop_label;
+
+            // ucomisd outcome a branch is taken on, equal and not_equal account for NaN
+            enum class trace_cond {
+                above,
+                above_equal,
+                below_equal,
+                below,
+                equal,
+                not_equal
+            };
+
+            static trace_cond negate(const trace_cond cond) {
+                switch (cond) {
+                case trace_cond::above:
+                    return trace_cond::below_equal;
+
+                case trace_cond::above_equal:
+                    return trace_cond::below;
+
+                case trace_cond::below_equal:
+                    return trace_cond::above;
+
+                case trace_cond::below:
+                    return trace_cond::above_equal;
+
+                case trace_cond::equal:
+                    return trace_cond::not_equal;
+
+                default:
+                    return trace_cond::equal;
+                }
+            }
+
+            static int find(const std::vector<size_t> &list, const size_t offset) {
+                const auto it = std::find(list.begin(), list.end(), offset);
+                return (it == list.end()) ? -1 : static_cast<int>(it - list.begin());
+            }
+
+            size_t local_offset(const size_t slot) const {
+                return static_cast<size_t>(context.local_slots - context.local_args) + slot;
+            }
+
+            bool use_var(const size_t offset, const bool write) {
+                if (find(arrays, offset) >= 0) {
+                    return false;
+                }
+
+                int idx = find(vars, offset);
+
+                if (idx < 0) {
+                    if (vars.size() == trace_max_vars) {
+                        return false;
+                    }
+
+                    vars.push_back(offset);
+                    var_written.push_back(false);
+                    idx = static_cast<int>(vars.size() - 1);
+                }
+
+                if (write) {
+                    var_written[idx] = true;
+                }
+
+                return true;
+            }
+
+            bool use_array(const size_t offset, const ir_array_storage storage) {
+                if (find(vars, offset) >= 0) {
+                    return false;
+                }
+
+                const int idx = find(arrays, offset);
+
+                if (idx >= 0) {
+                    return array_storages[idx] == storage;
+                }
+
+                if (arrays.size() == trace_max_arrays) {
+                    return false;
+                }
+
+                arrays.push_back(offset);
+                array_storages.push_back(storage);
+
+                return true;
+            }
+
+            bool collect_slots() {
+                for (const auto &step : steps) {
+                    const ir_instruction &inst = context.code[step.pc];
+                    bool ok = true;
+
+                    switch (get_op(inst)) {
+                    case ir::opcode::ldlc:
+                    case ir::opcode::ldlccst:
+                        ok = use_var(local_offset(inst.short_operand), false);
+                        break;
+
+                    case ir::opcode::strlc:
+                    case ir::opcode::inclc:
+                    case ir::opcode::addstlc:
+                        ok = use_var(local_offset(inst.short_operand), true);
+                        break;
+
+                    case ir::opcode::ldarg:
+                    case ir::opcode::ldargcst:
+                        ok = use_var(inst.short_operand, false);
+                        break;
+
+                    case ir::opcode::strarg:
+                        ok = use_var(inst.short_operand, true);
+                        break;
+
+                    case ir::opcode::ldlc2:
+                        ok = use_var(local_offset(inst.short_operand), false) && use_var(local_offset(inst.operand), false);
+                        break;
+
+                    case ir::opcode::ldelmlc:
+                        ok = use_array(local_offset(inst.short_operand), step.storage) && use_var(local_offset(inst.operand), false);
+                        break;
+
+                    default:
+                        break;
+                    }
+
+                    if (!ok) {
+                        return false;
+                    }
+                }
+
+                // The recorded iteration just ended, the frame holds what the next one starts with
+                for (const size_t offset : vars) {
+                    const ir_element &el = context.local_args[offset];
+
+                    if (!el.is_number()) {
+                        return false;
+                    }
+
+                    entry_kinds.push_back(el.type);
+                }
+
+                var_kinds = entry_kinds;
+                return true;
+            }
+
+            uint8_t var_reg(const size_t offset) const {
+                return static_cast<uint8_t>(trace_first_var_reg + find(vars, offset));
+            }
+
+            uint8_t &var_kind(const size_t offset) {
+                return var_kinds[find(vars, offset)];
+            }
+
+            x64_reg var_int_reg(const size_t offset) const {
+                return trace_int_var_regs[find(vars, offset)];
+            }
+
+            static x64_reg stack_int_reg(const uint8_t reg) {
+                return trace_int_stack_regs[reg];
+            }
+
+            static int32_t slot_disp(const size_t offset) {
+                return static_cast<int32_t>(offset * element_size);
+            }
+
+            size_t add_side_exit(const size_t pc) {
+                const size_t label = as.new_label();
+                side_exits.push_back(side_exit{ label, pc, var_kinds, stack_kinds });
+
+                return label;
+            }
+
+            bool push(uint8_t &reg, const uint8_t kind) {
+                const size_t limit = (kind == ir_element::integer) ? std::size(trace_int_stack_regs) : trace_stack_regs;
+
+                if (stack_kinds.size() >= limit) {
+                    return false;
+                }
+
+                reg = static_cast<uint8_t>(stack_kinds.size());
+                stack_kinds.push_back(kind);
+
+                return true;
+            }
+
+            bool pop(uint8_t &reg, uint8_t &kind) {
+                if (stack_kinds.empty()) {
+                    return false;
+                }
+
+                kind = stack_kinds.back();
+                stack_kinds.pop_back();
+                reg = static_cast<uint8_t>(stack_kinds.size());
+
+                return true;
+            }
+
+            bool push_constant(const uint32_t idx) {
+                const ir_element &cst = context.constants[idx];
+                uint8_t reg;
+
+                if (!push(reg, cst.type)) {
+                    return false;
+                }
+
+                if (cst.type == ir_element::integer) {
+                    as.mov_imm(stack_int_reg(reg), static_cast<uint64_t>(cst.int_data));
+                    return true;
+                }
+
+                uint64_t bits;
+                std::memcpy(&bits, &cst.num_data, sizeof(bits));
+
+                as.mov_imm(rax, bits);
+                as.move_to_sd(reg, rax);
+
+                return true;
+            }
+
+            bool push_var(const size_t offset) {
+                uint8_t reg;
+
+                if (!push(reg, var_kind(offset))) {
+                    return false;
+                }
+
+                if (var_kind(offset) == ir_element::integer) {
+                    as.move(stack_int_reg(reg), var_int_reg(offset));
+                } else {
+                    as.move_sd(reg, var_reg(offset));
+                }
+
+                return true;
+            }
+
+            bool store_var(const size_t offset) {
+                uint8_t reg;
+                uint8_t kind;
+
+                if (!pop(reg, kind)) {
+                    return false;
+                }
+
+                move_to_var(offset, reg, kind);
+                return true;
+            }
+
+            void move_to_var(const size_t offset, const uint8_t reg, const uint8_t kind) {
+                if (kind == ir_element::integer) {
+                    as.move(var_int_reg(offset), stack_int_reg(reg));
+                } else {
+                    as.move_sd(var_reg(offset), reg);
+                }
+
+                var_kind(offset) = kind;
+            }
+
+            // An integer on the stack to a double, in place
+            void to_double(const uint8_t reg) {
+                as.convert_to_sd(reg, stack_int_reg(reg));
+            }
+
+            // lhs = lhs op rhs, with the interpreter's rules, giving the tag of the result
+            uint8_t build_operation(const x64_sd_op op, const uint8_t lhs, const uint8_t lhs_kind, const uint8_t rhs,
+                const uint8_t rhs_kind) {
+                if (op != divsd && lhs_kind == ir_element::integer && rhs_kind == ir_element::integer) {
+                    as.int_op(get_int_op(op), stack_int_reg(lhs), stack_int_reg(rhs));
+                    return ir_element::integer;
+                }
+
+                if (lhs_kind == ir_element::integer) {
+                    to_double(lhs);
+                }
+
+                if (rhs_kind == ir_element::integer) {
+                    to_double(rhs);
+                }
+
+                as.op_sd(op, lhs, rhs);
+                return ir_element::num;
+            }
+
+            void jump_if(const trace_cond cond, const size_t label) {
+                switch (cond) {
+                case trace_cond::above:
+                    as.jcc(above, label);
+                    break;
+
+                case trace_cond::above_equal:
+                    as.jcc(above_equal, label);
+                    break;
+
+                case trace_cond::below_equal:
+                    as.jcc(below_equal, label);
+                    break;
+
+                case trace_cond::below:
+                    as.jcc(below, label);
+                    break;
+
+                case trace_cond::equal: {
+                    const size_t unordered = as.new_label();
+
+                    as.jcc(parity, unordered);
+                    as.jcc(equal, label);
+                    as.bind(unordered);
+
+                    break;
+                }
+
+                case trace_cond::not_equal:
+                    as.jcc(not_equal, label);
+                    as.jcc(parity, label);
+                    break;
+                }
+            }
+
+            bool build_arithmetic(const x64_sd_op op) {
+                uint8_t rhs;
+                uint8_t lhs;
+                uint8_t rhs_kind;
+                uint8_t lhs_kind;
+
+                if (!pop(rhs, rhs_kind) || !pop(lhs, lhs_kind)) {
+                    return false;
+                }
+
+                return push(lhs, build_operation(op, lhs, lhs_kind, rhs, rhs_kind));
+            }
+
+            bool build_compare(const ir::opcode op) {
+                uint8_t rhs;
+                uint8_t lhs;
+                uint8_t rhs_kind;
+                uint8_t lhs_kind;
+
+                if (!pop(rhs, rhs_kind) || !pop(lhs, lhs_kind)) {
+                    return false;
+                }
+
+                if (lhs_kind == ir_element::integer && rhs_kind == ir_element::integer) {
+                    // setcc al
+                    as.int_op(int_cmp, stack_int_reg(lhs), stack_int_reg(rhs));
+                    as.emit({ 0x0F, static_cast<uint8_t>(0x90 | get_int_cond(op)), 0xC0 });
+                } else {
+                    if (lhs_kind == ir_element::integer) {
+                        to_double(lhs);
+                    }
+
+                    if (rhs_kind == ir_element::integer) {
+                        to_double(rhs);
+                    }
+
+                    switch (op) {
+                    case ir::opcode::clt:
+                        // seta al
+                        as.ucomisd(rhs, lhs);
+                        as.emit({ 0x0F, 0x97, 0xC0 });
+                        break;
+
+                    case ir::opcode::cle:
+                        // setae al
+                        as.ucomisd(rhs, lhs);
+                        as.emit({ 0x0F, 0x93, 0xC0 });
+                        break;
+
+                    case ir::opcode::cgt:
+                        as.ucomisd(lhs, rhs);
+                        as.emit({ 0x0F, 0x97, 0xC0 });
+                        break;
+
+                    case ir::opcode::cge:
+                        as.ucomisd(lhs, rhs);
+                        as.emit({ 0x0F, 0x93, 0xC0 });
+                        break;
+
+                    default:
+                        // sete al / setnp cl / and al, cl
+                        as.ucomisd(lhs, rhs);
+                        as.emit({ 0x0F, 0x94, 0xC0, 0x0F, 0x9B, 0xC1, 0x20, 0xC8 });
+                        break;
+                    }
+                }
+
+                // Comparisons give integers: movzx eax, al
+                as.emit({ 0x0F, 0xB6, 0xC0 });
+                as.move(stack_int_reg(lhs), rax);
+
+                return push(lhs, ir_element::integer);
+            }
+
+            bool build_branch(const trace_step &step) {
+                const ir_instruction &inst = context.code[step.pc];
+                const bool test = (get_op(inst) == ir::opcode::brt || get_op(inst) == ir::opcode::brf);
+
+                uint8_t lhs;
+                uint8_t rhs;
+                uint8_t lhs_kind;
+                uint8_t rhs_kind = ir_element::integer;
+
+                if (test) {
+                    if (!pop(lhs, lhs_kind)) {
+                        return false;
+                    }
+                } else if (!pop(rhs, rhs_kind) || !pop(lhs, lhs_kind)) {
+                    return false;
+                }
+
+                // Leave where the recorded iteration did not go
+                const size_t exit = add_side_exit(step.taken ? step.pc + 1 : inst.operand);
+
+                if (lhs_kind == ir_element::integer && rhs_kind == ir_element::integer) {
+                    if (test) {
+                        as.test(stack_int_reg(lhs));
+                    } else {
+                        as.int_op(int_cmp, stack_int_reg(lhs), stack_int_reg(rhs));
+                    }
+
+                    const x64_cond cond = get_int_cond(get_op(inst));
+                    as.jcc(step.taken ? invert(cond) : cond, exit);
+
+                    return true;
+                }
+
+                if (test) {
+                    rhs = trace_scratch_reg;
+                    as.zero_sd(rhs);
+                } else if (rhs_kind == ir_element::integer) {
+                    to_double(rhs);
+                }
+
+                if (lhs_kind == ir_element::integer) {
+                    to_double(lhs);
+                }
+
+                // Taken when ucomisd(a, b) gives cond
+                uint8_t a = lhs;
+                uint8_t b = rhs;
+                trace_cond cond;
+
+                switch (get_op(inst)) {
+                case ir::opcode::blt:
+                    std::swap(a, b);
+                    cond = trace_cond::above;
+                    break;
+
+                case ir::opcode::ble:
+                    std::swap(a, b);
+                    cond = trace_cond::above_equal;
+                    break;
+
+                case ir::opcode::bgt:
+                    cond = trace_cond::above;
+                    break;
+
+                case ir::opcode::bge:
+                    cond = trace_cond::above_equal;
+                    break;
+
+                case ir::opcode::bnlt:
+                    std::swap(a, b);
+                    cond = trace_cond::below_equal;
+                    break;
+
+                case ir::opcode::bnle:
+                    std::swap(a, b);
+                    cond = trace_cond::below;
+                    break;
+
+                case ir::opcode::bngt:
+                    cond = trace_cond::below_equal;
+                    break;
+
+                case ir::opcode::bnge:
+                    cond = trace_cond::below;
+                    break;
+
+                case ir::opcode::beq:
+                case ir::opcode::brf:
+                    cond = trace_cond::equal;
+                    break;
+
+                default:
+                    // bneq, brt: NaN is not equal, and true
+                    cond = trace_cond::not_equal;
+                    break;
+                }
+
+                as.ucomisd(a, b);
+                jump_if(step.taken ? negate(cond) : cond, exit);
+
+                return true;
+            }
+
+            bool build_element_load(const trace_step &step) {
+                const ir_instruction &inst = context.code[step.pc];
+                const int arr = find(arrays, local_offset(inst.short_operand));
+                const size_t index = local_offset(inst.operand);
+
+                if (step.kind != ir_element::num && step.kind != ir_element::integer) {
+                    return false;
+                }
+
+                // Out of range, or not the tag recorded: the interpreter grows the array or handles the value
+                const size_t exit = add_side_exit(step.pc);
+                const bool packed = step.storage != ir_array_storage::generic;
+
+                if (var_kind(index) == ir_element::integer) {
+                    as.move(rax, var_int_reg(index));
+                } else {
+                    as.truncate_sd(rax, var_reg(index));
+                }
+
+                // cmp rax, [rsp + arr * 8], negative indices are above too
+                as.emit({ 0x48, 0x3B, 0x44, 0x24, static_cast<uint8_t>(arr * 8) });
+                as.jcc(above_equal, exit);
+
+                // shl rax, 3 or 4 / add rax, r13 or r14
+                as.emit({ 0x48, 0xC1, 0xE0, static_cast<uint8_t>(packed ? 0x03 : 0x04) });
+                as.emit({ 0x4C, 0x01, static_cast<uint8_t>(arr == 0 ? 0xE8 : 0xF0) });
+
+                // A packed array only has payloads, all of the tag recorded
+                if (!packed) {
+                    as.cmp_byte(rax, 0, step.kind);
+                    as.jcc(not_equal, exit);
+                }
+
+                const int32_t disp = packed ? 0 : payload_offset;
+                uint8_t reg;
+
+                if (!push(reg, step.kind)) {
+                    return false;
+                }
+
+                if (step.kind == ir_element::integer) {
+                    as.load(stack_int_reg(reg), rax, disp);
+                } else {
+                    as.load_sd(reg, rax, disp);
+                }
+
+                return true;
+            }
+
+            bool build_increment(const ir_instruction &inst) {
+                const size_t offset = local_offset(inst.short_operand);
+                const ir_element &cst = context.constants[inst.operand];
+                const uint8_t reg = var_reg(offset);
+
+                if (var_kind(offset) == ir_element::integer && cst.type == ir_element::integer) {
+                    as.mov_imm(rcx, static_cast<uint64_t>(cst.int_data));
+                    as.int_op(int_add, var_int_reg(offset), rcx);
+
+                    return true;
+                }
+
+                if (var_kind(offset) == ir_element::integer) {
+                    as.convert_to_sd(reg, var_int_reg(offset));
+                    var_kind(offset) = ir_element::num;
+                }
+
+                const double val = cst.get_number();
+
+                uint64_t bits;
+                std::memcpy(&bits, &val, sizeof(bits));
+
+                as.mov_imm(rax, bits);
+                as.move_to_sd(trace_scratch_reg, rax);
+                as.op_sd(addsd, reg, trace_scratch_reg);
+
+                return true;
+            }
+
+            bool build_step(const size_t idx) {
+                const trace_step &step = steps[idx];
+                const ir_instruction &inst = context.code[step.pc];
+
+                switch (get_op(inst)) {
+                case ir::opcode::nop:
+                case ir::opcode::upn:
+                case ir::opcode::met:
+                    return true;
+
+                case ir::opcode::br:
+                    // The last step closes the loop, the others just fall into the recorded path. Every
+                    // iteration is charged to the budget, leaving at the header when nothing is left.
+                    if (idx + 1 == steps.size()) {
+                        const size_t exit = add_side_exit(header);
+
+                        as.load(rax, rbx, budget_offset);
+                        as.sub_mem_imm(rax, 0, static_cast<int32_t>(steps.size()));
+                        as.jcc(less_equal, exit);
+                        as.jmp(loop_label);
+                    }
+
+                    return true;
+
+                case ir::opcode::ldcst:
+                case ir::opcode::ldcststr:
+                    return push_constant(inst.operand);
+
+                case ir::opcode::ldlc:
+                    return push_var(local_offset(inst.short_operand));
+
+                case ir::opcode::ldarg:
+                    return push_var(inst.short_operand);
+
+                case ir::opcode::ldlc2:
+                    return push_var(local_offset(inst.short_operand)) && push_var(local_offset(inst.operand));
+
+                case ir::opcode::ldlccst:
+                    return push_var(local_offset(inst.short_operand)) && push_constant(inst.operand);
+
+                case ir::opcode::ldargcst:
+                    return push_var(inst.short_operand) && push_constant(inst.operand);
+
+                case ir::opcode::strlc:
+                    return store_var(local_offset(inst.short_operand));
+
+                case ir::opcode::strarg:
+                    return store_var(inst.short_operand);
+
+                case ir::opcode::pop: {
+                    uint8_t reg;
+                    uint8_t kind;
+
+                    return pop(reg, kind);
+                }
+
+                case ir::opcode::inclc:
+                    return build_increment(inst);
+
+                case ir::opcode::addstlc: {
+                    const size_t offset = local_offset(inst.short_operand);
+
+                    uint8_t rhs;
+                    uint8_t lhs;
+                    uint8_t rhs_kind;
+                    uint8_t lhs_kind;
+
+                    if (!pop(rhs, rhs_kind) || !pop(lhs, lhs_kind)) {
+                        return false;
+                    }
+
+                    move_to_var(offset, lhs, build_operation(addsd, lhs, lhs_kind, rhs, rhs_kind));
+                    return true;
+                }
+
+                case ir::opcode::add:
+                    return build_arithmetic(addsd);
+
+                case ir::opcode::sub:
+                    return build_arithmetic(subsd);
+
+                case ir::opcode::mul:
+                    return build_arithmetic(mulsd);
+
+                case ir::opcode::div:
+                    return build_arithmetic(divsd);
+
+                case ir::opcode::ceq:
+                case ir::opcode::clt:
+                case ir::opcode::cle:
+                case ir::opcode::cgt:
+                case ir::opcode::cge:
+                    return build_compare(get_op(inst));
+
+                case ir::opcode::ung: {
+                    if (stack_kinds.empty()) {
+                        return false;
+                    }
+
+                    const uint8_t reg = static_cast<uint8_t>(stack_kinds.size() - 1);
+
+                    if (stack_kinds.back() == ir_element::integer) {
+                        as.neg(stack_int_reg(reg));
+                        return true;
+                    }
+
+                    as.mov_imm(rax, 0x8000000000000000ULL);
+                    as.move_to_sd(trace_scratch_reg, rax);
+                    as.xor_sd(reg, trace_scratch_reg);
+
+                    return true;
+                }
+
+                case ir::opcode::ldelmlc:
+                    return build_element_load(step);
+
+                default:
+                    return is_branch_op(get_op(inst)) && build_branch(step);
+                }
+            }
+
+            void build_entry() {
+                // push rbx, rbp, r12, r13, r14, r15 / sub rsp, 24, the array lengths go at rsp
+                as.emit({ 0x53, 0x55, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57, 0x48, 0x83, 0xEC, 0x18 });
+
+                // mov rbx, rsi / mov r12, rdi
+                as.emit({ 0x48, 0x89, 0xF3, 0x49, 0x89, 0xFC });
+
+                // Arrays first, the call clobbers every xmm register
+                for (size_t i = 0; i < arrays.size(); i++) {
+                    const int32_t disp = slot_disp(arrays[i]);
+
+                    as.load(rcx, rbx, local_args_offset);
+                    as.cmp_byte(rcx, disp, ir_element::ref);
+                    as.jcc(not_equal, entry_exit_label);
+
+                    // mov rdi, r12
+                    as.load(rsi, rcx, disp + payload_offset);
+                    as.mov_imm(rdx, static_cast<uint64_t>(array_storages[i]));
+                    as.emit({ 0x4C, 0x89, 0xE7 });
+                    as.call_abs(reinterpret_cast<const void *>(&get_array_view));
+
+                    // test rax, rax
+                    as.test(rax);
+                    as.jcc(equal, entry_exit_label);
+
+                    // mov r13, rax / mov [rsp], rdx, or mov r14, rax / mov [rsp + 8], rdx
+                    if (i == 0) {
+                        as.emit({ 0x49, 0x89, 0xC5, 0x48, 0x89, 0x54, 0x24, 0x00 });
+                    } else {
+                        as.emit({ 0x49, 0x89, 0xC6, 0x48, 0x89, 0x54, 0x24, 0x08 });
+                    }
+                }
+
+                as.load(rcx, rbx, local_args_offset);
+
+                for (size_t i = 0; i < vars.size(); i++) {
+                    as.cmp_byte(rcx, slot_disp(vars[i]), entry_kinds[i]);
+                    as.jcc(not_equal, entry_exit_label);
+
+                    if (entry_kinds[i] == ir_element::integer) {
+                        as.load(trace_int_var_regs[i], rcx, slot_disp(vars[i]) + payload_offset);
+                    } else {
+                        as.load_sd(var_reg(vars[i]), rcx, slot_disp(vars[i]) + payload_offset);
+                    }
+                }
+            }
+
+            void build_side_exit(const side_exit &exit) {
+                as.bind(exit.label);
+                as.load(rcx, rbx, local_args_offset);
+
+                // The trace only stores numbers, so nothing needs releasing
+                for (size_t i = 0; i < vars.size(); i++) {
+                    if (!var_written[i]) {
+                        continue;
+                    }
+
+                    const int32_t disp = slot_disp(vars[i]);
+                    as.store_byte(rcx, disp, exit.var_kinds[i]);
+
+                    if (exit.var_kinds[i] == ir_element::integer) {
+                        as.store(rcx, disp + payload_offset, trace_int_var_regs[i]);
+                    } else {
+                        as.store_sd(rcx, disp + payload_offset, var_reg(vars[i]));
+                    }
+                }
+
+                // rdx may hold a value, the stack pointer goes in rax
+                if (!exit.stack_kinds.empty()) {
+                    as.load(rax, rbx, stack_ptr_offset);
+
+                    for (size_t i = 0; i < exit.stack_kinds.size(); i++) {
+                        const int32_t disp = static_cast<int32_t>(i * element_size);
+                        const uint8_t reg = static_cast<uint8_t>(i);
+
+                        as.store_byte(rax, disp, exit.stack_kinds[i]);
+
+                        if (exit.stack_kinds[i] == ir_element::integer) {
+                            as.store(rax, disp + payload_offset, stack_int_reg(reg));
+                        } else {
+                            as.store_sd(rax, disp + payload_offset, reg);
+                        }
+                    }
+
+                    as.add_imm(rax, static_cast<int8_t>(exit.stack_kinds.size() * element_size));
+                    as.store(rbx, stack_ptr_offset, rax);
+                }
+
+                as.store_imm(rbx, pc_offset, static_cast<int32_t>(exit.pc));
+                as.jmp(epilogue_label);
+            }
+
+        public:
+            explicit x64_trace_builder(const ir_interpreter_func_context &context, const size_t header,
+                const std::vector<trace_step> &steps)
+                : context(context)
+                , header(header)
+                , steps(steps) {
+                entry_exit_label = as.new_label();
+                epilogue_label = as.new_label();
+                loop_label = as.new_label();
+            }
+
+            bool build() {
+                if (steps.empty() || !collect_slots()) {
+                    return false;
+                }
+
+                build_entry();
+                as.bind(loop_label);
+
+                for (size_t i = 0; i < steps.size(); i++) {
+                    if (!build_step(i)) {
+                        return false;
+                    }
+                }
+
+                // The loop closes on an empty stack and the tags it started with
+                if (!stack_kinds.empty() || var_kinds != entry_kinds) {
+                    return false;
+                }
+
+                for (const auto &exit : side_exits) {
+                    build_side_exit(exit);
+                }
+
+                // Nothing changed yet, the interpreter goes on from the header
+                as.bind(entry_exit_label);
+                as.store_imm(rbx, pc_offset, static_cast<int32_t>(header));
+
+                // add rsp, 24 / pop r15, r14, r13, r12, rbp, rbx / ret
+                as.bind(epilogue_label);
+                as.emit({ 0x48, 0x83, 0xC4, 0x18, 0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5D, 0x5B, 0xC3 });
+
+                return as.resolve();
+            }
+
+            const std::vector<uint8_t> &get_code() const {
+                return as.get_code();
+            }
+        };
+    }
+
+    bool ir_jit::compile(ir_interpreter &interpreter, ir_function_entry &func, const ir_jit_mode mode) {
+        if (func.native_code) {
+            return true;
+        }
+
+        // Instruction indices are 32 bits immediates in the templates
+        if (func.entry >= func.end || func.end > static_cast<size_t>(std::numeric_limits<int32_t>::max())) {
+            return false;
+        }
+
+        x64_function_builder builder(func, &ir_jit::get_helper, mode);
+
+        if (!builder.build()) {
+            return false;
+        }
+
+        func.native_code = make_executable(builder.get_code(), interpreter.native_blocks);
+
+        return func.native_code != nullptr;
+    }
+
+    ir_jit_code ir_jit::trace_loop(ir_interpreter &interpreter, ir_interpreter_func_context &context) {
+        const size_t header = context.pc;
+        std::vector<trace_step> steps;
+
+        // Run one iteration, remembering the path it took
+        while (true) {
+            const size_t pc = context.pc;
+            const ir_instruction &inst = context.code[pc];
+
+            if (steps.size() == max_trace_length || !can_trace(interpreter.get_ref_manager(), context, inst)) {
+                return nullptr;
+            }
+
+            // Followed by hand, so recording doesn't count back edges. One going anywhere but the
+            // header is a nested loop, which has a trace of its own.
+            if (get_op(inst) == ir::opcode::br) {
+                steps.push_back(trace_step{ pc, true, ir_element::none, ir_array_storage::generic });
+                context.pc = inst.operand;
+
+                if (inst.operand <= pc) {
+                    if (inst.operand != header) {
+                        return nullptr;
+                    }
+
+                    break;
+                }
+
+                continue;
+            }
+
+            // A number form seeing anything else only turns back into the generic form
+            const ir::opcode op = inst.op;
+            interpreter.step(context);
+
+            if (context.pc == pc && inst.op != op) {
+                interpreter.step(context);
+            }
+
+            uint8_t kind = ir_element::none;
+            ir_array_storage storage = ir_array_storage::generic;
+
+            // can_trace made sure the element exists, and the array with it
+            if (get_op(inst) == ir::opcode::ldelmlc) {
+                kind = context.stack_ptr[-1].type;
+                storage = interpreter.get_ref_manager()->find_array(context.local_slots[inst.short_operand].ref_id)->get_storage();
+            }
+
+            steps.push_back(trace_step{ pc, context.pc != pc + 1, kind, storage });
+        }
+
+        x64_trace_builder builder(context, header, steps);
+
+        if (!builder.build()) {
+            return nullptr;
+        }
+
+        return make_executable(builder.get_code(), interpreter.native_blocks);
+    }
+
+    void ir_jit::release(const ir_native_block &block) {
+        munmap(block.mem, block.size);
+    }
+#else
+    bool ir_jit::is_available() {
+        return false;
+    }
+
+    bool ir_jit::compile(ir_interpreter &interpreter, ir_function_entry &func, const ir_jit_mode mode) {
+        return false;
+    }
+
+    ir_jit_code ir_jit::trace_loop(ir_interpreter &interpreter, ir_interpreter_func_context &context) {
+        return nullptr;
+    }
+
+    void ir_jit::release(const ir_native_block &block) {
+    }
+#endif
+}
@@ -4,7 +4,7 @@ namespace snack::ir {
     const char *get_op_name(opcode op) {
         switch (op) {
             #define IR_OP_DEF(a)  \
-                case opcode::##a: \
+                case opcode::a:   \
                     return #a;
             #include <snack/ir_opcode.def>
             #undef IR_OP_DEF
@@ -15,4 +15,135 @@ namespace snack::ir {
 
         return nullptr;
     }
+
+    size_t get_op_operand_size(opcode op) {
+        switch (op) {
+        case opcode::ldcst:
+        case opcode::ldcststr:
+        case opcode::beq:
+        case opcode::bge:
+        case opcode::bgt:
+        case opcode::blt:
+        case opcode::ble:
+        case opcode::br:
+        case opcode::brt:
+        case opcode::brf:
+        case opcode::bnlt:
+        case opcode::bnle:
+        case opcode::bngt:
+        case opcode::bnge:
+        case opcode::bneq:
+            return sizeof(size_t);
+
+        case opcode::inclc:
+        case opcode::ldlccst:
+        case opcode::ldargcst:
+            return 1 + sizeof(size_t);
+
+        case opcode::ldlc2:
+        case opcode::ldelmlc:
+            return 2;
+
+        case opcode::met:
+            return 2 + sizeof(size_t) + 4;
+
+        case opcode::ldarg:
+        case opcode::ldlc:
+        case opcode::addstlc:
+        case opcode::strarg:
+        case opcode::strlc:
+        case opcode::vri:
+        case opcode::vrs:
+            return 1;
+
+        case opcode::call:
+        case opcode::tcall:
+            return 5;
+
+        case opcode::rmov:
+        case opcode::rung:
+        case opcode::runo:
+        case opcode::ruin:
+            return 4;
+
+        case opcode::radd:
+        case opcode::rsub:
+        case opcode::rmul:
+        case opcode::rdiv:
+        case opcode::rmod:
+        case opcode::rand:
+        case opcode::ror:
+        case opcode::rxor:
+        case opcode::rpwr:
+        case opcode::rshl:
+        case opcode::rshr:
+        case opcode::rceq:
+        case opcode::rclt:
+        case opcode::rcle:
+        case opcode::rcgt:
+        case opcode::rcge:
+            return 6;
+
+        default:
+            break;
+        }
+
+        return 0;
+    }
+
+    bool is_register_op(opcode op) {
+        return op >= opcode::rmov && op <= opcode::ruin;
+    }
+
+    bool is_quickened_op(opcode op) {
+        return op >= opcode::addnn && op <= opcode::bneqnn;
+    }
+
+    opcode get_generic_op(opcode op) {
+        switch (op) {
+        case opcode::addnn:
+            return opcode::add;
+
+        case opcode::subnn:
+            return opcode::sub;
+
+        case opcode::mulnn:
+            return opcode::mul;
+
+        case opcode::ceqnn:
+            return opcode::ceq;
+
+        case opcode::cltnn:
+            return opcode::clt;
+
+        case opcode::clenn:
+            return opcode::cle;
+
+        case opcode::cgtnn:
+            return opcode::cgt;
+
+        case opcode::cgenn:
+            return opcode::cge;
+
+        case opcode::bnltnn:
+            return opcode::bnlt;
+
+        case opcode::bnlenn:
+            return opcode::bnle;
+
+        case opcode::bngtnn:
+            return opcode::bngt;
+
+        case opcode::bngenn:
+            return opcode::bnge;
+
+        case opcode::bneqnn:
+            return opcode::bneq;
+
+        default:
+            break;
+        }
+
+        return op;
+    }
 }
\ No newline at end of file
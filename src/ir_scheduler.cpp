@@ -0,0 +1,244 @@
+#include <snack/ir_scheduler.h>
+#include <snack/unit.h>
+#include <snack/unit_manager.h>
+
+#include <algorithm>
+
+namespace snack::ir::backend {
+    namespace {
+        // Refcounts of strings are not atomic, a string that is not interned may not be shared with
+        // another thread
+        ir_element detach(ir_element &&el) {
+            if (el.type == ir_element::str && !el.str_data->interned) {
+                return ir_element(std::string(el.str_data->value));
+            }
+
+            return std::move(el);
+        }
+    }
+
+    ir_scheduler::ir_scheduler(snack::error_manager &err_mngr, userspace::unit_manager &manager, const size_t worker_count,
+        const ir_jit_mode jit_mode)
+        : err_manager(&err_mngr)
+        , queued(0)
+        , unfinished(0)
+        , stopping(false)
+        , next_worker(0)
+        , stats_start(std::chrono::steady_clock::now()) {
+        for (size_t i = 0; i < std::max<size_t>(worker_count, 1); i++) {
+            std::unique_ptr<worker> new_worker = std::make_unique<worker>();
+
+            new_worker->interpreter = std::make_unique<ir_interpreter>(new_worker->err_mngr, manager);
+            new_worker->interpreter->set_jit_mode(jit_mode);
+
+            new_worker->jobs_run = 0;
+            new_worker->jobs_stolen = 0;
+            new_worker->busy_ns = 0;
+
+            workers.push_back(std::move(new_worker));
+        }
+
+        // Only once every queue exists, workers steal from each other
+        for (auto &each : workers) {
+            each->thread = std::thread(&ir_scheduler::work, this, std::ref(*each));
+        }
+    }
+
+    ir_scheduler::~ir_scheduler() {
+        {
+            std::lock_guard<std::mutex> guard(sleep_lock);
+            stopping = true;
+        }
+
+        wake.notify_all();
+
+        for (auto &each : workers) {
+            each->thread.join();
+        }
+    }
+
+    void ir_scheduler::enqueue(std::vector<task> &&tasks) {
+        if (tasks.empty()) {
+            return;
+        }
+
+        unfinished += tasks.size();
+
+        std::lock_guard<std::mutex> guard(sleep_lock);
+
+        // Counted first, a worker taking one right away must not see the count go below zero
+        queued += tasks.size();
+
+        for (task &each : tasks) {
+            worker &target = *workers[next_worker];
+            next_worker = (next_worker + 1) % workers.size();
+
+            std::lock_guard<std::mutex> queue_guard(target.queue_lock);
+            target.queue.push_back(std::move(each));
+        }
+
+        wake.notify_all();
+    }
+
+    std::vector<ir_scheduler::task> ir_scheduler::make_tasks(std::vector<ir_job> &&jobs) {
+        std::shared_ptr<std::atomic<size_t>> batch_left = std::make_shared<std::atomic<size_t>>(jobs.size());
+        std::vector<task> tasks(jobs.size());
+
+        for (size_t i = 0; i < jobs.size(); i++) {
+            tasks[i].job = std::move(jobs[i]);
+            tasks[i].index = i;
+            tasks[i].batch_left = batch_left;
+
+            for (ir_element &arg : tasks[i].job.args) {
+                arg = detach(std::move(arg));
+            }
+        }
+
+        return tasks;
+    }
+
+    std::vector<std::future<ir_element>> ir_scheduler::submit(std::vector<ir_job> &&jobs) {
+        std::vector<std::future<ir_element>> results;
+        std::vector<task> tasks = make_tasks(std::move(jobs));
+
+        for (task &each : tasks) {
+            results.push_back(each.promise.get_future());
+        }
+
+        enqueue(std::move(tasks));
+        return results;
+    }
+
+    void ir_scheduler::submit(std::vector<ir_job> &&jobs, ir_job_callback callback) {
+        std::shared_ptr<ir_job_callback> shared_callback = std::make_shared<ir_job_callback>(std::move(callback));
+        std::vector<task> tasks = make_tasks(std::move(jobs));
+
+        for (task &each : tasks) {
+            each.callback = shared_callback;
+        }
+
+        enqueue(std::move(tasks));
+    }
+
+    bool ir_scheduler::take_own(worker &self, task &result) {
+        std::lock_guard<std::mutex> guard(self.queue_lock);
+
+        if (self.queue.empty()) {
+            return false;
+        }
+
+        // Newest first, what was just queued is the most likely to still be in cache
+        result = std::move(self.queue.back());
+        self.queue.pop_back();
+
+        queued--;
+        return true;
+    }
+
+    bool ir_scheduler::steal(worker &self, task &result) {
+        const size_t self_idx = std::find_if(workers.begin(), workers.end(),
+            [&](const std::unique_ptr<worker> &each) { return each.get() == &self; }) - workers.begin();
+
+        for (size_t i = 1; i < workers.size(); i++) {
+            worker &victim = *workers[(self_idx + i) % workers.size()];
+            std::lock_guard<std::mutex> guard(victim.queue_lock);
+
+            if (victim.queue.empty()) {
+                continue;
+            }
+
+            // Oldest first, the owner works on the other end
+            result = std::move(victim.queue.front());
+            victim.queue.pop_front();
+
+            queued--;
+            self.jobs_stolen++;
+
+            return true;
+        }
+
+        return false;
+    }
+
+    void ir_scheduler::run_task(worker &self, task &&job) {
+        const auto start = std::chrono::steady_clock::now();
+
+        ir_interpreter &interpreter = *self.interpreter;
+        ir_call_site site{};
+        ir_element result;
+
+        if (job.job.unit && job.job.unit->resolve_call(static_cast<uint8_t>(job.job.func_idx), site) && site.script_func
+            && interpreter.call_from_host(*site.script_func, job.job.args)) {
+            interpreter.interpret();
+            result = detach(interpreter.take_result());
+        }
+
+        // Every other job of the batch is done, so are their errors
+        if (--*job.batch_left == 0) {
+            for (auto &each : workers) {
+                err_manager->merge(each->err_mngr);
+            }
+        }
+
+        if (job.callback) {
+            (*job.callback)(job.index, std::move(result));
+        } else {
+            job.promise.set_value(std::move(result));
+        }
+
+        self.busy_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        self.jobs_run++;
+
+        if (--unfinished == 0) {
+            std::lock_guard<std::mutex> guard(sleep_lock);
+            idle.notify_all();
+        }
+    }
+
+    void ir_scheduler::work(worker &self) {
+        while (true) {
+            task job;
+
+            if (take_own(self, job) || steal(self, job)) {
+                run_task(self, std::move(job));
+                continue;
+            }
+
+            std::unique_lock<std::mutex> guard(sleep_lock);
+            wake.wait(guard, [&] { return stopping || queued > 0; });
+
+            if (stopping && queued == 0) {
+                return;
+            }
+        }
+    }
+
+    void ir_scheduler::wait_idle() {
+        std::unique_lock<std::mutex> guard(sleep_lock);
+        idle.wait(guard, [&] { return unfinished == 0; });
+    }
+
+    std::vector<ir_worker_stats> ir_scheduler::get_worker_stats() const {
+        const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - stats_start);
+        std::vector<ir_worker_stats> stats;
+
+        for (const auto &each : workers) {
+            const std::chrono::nanoseconds busy(each->busy_ns.load());
+            const double utilization = elapsed.count() ? static_cast<double>(busy.count()) / elapsed.count() : 0.0;
+
+            stats.push_back(ir_worker_stats{ each->jobs_run.load(), each->jobs_stolen.load(), busy, std::min(utilization, 1.0) });
+        }
+
+        return stats;
+    }
+
+    void ir_scheduler::reset_worker_stats() {
+        for (auto &each : workers) {
+            each->jobs_run = 0;
+            each->jobs_stolen = 0;
+            each->busy_ns = 0;
+        }
+
+        stats_start = std::chrono::steady_clock::now();
+    }
+}
@@ -0,0 +1,760 @@
+#include <snack/ir_interpreter.h>
+#include <snack/unit.h>
+
+#include <algorithm>
+#include <cstring>
+#include <type_traits>
+
+namespace snack::ir::backend {
+    // Frames are copied as they are, only the pointers into the value stack are turned into offsets
+    static_assert(std::is_trivially_copyable<ir_interpreter_func_context>::value,
+        "Frames should stay plain data to be snapshotted");
+
+    namespace {
+        constexpr uint32_t snapshot_magic = 0x50534E53;
+        constexpr uint32_t snapshot_version = 5;
+
+        struct snapshot_header {
+            uint32_t magic;
+            uint32_t version;
+
+            // Only the interpreter that took it can restore it
+            uint64_t owner;
+            uint64_t size;
+
+            // Units the frames point into, each written after the header
+            uint64_t unit_count;
+
+            // Size of the object table, every reference indexes below it
+            uint64_t slot_count;
+            int64_t budget;
+
+            uint64_t object_count;
+            uint64_t coroutine_count;
+        };
+
+        /*! \brief A unit the interpreter had entered, with the copy of its code frames point into. */
+        struct snapshot_unit {
+            const void *unit;
+            const void *code;
+            uint64_t code_size;
+
+            // Of the name and the code as loaded, telling a unit apart from another one at the same address
+            uint64_t hash;
+        };
+
+        /*! \brief A value as written. Strings that are not interned are followed by their characters. */
+        struct snapshot_value {
+            uint8_t type;
+            uint8_t interned;
+            uint8_t padding[6];
+
+            uint64_t payload;
+        };
+
+        enum class snapshot_stack_kind : uint64_t {
+            none,
+            main,
+            idle,
+            coroutine
+        };
+
+        struct snapshot_stack_ref {
+            snapshot_stack_kind kind;
+
+            // Reference of the coroutine
+            uint64_t id;
+        };
+
+        struct snapshot_object {
+            uint64_t id;
+            uint32_t type;
+            uint32_t pin_count;
+
+            // Elements of an array, fields of an object
+            uint64_t count;
+
+            // Of an array: packed ones are followed by their 8 byte payloads, generic ones by values
+            uint32_t storage;
+            uint32_t padding;
+        };
+
+        constexpr size_t align_8(const size_t size) {
+            return (size + 7) & ~static_cast<size_t>(7);
+        }
+
+        // FNV-1a
+        uint64_t hash_bytes(uint64_t hash, const void *data, const size_t size) {
+            const uint8_t *bytes = static_cast<const uint8_t *>(data);
+
+            for (size_t i = 0; i < size; i++) {
+                hash = (hash ^ bytes[i]) * 0x100000001B3;
+            }
+
+            return hash;
+        }
+
+        uint64_t hash_unit(const userspace::interpreted_unit &unit) {
+            const std::string &name = unit.get_unit_name();
+            const std::vector<ir_instruction> &code = unit.get_code();
+
+            const uint64_t hash = hash_bytes(0xCBF29CE484222325, name.data(), name.length());
+            return hash_bytes(hash, code.data(), code.size() * sizeof(ir_instruction));
+        }
+    }
+
+    /*! \brief Appends to the caller's buffer, only counting once it is full. */
+    class ir_snapshot_writer {
+        uint8_t *buffer;
+        size_t capacity;
+        size_t size;
+
+    public:
+        explicit ir_snapshot_writer(uint8_t *buffer, const size_t capacity)
+            : buffer(buffer)
+            , capacity(capacity)
+            , size(0) {}
+
+        void write_bytes(const void *data, const size_t len) {
+            if (buffer && size + len <= capacity) {
+                std::memcpy(buffer + size, data, len);
+            }
+
+            size += len;
+        }
+
+        template <typename T>
+        void write(const T &value) {
+            write_bytes(&value, sizeof(T));
+        }
+
+        void write_value(const ir_element &el) {
+            snapshot_value value{};
+            value.type = el.type;
+            value.payload = el.ref_id;
+
+            if (el.type != ir_element::str || el.str_data->interned) {
+                value.interned = 1;
+                write(value);
+
+                return;
+            }
+
+            const std::string &str = el.str_data->value;
+            value.payload = str.length();
+
+            write(value);
+            write_bytes(str.data(), str.length());
+
+            size = align_8(size);
+        }
+
+        size_t get_size() const {
+            return size;
+        }
+
+        // Fill in a header written before
+        template <typename T>
+        void patch(const size_t offset, const T &value) {
+            if (buffer && offset + sizeof(T) <= capacity) {
+                std::memcpy(buffer + offset, &value, sizeof(T));
+            }
+        }
+    };
+
+    /*! \brief Reads a snapshot back, failing on anything past its end. */
+    class ir_snapshot_reader {
+        const uint8_t *buffer;
+        size_t size;
+        size_t offset;
+
+    public:
+        explicit ir_snapshot_reader(const uint8_t *buffer, const size_t size)
+            : buffer(buffer)
+            , size(size)
+            , offset(0) {}
+
+        bool read_bytes(void *data, const size_t len) {
+            if (offset + len > size) {
+                return false;
+            }
+
+            std::memcpy(data, buffer + offset, len);
+            offset += len;
+
+            return true;
+        }
+
+        template <typename T>
+        bool read(T &value) {
+            return read_bytes(&value, sizeof(T));
+        }
+
+        size_t get_remaining() const {
+            return size - offset;
+        }
+
+        bool read_value(ir_element &el) {
+            snapshot_value value;
+
+            if (!read(value) || value.type > ir_element::ref) {
+                return false;
+            }
+
+            if (value.type == ir_element::str && !value.interned) {
+                if (offset + value.payload > size) {
+                    return false;
+                }
+
+                el = ir_element(std::string(reinterpret_cast<const char *>(buffer + offset), value.payload));
+                offset = align_8(offset + value.payload);
+
+                return true;
+            }
+
+            // Interned strings are never freed, the pointer is still good
+            el = ir_element();
+            el.ref_id = value.payload;
+            el.type = static_cast<decltype(el.type)>(value.type);
+
+            return true;
+        }
+    };
+
+    namespace {
+        /*! \brief A stack as read, the frames still holding offsets into its values. */
+        struct staged_stack {
+            std::vector<ir_element> values;
+            std::vector<ir_interpreter_func_context> frames;
+        };
+
+        bool read_stack(ir_snapshot_reader &reader, staged_stack &loaded, const size_t value_capacity,
+            const size_t frame_capacity) {
+            uint64_t frame_count;
+            uint64_t used;
+
+            if (!reader.read(frame_count) || !reader.read(used) || used > value_capacity || frame_count > frame_capacity) {
+                return false;
+            }
+
+            loaded.values.resize(used);
+
+            for (ir_element &el : loaded.values) {
+                if (!reader.read_value(el)) {
+                    return false;
+                }
+            }
+
+            loaded.frames.resize(frame_count);
+
+            for (ir_interpreter_func_context &frame : loaded.frames) {
+                if (!reader.read(frame)) {
+                    return false;
+                }
+
+                // Everything a frame points at is below the top of the stack
+                for (const ir_element *offset : { frame.local_args, frame.local_slots, frame.stack_base, frame.stack_ptr }) {
+                    if (reinterpret_cast<uintptr_t>(offset) > used) {
+                        return false;
+                    }
+                }
+            }
+
+            return true;
+        }
+
+        // Checked against the capacity of the stack when read, it fits
+        void apply_stack(staged_stack &&staged, ir_execution_stack &loaded, ir_interpreter *interpreter,
+            ir_interpreter_ref_manager *ref_manager, int64_t *budget) {
+            const size_t current = loaded.frames.empty() ? 0 : loaded.frames.top().stack_ptr - loaded.values.data();
+
+            for (size_t i = 0; i < current; i++) {
+                loaded.values[i] = ir_element();
+            }
+
+            while (!loaded.frames.empty()) {
+                loaded.frames.pop();
+            }
+
+            ir_element *const base = loaded.values.data();
+            std::move(staged.values.begin(), staged.values.end(), base);
+
+            for (const ir_interpreter_func_context &saved : staged.frames) {
+                ir_interpreter_func_context *frame = loaded.frames.push();
+                *frame = saved;
+
+                frame->local_args = base + reinterpret_cast<uintptr_t>(frame->local_args);
+                frame->local_slots = base + reinterpret_cast<uintptr_t>(frame->local_slots);
+                frame->stack_base = base + reinterpret_cast<uintptr_t>(frame->stack_base);
+                frame->stack_ptr = base + reinterpret_cast<uintptr_t>(frame->stack_ptr);
+
+                frame->ref_manager = ref_manager;
+                frame->interpreter = interpreter;
+                frame->budget = budget;
+            }
+        }
+    }
+
+    void ir_interpreter::save_stack_ref(ir_snapshot_writer &writer, const ir_execution_stack *saved) {
+        snapshot_stack_ref ref{ snapshot_stack_kind::none, 0 };
+
+        if (saved == &main_stack) {
+            ref.kind = snapshot_stack_kind::main;
+        } else if (saved == &idle_stack) {
+            ref.kind = snapshot_stack_kind::idle;
+        } else if (saved) {
+            // Any other stack that may be running is one of a running coroutine
+            for (const auto &coroutine : coroutines) {
+                if (&coroutine->stack == saved) {
+                    ref.kind = snapshot_stack_kind::coroutine;
+                    ref.id = coroutine->id;
+
+                    break;
+                }
+            }
+        }
+
+        writer.write(ref);
+    }
+
+    void ir_interpreter::save_stack(ir_snapshot_writer &writer, ir_execution_stack &saved) {
+        ir_element *const base = saved.values.data();
+
+        // Everything above the top frame is none
+        const uint64_t frame_count = saved.frames.size();
+        const uint64_t used = saved.frames.empty() ? 0 : saved.frames.top().stack_ptr - base;
+
+        writer.write(frame_count);
+        writer.write(used);
+
+        for (uint64_t i = 0; i < used; i++) {
+            writer.write_value(base[i]);
+        }
+
+        for (uint64_t i = 0; i < frame_count; i++) {
+            ir_interpreter_func_context frame = saved.frames[i];
+
+            frame.local_args = reinterpret_cast<ir_element *>(frame.local_args - base);
+            frame.local_slots = reinterpret_cast<ir_element *>(frame.local_slots - base);
+            frame.stack_base = reinterpret_cast<ir_element *>(frame.stack_base - base);
+            frame.stack_ptr = reinterpret_cast<ir_element *>(frame.stack_ptr - base);
+
+            writer.write(frame);
+        }
+    }
+
+    size_t ir_interpreter::snapshot(uint8_t *buffer, const size_t capacity) {
+        ir_snapshot_writer writer(buffer, capacity);
+
+        snapshot_header header{};
+        header.magic = snapshot_magic;
+        header.version = snapshot_version;
+        header.owner = instance_id;
+        header.unit_count = unit_instances.size();
+        header.slot_count = ref_manager.slots.size();
+        header.budget = budget;
+        header.coroutine_count = coroutines.size();
+
+        writer.write(header);
+
+        for (const auto &instance : unit_instances) {
+            const ir_unit_instance &copy = *instance.second;
+            writer.write(snapshot_unit{ instance.first, copy.code.data(), copy.code.size(), hash_unit(*copy.unit) });
+        }
+        writer.write_value(result);
+
+        for (const ir_object_slot &slot : ref_manager.slots) {
+            ir_object_base *obj = slot.object.get();
+
+            if (!obj) {
+                continue;
+            }
+
+            snapshot_object saved{ obj->id, static_cast<uint32_t>(obj->type), obj->pin_count, 0, 0, 0 };
+            header.object_count++;
+
+            switch (obj->type) {
+            case ir_object_base_type::array: {
+                ir_array *arr = static_cast<ir_array *>(obj);
+                saved.count = arr->get_array_length();
+                saved.storage = static_cast<uint32_t>(arr->storage);
+
+                writer.write(saved);
+
+                switch (arr->storage) {
+                case ir_array_storage::integers:
+                    writer.write_bytes(arr->integers.data(), saved.count * sizeof(int64_t));
+                    break;
+
+                case ir_array_storage::numbers:
+                    writer.write_bytes(arr->numbers.data(), saved.count * sizeof(double));
+                    break;
+
+                default:
+                    for (const ir_element &el : arr->elements) {
+                        writer.write_value(el);
+                    }
+
+                    break;
+                }
+
+                break;
+            }
+
+            case ir_object_base_type::oop: {
+                ir_oop_object *oop = static_cast<ir_oop_object *>(obj);
+                saved.count = oop->fields.size();
+
+                writer.write(saved);
+
+                for (const auto &field : oop->fields) {
+                    writer.write(static_cast<uint64_t>(field.first));
+                    writer.write_value(field.second);
+                }
+
+                break;
+            }
+
+            case ir_object_base_type::coroutine: {
+                ir_coroutine *coroutine = static_cast<ir_coroutine *>(obj);
+
+                writer.write(saved);
+                writer.write(static_cast<uint64_t>(coroutine->state));
+                writer.write_value(coroutine->result);
+
+                save_stack(writer, coroutine->stack);
+                break;
+            }
+            }
+        }
+
+        // Who resumed every running coroutine, innermost last
+        for (const auto &coroutine : coroutines) {
+            save_stack_ref(writer, &coroutine->stack);
+            save_stack_ref(writer, coroutine->resumer);
+        }
+
+        save_stack_ref(writer, stack);
+        save_stack(writer, main_stack);
+
+        header.size = writer.get_size();
+        writer.patch(0, header);
+
+        return writer.get_size();
+    }
+
+    bool ir_interpreter::restore(const uint8_t *buffer, const size_t size) {
+        ir_snapshot_reader reader(buffer, size);
+        snapshot_header header;
+
+        if (!buffer || !reader.read(header) || header.magic != snapshot_magic || header.version != snapshot_version
+            || header.owner != instance_id || header.size != size) {
+            return false;
+        }
+
+        // Units are never dropped by an interpreter, every one the frames point into is still there
+        for (uint64_t i = 0; i < header.unit_count; i++) {
+            snapshot_unit saved;
+
+            if (!reader.read(saved)) {
+                return false;
+            }
+
+            auto instance = unit_instances.find(static_cast<const userspace::unit *>(saved.unit));
+
+            if (instance == unit_instances.end() || instance->second->code.data() != saved.code
+                || instance->second->code.size() != saved.code_size || hash_unit(*instance->second->unit) != saved.hash) {
+                return false;
+            }
+        }
+
+        // Everything is read and checked aside first, a snapshot cut short or corrupt leaves the
+        // interpreter as it was
+        ir_element staged_result;
+
+        if (!reader.read_value(staged_result)) {
+            return false;
+        }
+
+        const size_t slot_count = std::max<size_t>(header.slot_count, ref_manager.slots.size());
+
+        std::vector<ir_object_base_ptr> objects;
+        std::vector<bool> taken(slot_count);
+        std::unordered_map<uint64_t, ir_coroutine *> staged_coroutines;
+
+        for (uint64_t i = 0; i < header.object_count; i++) {
+            snapshot_object saved;
+
+            if (!reader.read(saved) || (saved.id & 0xFFFFFFFF) >= slot_count || taken[saved.id & 0xFFFFFFFF]) {
+                return false;
+            }
+
+            taken[saved.id & 0xFFFFFFFF] = true;
+
+            const ir_object_base_type type = static_cast<ir_object_base_type>(saved.type);
+            ir_object_base_ptr obj;
+
+            switch (type) {
+            case ir_object_base_type::array: {
+                // Payloads and values are both at least 8 bytes
+                if (saved.count > reader.get_remaining() / sizeof(int64_t)) {
+                    return false;
+                }
+
+                std::shared_ptr<ir_array> arr = std::make_shared<ir_array>();
+                arr->storage = static_cast<ir_array_storage>(saved.storage);
+
+                switch (arr->storage) {
+                case ir_array_storage::integers:
+                    arr->integers.resize(saved.count);
+
+                    if (!reader.read_bytes(arr->integers.data(), saved.count * sizeof(int64_t))) {
+                        return false;
+                    }
+
+                    break;
+
+                case ir_array_storage::numbers:
+                    arr->numbers.resize(saved.count);
+
+                    if (!reader.read_bytes(arr->numbers.data(), saved.count * sizeof(double))) {
+                        return false;
+                    }
+
+                    break;
+
+                case ir_array_storage::generic:
+                    arr->elements.resize(saved.count);
+
+                    for (ir_element &el : arr->elements) {
+                        if (!reader.read_value(el)) {
+                            return false;
+                        }
+                    }
+
+                    break;
+
+                default:
+                    return false;
+                }
+
+                obj = std::move(arr);
+                break;
+            }
+
+            case ir_object_base_type::oop: {
+                if (saved.count > reader.get_remaining() / (sizeof(uint64_t) + sizeof(snapshot_value))) {
+                    return false;
+                }
+
+                std::shared_ptr<ir_oop_object> oop = std::make_shared<ir_oop_object>();
+
+                for (uint64_t j = 0; j < saved.count; j++) {
+                    uint64_t key;
+
+                    if (!reader.read(key) || !reader.read_value(oop->fields[static_cast<uint32_t>(key)])) {
+                        return false;
+                    }
+                }
+
+                obj = std::move(oop);
+                break;
+            }
+
+            case ir_object_base_type::coroutine: {
+                std::shared_ptr<ir_coroutine> coroutine = std::make_shared<ir_coroutine>();
+                staged_stack loaded;
+                uint64_t state;
+
+                if (!reader.read(state) || state > static_cast<uint64_t>(ir_coroutine_state::done)
+                    || !reader.read_value(coroutine->result)
+                    || !read_stack(reader, loaded, coroutine->stack.values.size(), coroutine->stack.frames.capacity())) {
+                    return false;
+                }
+
+                apply_stack(std::move(loaded), coroutine->stack, this, &ref_manager, &budget);
+
+                coroutine->state = static_cast<ir_coroutine_state>(state);
+                coroutine->resumer = nullptr;
+
+                staged_coroutines[saved.id] = coroutine.get();
+                obj = std::move(coroutine);
+
+                break;
+            }
+
+            default:
+                return false;
+            }
+
+            obj->id = saved.id;
+            obj->pin_count = saved.pin_count;
+
+            objects.push_back(std::move(obj));
+        }
+
+        const auto is_valid_ref = [&staged_coroutines](const snapshot_stack_ref &ref) {
+            return (ref.kind == snapshot_stack_kind::coroutine) ? staged_coroutines.count(ref.id) != 0
+                                                                : ref.kind < snapshot_stack_kind::coroutine;
+        };
+
+        // Who resumed every running coroutine, innermost last
+        std::vector<std::pair<ir_coroutine *, snapshot_stack_ref>> running_coroutines;
+
+        for (uint64_t i = 0; i < header.coroutine_count; i++) {
+            snapshot_stack_ref running;
+            snapshot_stack_ref resumer;
+
+            if (!reader.read(running) || !reader.read(resumer) || running.kind != snapshot_stack_kind::coroutine
+                || !is_valid_ref(running) || !is_valid_ref(resumer)) {
+                return false;
+            }
+
+            running_coroutines.emplace_back(staged_coroutines[running.id], resumer);
+        }
+
+        snapshot_stack_ref running;
+        staged_stack loaded_main;
+
+        if (!reader.read(running) || running.kind == snapshot_stack_kind::none || !is_valid_ref(running)
+            || !read_stack(reader, loaded_main, main_stack.values.size(), main_stack.frames.capacity())) {
+            return false;
+        }
+
+        // All of it checked out, nothing below fails
+        result = std::move(staged_result);
+
+        // Objects still alive under the same id keep their storage. Slots not in the snapshot are
+        // freed, a new generation keeps references to what they held from matching anything.
+        std::vector<ir_object_slot> slots(slot_count);
+
+        for (size_t i = 0; i < ref_manager.slots.size(); i++) {
+            slots[i].generation = ref_manager.slots[i].generation + (ref_manager.slots[i].object ? 1 : 0);
+        }
+
+        for (size_t i = ref_manager.slots.size(); i < slots.size(); i++) {
+            slots[i].generation = 1;
+        }
+
+        for (ir_object_base_ptr &obj : objects) {
+            ir_object_base_ptr live = ref_manager.find_obj(obj->id) ? ref_manager.slots[obj->id & 0xFFFFFFFF].object : nullptr;
+
+            // Arena objects are not kept, the arena may be gone before the invocation restored ends
+            if (live && live->type == obj->type && !live->in_arena) {
+                live->pin_count = obj->pin_count;
+
+                switch (obj->type) {
+                case ir_object_base_type::array: {
+                    ir_array *from = static_cast<ir_array *>(obj.get());
+                    ir_array *to = static_cast<ir_array *>(live.get());
+
+                    to->storage = from->storage;
+                    to->integers.swap(from->integers);
+                    to->numbers.swap(from->numbers);
+                    to->elements.swap(from->elements);
+
+                    break;
+                }
+
+                case ir_object_base_type::oop:
+                    static_cast<ir_oop_object *>(live.get())->fields.swap(static_cast<ir_oop_object *>(obj.get())->fields);
+                    break;
+
+                case ir_object_base_type::coroutine: {
+                    // The buffers move with the vectors, frames keep pointing at the right values
+                    ir_coroutine *from = static_cast<ir_coroutine *>(obj.get());
+                    ir_coroutine *to = static_cast<ir_coroutine *>(live.get());
+
+                    std::swap(to->stack.frames, from->stack.frames);
+                    to->stack.values.swap(from->stack.values);
+
+                    to->state = from->state;
+                    to->resumer = nullptr;
+                    to->result = std::move(from->result);
+
+                    for (auto &each : running_coroutines) {
+                        if (each.first == from) {
+                            each.first = to;
+                        }
+                    }
+
+                    break;
+                }
+                }
+
+                obj = std::move(live);
+            }
+
+            ir_object_slot &slot = slots[obj->id & 0xFFFFFFFF];
+            slot.generation = static_cast<uint32_t>(obj->id >> 32);
+            slot.object = std::move(obj);
+        }
+
+        for (ir_object_slot &slot : slots) {
+            if (!slot.object && slot.generation == 0) {
+                slot.generation = 1;
+            }
+        }
+
+        ref_manager.slots.swap(slots);
+        ref_manager.rebuild_free_list();
+        ref_manager.reset_collection();
+
+        ref_manager.object_count = header.object_count;
+        ref_manager.pinned.clear();
+
+        for (const ir_object_slot &slot : ref_manager.slots) {
+            if (slot.object && slot.object->pin_count) {
+                ref_manager.pinned.push_back(slot.object->id);
+            }
+        }
+
+        const auto find_stack = [this](const snapshot_stack_ref &ref) -> ir_execution_stack * {
+            switch (ref.kind) {
+            case snapshot_stack_kind::main:
+                return &main_stack;
+
+            case snapshot_stack_kind::idle:
+                return &idle_stack;
+
+            case snapshot_stack_kind::coroutine:
+                return &static_cast<ir_coroutine *>(ref_manager.find_obj(ref.id))->stack;
+
+            default:
+                return nullptr;
+            }
+        };
+
+        coroutines.clear();
+
+        for (const auto &each : running_coroutines) {
+            ir_coroutine *coroutine = each.first;
+            coroutine->resumer = find_stack(each.second);
+
+            coroutines.push_back(std::static_pointer_cast<ir_coroutine>(ref_manager.slots[coroutine->id & 0xFFFFFFFF].object));
+        }
+
+        apply_stack(std::move(loaded_main), main_stack, this, &ref_manager, &budget);
+
+        stack = find_stack(running);
+        budget = header.budget;
+
+        // Arena objects were left behind with the old slots and every value pointing at arena strings
+        // is overwritten, the arena can go. An invocation restored half way allocates from it again.
+        slots.clear();
+
+        for (const uint64_t id : ref_manager.remembered) {
+            if (ir_object_base *obj = ref_manager.find_obj(id)) {
+                obj->remembered = false;
+            }
+        }
+
+        ref_manager.arena_objects.clear();
+        ref_manager.remembered.clear();
+        ref_manager.arena.reset();
+
+        ref_manager.arena_active = arena_mode && !main_stack.frames.empty();
+
+        return true;
+    }
+}
@@ -198,7 +198,7 @@ namespace snack {
                     // error
                     do_report(error_panic_code::invalid_number_dot, error_level::error,
                         tok);
-                } else {
+                } else if (temp == '.') {
                     dot_found = true;
                 }
 
@@ -217,7 +217,7 @@ namespace snack {
                     // error
                     do_report(error_panic_code::invalid_number_dot, error_level::error,
                         tok);
-                } else {
+                } else if (temp == '.') {
                     dot_found = true;
                 }
 
@@ -263,6 +263,7 @@ namespace snack {
         "object",
         "fn",
         "ret",
+        "yield",
         "for",
         "while",
         "do",
@@ -1,6 +1,7 @@
 #include <snack/parser.h>
 
 #include <algorithm>
+#include <charconv>
 
 namespace snack {
     parser::parser(error_manager &err_mngr, lexer &lex)
@@ -51,7 +52,24 @@ namespace snack {
         return new_type;
     }
 
-    number_node_ptr parser::make_number(const long double num) {
+    number_node_ptr parser::make_number(const std::string &raw) {
+        int64_t int_num = 0;
+
+        if (raw.find('.') == std::string::npos) {
+            const auto [end, err] = std::from_chars(raw.data(), raw.data() + raw.length(), int_num);
+
+            if (err == std::errc() && end == raw.data() + raw.length()) {
+                auto res = unit->integers.find(int_num);
+
+                if (res == unit->integers.end()) {
+                    return unit->integers.emplace(int_num, std::make_shared<number_node>(unit, int_num)).first->second;
+                }
+
+                return res->second;
+            }
+        }
+
+        const long double num = std::stold(raw);
         auto res = unit->numbers.find(num);
 
         if (res == unit->numbers.end()) {
@@ -213,6 +231,8 @@ namespace snack {
                 return parse_function(parent);
             } else if (tok_val == "ret") {
                 return parse_return(parent);
+            } else if (tok_val == "yield") {
+                return parse_yield(parent);
             } else if (tok_val == "if") {
                 return parse_if_else(parent);
             } else if (tok_val == "do") {
@@ -368,7 +388,7 @@ namespace snack {
             auto tok = code_lexer.peek();
 
             if (tok->get_token_type() == token_type::number) {
-                res = std::move(make_number(std::stod(tok->get_raw_token_string())));
+                res = std::move(make_number(tok->get_raw_token_string()));
                 code_lexer.next();
             } else if (tok->get_token_type() == token_type::ident) {
                 res = parse_ident_based(parent);
@@ -438,7 +458,7 @@ namespace snack {
         }
 
         case token_type::number: {
-            return make_number(std::stod(tok->get_raw_token_string()));
+            return make_number(tok->get_raw_token_string());
         }
 
         case token_type::ident:
@@ -1002,7 +1022,7 @@ namespace snack {
             tok = code_lexer.peek();
 
             if (tok->get_token_type() == token_type::number) {
-                assign->right = std::move(make_number(std::stod(tok->get_raw_token_string())));
+                assign->right = std::move(make_number(tok->get_raw_token_string()));
                 code_lexer.next();
             } else if (tok->get_token_type() == token_type::string) {
                 assign->right = std::move(make_string(tok->get_raw_token_string()));
@@ -1087,6 +1107,17 @@ namespace snack {
         return ret;
     }
 
+    std::shared_ptr<node> parser::parse_yield(node_ptr parent) {
+        std::shared_ptr<yield_node> yield = std::make_shared<yield_node>(parent, *code_lexer.get_current_token());
+
+        code_lexer.next();
+        yield->result = std::move(parse_rhs(yield));
+
+        code_lexer.back();
+
+        return yield;
+    }
+
     std::shared_ptr<node> parser::parse_function(node_ptr parent) {
         std::shared_ptr<function_node> func = std::make_shared<function_node>(parent, *code_lexer.peek());
 
@@ -16,6 +16,8 @@ namespace snack::userspace {
             const size_t addr = *reinterpret_cast<const size_t *>(ir_bin + header->func_table_addr + i * sizeof(size_t));
             const uint16_t arg_count = *reinterpret_cast<const size_t *>(ir_bin + addr + 2);
             const size_t name_addr = *reinterpret_cast<const size_t *>(ir_bin + addr + 4);
+            const uint16_t max_stack = *reinterpret_cast<const uint16_t *>(ir_bin + addr + 4 + sizeof(size_t));
+            const uint16_t local_count = *reinterpret_cast<const uint16_t *>(ir_bin + addr + 6 + sizeof(size_t));
 
             const size_t name_len = *reinterpret_cast<const size_t *>(ir_bin + name_addr + 2);
 
@@ -24,7 +26,21 @@ namespace snack::userspace {
 
             std::copy(ir_bin + name_addr + 2 + sizeof(size_t), ir_bin + name_addr + 2 + sizeof(size_t) + name_len, name.begin());
 
-            functions.push_back(interpreted_unit_func_info{ name, addr, arg_count });
+            functions.push_back(interpreted_unit_func_info{ name, addr, arg_count, max_stack, local_count, 0 });
+        }
+
+        for (auto &func : functions) {
+            decode_function(func);
+        }
+
+        // Code, constants and call sites don't move anymore. Functions are decoded back to back, one
+        // ends where the next one starts.
+        for (size_t i = 0; i < functions.size(); i++) {
+            const auto &func = functions[i];
+            const size_t end = (i + 1 < functions.size()) ? functions[i + 1].entry : code.size();
+
+            entries.push_back(ir::backend::ir_function_entry{ code.data(), constants.data(), call_sites.data(),
+                &func.name, this, func.entry, end, func.arg_count, func.local_count, func.max_stack, 0, nullptr });
         }
 
         size_t ref_pc = header->ref_table_addr;
@@ -43,6 +59,291 @@ namespace snack::userspace {
         }
     }
 
+    std::optional<uint32_t> interpreted_unit::get_constant_index(const size_t data_addr, const bool number) {
+        const ir::backend::ir_binary_header *header = reinterpret_cast<decltype(header)>(ir_bin);
+
+        if (data_addr < header->data_addr || data_addr >= header->relocate_addr) {
+            return std::optional<uint32_t>{};
+        }
+
+        const ir::opcode op = *reinterpret_cast<const ir::opcode *>(ir_bin + data_addr);
+        const bool is_number = (op == ir::opcode::idata || op == ir::opcode::i64data || op == ir::opcode::f64data);
+
+        if ((op != ir::opcode::strdata && !is_number) || is_number != number) {
+            return std::optional<uint32_t>{};
+        }
+
+        auto cached = constant_indexes.find(data_addr);
+
+        if (cached != constant_indexes.end()) {
+            return cached->second;
+        }
+
+        ir::backend::ir_element element;
+
+        const char *data = ir_bin + data_addr + 2;
+
+        if (op == ir::opcode::i64data) {
+            element = *reinterpret_cast<const int64_t *>(data);
+        } else if (op == ir::opcode::f64data) {
+            element = *reinterpret_cast<const double *>(data);
+        } else if (op == ir::opcode::idata) {
+            // Binaries from before typed number data
+            element = static_cast<double>(*reinterpret_cast<const long double *>(data));
+        } else {
+            const size_t len = *reinterpret_cast<const size_t *>(ir_bin + data_addr + 2);
+            const char *str = ir_bin + data_addr + 2 + sizeof(size_t);
+
+            element = ir::backend::ir_element(ir::backend::ir_intern_string(std::string(str, len)));
+        }
+
+        const uint32_t index = static_cast<uint32_t>(constants.size());
+
+        constants.push_back(std::move(element));
+        constant_indexes.emplace(data_addr, index);
+
+        return index;
+    }
+
+    std::optional<uint16_t> interpreted_unit::decode_register_operand(const interpreted_unit_func_info &info,
+        const uint16_t operand) {
+        if (operand == ir::ir_operand_stack) {
+            return operand;
+        }
+
+        if (!(operand & ir::ir_operand_constant)) {
+            if (operand >= info.arg_count + info.local_count) {
+                return std::optional<uint16_t>{};
+            }
+
+            return operand;
+        }
+
+        // Constant operands index the binary constant table, turn them into constant pool indices
+        const ir::backend::ir_binary_header *header = reinterpret_cast<decltype(header)>(ir_bin);
+        const size_t table_idx = operand & ~ir::ir_operand_constant;
+
+        if (table_idx >= header->const_count) {
+            return std::optional<uint16_t>{};
+        }
+
+        const size_t data_addr = *reinterpret_cast<const size_t *>(ir_bin + header->const_table_addr + table_idx * sizeof(size_t));
+
+        if (data_addr < header->data_addr || data_addr >= header->relocate_addr) {
+            return std::optional<uint16_t>{};
+        }
+
+        const ir::opcode data_op = *reinterpret_cast<const ir::opcode *>(ir_bin + data_addr);
+        auto const_index = get_constant_index(data_addr, data_op != ir::opcode::strdata);
+
+        if (!const_index || *const_index >= ir::ir_operand_constant) {
+            return std::optional<uint16_t>{};
+        }
+
+        return static_cast<uint16_t>(ir::ir_operand_constant | *const_index);
+    }
+
+    void interpreted_unit::decode_function(interpreted_unit_func_info &info) {
+        const ir::backend::ir_binary_header *header = reinterpret_cast<decltype(header)>(ir_bin);
+
+        // Register form instructions are only understood in binaries that say they use them
+        const bool register_form = (header->major == ir::backend::ir_binary_version_register);
+
+        // Branch targets are byte offsets relative to the function start. Find out where every
+        // instruction will land in the stream first.
+        std::unordered_map<size_t, uint32_t> offset_to_index;
+
+        size_t offset = 0;
+        uint32_t index = static_cast<uint32_t>(code.size());
+
+        bool terminated = false;
+
+        while (info.addr + offset + 2 <= header->data_addr) {
+            const ir::opcode op = *reinterpret_cast<const ir::opcode *>(ir_bin + info.addr + offset);
+            offset_to_index.emplace(offset, index++);
+
+            if (op == ir::opcode::endmet) {
+                terminated = true;
+                break;
+            }
+
+            offset += 2 + ir::get_op_operand_size(op);
+        }
+
+        info.entry = code.size();
+        code.reserve(index + 1);
+
+        offset = 0;
+
+        while (code.size() < index) {
+            const char *operand_ptr = ir_bin + info.addr + offset + 2;
+
+            ir::backend::ir_instruction inst{};
+            inst.op = *reinterpret_cast<const ir::opcode *>(ir_bin + info.addr + offset);
+
+            switch (inst.op) {
+            case ir::opcode::ldcst:
+            case ir::opcode::ldcststr: {
+                auto const_index = get_constant_index(*reinterpret_cast<const size_t *>(operand_ptr),
+                    inst.op == ir::opcode::ldcst);
+
+                if (!const_index) {
+                    inst.op = ir::opcode::total_opcode;
+                    break;
+                }
+
+                inst.operand = *const_index;
+                break;
+            }
+
+            case ir::opcode::beq:
+            case ir::opcode::bge:
+            case ir::opcode::bgt:
+            case ir::opcode::blt:
+            case ir::opcode::ble:
+            case ir::opcode::br:
+            case ir::opcode::brt:
+            case ir::opcode::brf:
+            case ir::opcode::bnlt:
+            case ir::opcode::bnle:
+            case ir::opcode::bngt:
+            case ir::opcode::bnge:
+            case ir::opcode::bneq: {
+                auto target = offset_to_index.find(*reinterpret_cast<const size_t *>(operand_ptr));
+
+                if (target == offset_to_index.end()) {
+                    inst.op = ir::opcode::total_opcode;
+                    break;
+                }
+
+                inst.operand = target->second;
+                break;
+            }
+
+            case ir::opcode::met: {
+                inst.short_operand = *reinterpret_cast<const uint16_t *>(operand_ptr);
+                break;
+            }
+
+            case ir::opcode::ldlc:
+            case ir::opcode::strlc:
+            case ir::opcode::addstlc: {
+                inst.short_operand = *reinterpret_cast<const uint8_t *>(operand_ptr);
+
+                if (inst.short_operand >= info.local_count) {
+                    inst.op = ir::opcode::total_opcode;
+                }
+
+                break;
+            }
+
+            case ir::opcode::ldarg:
+            case ir::opcode::strarg:
+            case ir::opcode::vri:
+            case ir::opcode::vrs: {
+                const uint8_t arg_idx = *reinterpret_cast<const uint8_t *>(operand_ptr);
+
+                if (arg_idx >= info.arg_count) {
+                    inst.op = ir::opcode::total_opcode;
+                    break;
+                }
+
+                // Arguments sit in the frame the way the caller pushed them, last one first
+                inst.short_operand = static_cast<uint16_t>(info.arg_count - 1 - arg_idx);
+                break;
+            }
+
+            case ir::opcode::inclc:
+            case ir::opcode::ldlccst:
+            case ir::opcode::ldargcst: {
+                const uint8_t slot = *reinterpret_cast<const uint8_t *>(operand_ptr);
+                auto const_index = get_constant_index(*reinterpret_cast<const size_t *>(operand_ptr + 1), true);
+
+                const size_t slot_count = (inst.op == ir::opcode::ldargcst) ? info.arg_count : info.local_count;
+
+                if (!const_index || slot >= slot_count) {
+                    inst.op = ir::opcode::total_opcode;
+                    break;
+                }
+
+                inst.short_operand = (inst.op == ir::opcode::ldargcst) ? static_cast<uint16_t>(info.arg_count - 1 - slot) : slot;
+                inst.operand = *const_index;
+
+                break;
+            }
+
+            case ir::opcode::ldlc2:
+            case ir::opcode::ldelmlc: {
+                inst.short_operand = *reinterpret_cast<const uint8_t *>(operand_ptr);
+                inst.operand = *reinterpret_cast<const uint8_t *>(operand_ptr + 1);
+
+                if (inst.short_operand >= info.local_count || inst.operand >= info.local_count) {
+                    inst.op = ir::opcode::total_opcode;
+                }
+
+                break;
+            }
+
+            case ir::opcode::call:
+            case ir::opcode::tcall: {
+                ir::backend::ir_call_site site{};
+                site.unit_ref = *reinterpret_cast<const uint16_t *>(operand_ptr);
+                site.func_idx = *reinterpret_cast<const uint16_t *>(operand_ptr + 2);
+                site.arg_count = *reinterpret_cast<const uint8_t *>(operand_ptr + 4);
+
+                inst.short_operand = site.arg_count;
+                inst.operand = static_cast<uint32_t>(call_sites.size());
+
+                call_sites.push_back(std::move(site));
+                break;
+            }
+
+            default: {
+                // Number forms are only made by the interpreter
+                if (ir::is_quickened_op(inst.op)) {
+                    inst.op = ir::opcode::total_opcode;
+                    break;
+                }
+
+                if (!ir::is_register_op(inst.op)) {
+                    break;
+                }
+
+                const uint16_t *operands = reinterpret_cast<const uint16_t *>(operand_ptr);
+
+                if (!register_form) {
+                    inst.op = ir::opcode::total_opcode;
+                    break;
+                }
+
+                // Destination, then one or two sources
+                auto dest = decode_register_operand(info, operands[0]);
+                auto lhs = decode_register_operand(info, operands[1]);
+                auto rhs = (ir::get_op_operand_size(inst.op) == 6) ? decode_register_operand(info, operands[2])
+                                                                    : std::optional<uint16_t>{ 0 };
+
+                if (!dest || !lhs || !rhs || (*dest & ir::ir_operand_constant)) {
+                    inst.op = ir::opcode::total_opcode;
+                    break;
+                }
+
+                inst.short_operand = *dest;
+                inst.operand = *lhs | (static_cast<uint32_t>(*rhs) << 16);
+
+                break;
+            }
+            }
+
+            code.push_back(inst);
+            offset += 2 + ir::get_op_operand_size(*reinterpret_cast<const ir::opcode *>(ir_bin + info.addr + offset));
+        }
+
+        if (!terminated) {
+            // Running off the end of a truncated function must not fall into the next one
+            code.push_back(ir::backend::ir_instruction{ ir::opcode::total_opcode, 0, 0 });
+        }
+    }
+
     std::optional<size_t> interpreted_unit::get_function_idx(const std::string &name, size_t arg_count) {
         const auto &func = std::find_if(functions.begin(), functions.end(), 
             [&](interpreted_unit_func_info &info) { return info.name ==name && info.arg_count ==arg_count; });
@@ -60,16 +361,16 @@ namespace snack::userspace {
             return false;
         }
 
-        ir::backend::ir_interpreter_func_context function;
+        return interpreter->enter_function(context, interpreter->get_local_entry(entries[idx])) != nullptr;
+    }
 
-        function.pc = 0;
-        function.func_name = functions[idx].name;
-        function.ir_bin = ir_bin + functions[idx].addr;
-        function.ir_global_bin = ir_bin;
-        function.owning_unit = this;
-        function.ref_manager = interpreter->get_ref_manager();
+    bool interpreted_unit::resolve_call(const uint8_t idx, ir::backend::ir_call_site &site) {
+        if (idx >= entries.size()) {
+            return false;
+        }
 
-        interpreter->func_contexts.push(std::move(function));
+        site.script_func = &entries[idx];
+        site.host_func = nullptr;
 
         return true;
     }
@@ -92,9 +393,19 @@ namespace snack::userspace {
             return false;
         }
 
-        auto func = functions[idx].real_func;
+        functions[idx].func(functions[idx].object, *context);
+
+        return true;
+    }
+
+    bool external_unit::resolve_call(const uint8_t idx, ir::backend::ir_call_site &site) {
+        if (idx >= functions.size()) {
+            return false;
+        }
 
-        func(*context);
+        site.script_func = nullptr;
+        site.host_func = functions[idx].func;
+        site.host_object = functions[idx].object;
 
         return true;
     }
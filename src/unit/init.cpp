@@ -5,7 +5,7 @@
 
 namespace snack::userspace {
     void init_builtin(unit_manager *umngr) {
-        #define ADD_UNIT(unit) umngr->add_external_unit(std::make_shared<##unit>())
+        #define ADD_UNIT(unit) umngr->add_external_unit(std::make_shared<unit>())
 
         ADD_UNIT(std_unit);
 
@@ -1,3 +1,4 @@
+#include <cstdio>
 #include <iostream>
 #include <snack/unit/std.h>
 
@@ -11,92 +12,136 @@ namespace snack::userspace {
             return;
         }
 
-        std::string format_str = format.str_data;
+        // Write the pieces out directly, formatting should not build a new string every call
+        const std::string &format_str = format.get_string();
+
+        size_t last_pos = 0;
         size_t format_pos = format_str.find("{}");
 
         while (format_pos != std::string::npos) {
+            std::cout.write(format_str.data() + last_pos, format_pos - last_pos);
+
             ir::backend::ir_element dat = context.pop();
 
-            if (dat.type == decltype(dat)::num) {
-                format_str.replace(format_str.begin() + format_pos, format_str.begin() + format_pos + 2,
-                    (int64_t)(dat.num_data) == dat.num_data ? std::to_string((int64_t)(dat.num_data)) : std::to_string(dat.num_data));
+            if (dat.type == decltype(dat)::integer) {
+                char num_buf[32];
+                const int len = std::snprintf(num_buf, sizeof(num_buf), "%lld", static_cast<long long>(dat.int_data));
+
+                std::cout.write(num_buf, len);
+            } else if (dat.type == decltype(dat)::num) {
+                char num_buf[64];
+                const int len = (int64_t)(dat.num_data) == dat.num_data
+                    ? std::snprintf(num_buf, sizeof(num_buf), "%lld", static_cast<long long>(dat.num_data))
+                    : std::snprintf(num_buf, sizeof(num_buf), "%f", dat.num_data);
+
+                std::cout.write(num_buf, len);
             } else {
-                format_str.replace(format_str.begin() + format_pos, format_str.begin() + format_pos + 2,
-                    dat.str_data);
+                const std::string &str = dat.get_string();
+                std::cout.write(str.data(), str.length());
             }
 
-            format_pos = format_str.find("{}");
+            last_pos = format_pos + 2;
+            format_pos = format_str.find("{}", last_pos);
         }
 
-        std::cout << format_str;
+        std::cout.write(format_str.data() + last_pos, format_str.length() - last_pos);
     }
 
-    void std_unit::sin(ir::backend::ir_interpreter_func_context &context) {
-        ir::backend::ir_element num = context.pop();
+    double std_unit::sin(const double num) {
+        return std::sin(num);
+    }
 
-        if (num.type != ir::backend::ir_element::num) {
-            // report interpreter
-            return;
-        }
+    double std_unit::cos(const double num) {
+        return std::cos(num);
+    }
 
-        context.push(std::sin(num.num_data));
+    double std_unit::tan(const double num) {
+        return std::tan(num);
     }
 
-    void std_unit::cos(ir::backend::ir_interpreter_func_context &context) {
-        ir::backend::ir_element num = context.pop();
+    int64_t std_unit::length(ir::backend::ir_interpreter_func_context &context, const ir::backend::ir_element &el) {
+        switch (el.type) {
+        case ir::backend::ir_element::str:
+            return static_cast<int64_t>(el.str_data->value.length());
 
-        if (num.type != ir::backend::ir_element::num) {
-            // report interpreter
-            return;
+        case ir::backend::ir_element::ref: {
+            ir::backend::ir_array *arr = context.ref_manager->find_array(el.ref_id);
+            return arr ? static_cast<int64_t>(arr->get_array_length()) : -1;
         }
 
-        context.push(std::cos(num.num_data));
+        default:
+            return -1;
+        }
     }
 
-    void std_unit::tan(ir::backend::ir_interpreter_func_context &context) {
-        ir::backend::ir_element num = context.pop();
+    ir::backend::ir_element std_unit::start_coroutine(ir::backend::ir_interpreter_func_context &context,
+        const std::string &name, const std::vector<ir::backend::ir_element> &args) {
+        // The function is looked up by name in the unit of the caller
+        if (!context.owning_unit) {
+            return ir::backend::ir_element();
+        }
+
+        auto idx = context.owning_unit->get_function_idx(name, args.size());
+        ir::backend::ir_call_site site{};
 
-        if (num.type != ir::backend::ir_element::num) {
-            // report interpreter
-            return;
+        if (!idx || !context.owning_unit->resolve_call(static_cast<uint8_t>(*idx), site) || !site.script_func) {
+            return ir::backend::ir_element();
         }
 
-        context.push(std::tan(num.num_data));
+        return context.interpreter->create_coroutine(*site.script_func, args);
     }
 
-    void std_unit::length(ir::backend::ir_interpreter_func_context &context) {
-        ir::backend::ir_element el = context.pop();
+    ir::backend::ir_element std_unit::coroutine(ir::backend::ir_interpreter_func_context &context, const std::string &name) {
+        return start_coroutine(context, name, {});
+    }
 
-        switch (el.type) {
-        case ir::backend::ir_element::num:
-            context.push(-1);
-            break;
+    ir::backend::ir_element std_unit::coroutine_with_arg(ir::backend::ir_interpreter_func_context &context,
+        const std::string &name, const ir::backend::ir_element &arg) {
+        return start_coroutine(context, name, { arg });
+    }
 
-        case ir::backend::ir_element::str:
-            context.push(el.str_data.length());
-            break;
+    void std_unit::resume(ir::backend::ir_interpreter_func_context &context) {
+        ir::backend::ir_element coroutine = context.pop();
 
-        case ir::backend::ir_element::ref: {
-            auto obj = context.ref_manager->get_obj(el.ref_id);
-            
-            if (obj->get_type() == ir::backend::ir_object_base_type::array) {
-                std::shared_ptr<ir::backend::ir_array> arr = std::dynamic_pointer_cast<ir::backend::ir_array>(obj);
-                context.push(arr->get_array_length());
+        // Otherwise the coroutine pushes what it yields or returns when it gives control back
+        if (!context.interpreter->resume_after_call(context, coroutine)) {
+            context.push(ir::backend::ir_element());
+        }
+    }
 
-                break;
-            } else {
-                context.push(-1);
-            }
+    int64_t std_unit::alive(ir::backend::ir_interpreter_func_context &context, const ir::backend::ir_element &el) {
+        if (el.type != ir::backend::ir_element::ref) {
+            return 0;
         }
+
+        ir::backend::ir_object_base *obj = context.ref_manager->find_obj(el.ref_id);
+
+        if (!obj || obj->get_type() != ir::backend::ir_object_base_type::coroutine) {
+            return 0;
         }
+
+        return static_cast<ir::backend::ir_coroutine *>(obj)->get_state() != ir::backend::ir_coroutine_state::done;
     }
 
     std_unit::std_unit()
         : external_unit("std") {
-        REGISTER_UNIT_FUNC(std_unit, "print", print, -1);
-        REGISTER_UNIT_FUNC(std_unit, "sin", sin, 1);
-        REGISTER_UNIT_FUNC(std_unit, "cos", print, 1);
-        REGISTER_UNIT_FUNC(std_unit, "tan", print, 1);
-        REGISTER_UNIT_FUNC(std_unit, "length", length, 1);
+        bind<&std_unit::print>("print", -1);
+        bind<&std_unit::sin>("sin");
+        bind<&std_unit::cos>("cos");
+        bind<&std_unit::tan>("tan");
+        bind<&std_unit::length>("length");
+        bind<&std_unit::coroutine>("coroutine");
+        bind<&std_unit::coroutine_with_arg>("coroutine");
+        bind<&std_unit::resume>("resume", 1);
+        bind<&std_unit::alive>("alive");
+        bind<&std_unit::sum>("sum");
+        bind<&std_unit::min>("min");
+        bind<&std_unit::max>("max");
+        bind<&std_unit::dot>("dot");
+        bind<&std_unit::find>("find");
+        bind<&std_unit::count>("count");
+        bind<&std_unit::fill>("fill");
+        bind<&std_unit::copy>("copy");
+        bind<&std_unit::add_scalar>("add_scalar");
     }
 }
\ No newline at end of file
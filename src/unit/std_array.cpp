@@ -0,0 +1,631 @@
+#include <snack/unit/std.h>
+
+#include <algorithm>
+#include <cstring>
+
+// Kernels run on the widest vectors the build targets, SSE2 being part of every x86-64
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SNACK_VECTOR_LANES 4
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define SNACK_VECTOR_LANES 2
+#endif
+
+namespace snack::userspace {
+    namespace {
+        using ir::backend::ir_array;
+        using ir::backend::ir_array_storage;
+        using ir::backend::ir_element;
+
+#if SNACK_VECTOR_LANES == 4
+        __m256i load(const int64_t *data) {
+            return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data));
+        }
+
+        __m256d load(const double *data) {
+            return _mm256_loadu_pd(data);
+        }
+
+        void store(int64_t *data, const __m256i val) {
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(data), val);
+        }
+
+        void store(double *data, const __m256d val) {
+            _mm256_storeu_pd(data, val);
+        }
+
+        __m256i splat(const int64_t val) {
+            return _mm256_set1_epi64x(val);
+        }
+
+        __m256d splat(const double val) {
+            return _mm256_set1_pd(val);
+        }
+
+        __m256i add(const __m256i lhs, const __m256i rhs) {
+            return _mm256_add_epi64(lhs, rhs);
+        }
+
+        __m256d add(const __m256d lhs, const __m256d rhs) {
+            return _mm256_add_pd(lhs, rhs);
+        }
+
+        __m256d mul(const __m256d lhs, const __m256d rhs) {
+            return _mm256_mul_pd(lhs, rhs);
+        }
+
+        __m256d min_of(const __m256d lhs, const __m256d rhs) {
+            return _mm256_min_pd(lhs, rhs);
+        }
+
+        __m256d max_of(const __m256d lhs, const __m256d rhs) {
+            return _mm256_max_pd(lhs, rhs);
+        }
+
+        // One bit per lane
+        int equal_mask(const __m256i lhs, const __m256i rhs) {
+            return _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(lhs, rhs)));
+        }
+
+        int equal_mask(const __m256d lhs, const __m256d rhs) {
+            return _mm256_movemask_pd(_mm256_cmp_pd(lhs, rhs, _CMP_EQ_OQ));
+        }
+#elif SNACK_VECTOR_LANES == 2
+        __m128i load(const int64_t *data) {
+            return _mm_loadu_si128(reinterpret_cast<const __m128i *>(data));
+        }
+
+        __m128d load(const double *data) {
+            return _mm_loadu_pd(data);
+        }
+
+        void store(int64_t *data, const __m128i val) {
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(data), val);
+        }
+
+        void store(double *data, const __m128d val) {
+            _mm_storeu_pd(data, val);
+        }
+
+        __m128i splat(const int64_t val) {
+            return _mm_set1_epi64x(val);
+        }
+
+        __m128d splat(const double val) {
+            return _mm_set1_pd(val);
+        }
+
+        __m128i add(const __m128i lhs, const __m128i rhs) {
+            return _mm_add_epi64(lhs, rhs);
+        }
+
+        __m128d add(const __m128d lhs, const __m128d rhs) {
+            return _mm_add_pd(lhs, rhs);
+        }
+
+        __m128d mul(const __m128d lhs, const __m128d rhs) {
+            return _mm_mul_pd(lhs, rhs);
+        }
+
+        __m128d min_of(const __m128d lhs, const __m128d rhs) {
+            return _mm_min_pd(lhs, rhs);
+        }
+
+        __m128d max_of(const __m128d lhs, const __m128d rhs) {
+            return _mm_max_pd(lhs, rhs);
+        }
+
+        // One bit per lane. SSE2 only compares 32 bits halves, both must match.
+        int equal_mask(const __m128i lhs, const __m128i rhs) {
+            __m128i eq = _mm_cmpeq_epi32(lhs, rhs);
+            eq = _mm_and_si128(eq, _mm_shuffle_epi32(eq, _MM_SHUFFLE(2, 3, 0, 1)));
+
+            return _mm_movemask_pd(_mm_castsi128_pd(eq));
+        }
+
+        int equal_mask(const __m128d lhs, const __m128d rhs) {
+            return _mm_movemask_pd(_mm_cmpeq_pd(lhs, rhs));
+        }
+#endif
+
+#ifdef SNACK_VECTOR_LANES
+        constexpr size_t lanes = SNACK_VECTOR_LANES;
+#endif
+
+        // Integers wrap around like the + and * operators make them
+        int64_t plus(const int64_t lhs, const int64_t rhs) {
+            return static_cast<int64_t>(static_cast<uint64_t>(lhs) + static_cast<uint64_t>(rhs));
+        }
+
+        double plus(const double lhs, const double rhs) {
+            return lhs + rhs;
+        }
+
+        int64_t times(const int64_t lhs, const int64_t rhs) {
+            return static_cast<int64_t>(static_cast<uint64_t>(lhs) * static_cast<uint64_t>(rhs));
+        }
+
+        template <typename T>
+        T sum_packed(const T *data, const size_t n) {
+            T total = 0;
+            size_t i = 0;
+
+#ifdef SNACK_VECTOR_LANES
+            if (n >= lanes) {
+                auto acc = load(data);
+
+                for (i = lanes; i + lanes <= n; i += lanes) {
+                    acc = add(acc, load(data + i));
+                }
+
+                T parts[lanes];
+                store(parts, acc);
+
+                for (const T part : parts) {
+                    total = plus(total, part);
+                }
+            }
+#endif
+
+            for (; i < n; i++) {
+                total = plus(total, data[i]);
+            }
+
+            return total;
+        }
+
+        // Integers have no vector min and max before AVX-512, the compiler does what it can
+        int64_t extreme_packed(const int64_t *data, const size_t n, const bool want_max) {
+            return want_max ? *std::max_element(data, data + n) : *std::min_element(data, data + n);
+        }
+
+        double extreme_packed(const double *data, const size_t n, const bool want_max) {
+            double best = data[0];
+            size_t i = 1;
+
+#ifdef SNACK_VECTOR_LANES
+            if (n >= lanes) {
+                auto acc = load(data);
+
+                for (i = lanes; i + lanes <= n; i += lanes) {
+                    acc = want_max ? max_of(acc, load(data + i)) : min_of(acc, load(data + i));
+                }
+
+                double parts[lanes];
+                store(parts, acc);
+
+                best = parts[0];
+
+                for (const double part : parts) {
+                    best = want_max ? std::max(best, part) : std::min(best, part);
+                }
+            }
+#endif
+
+            for (; i < n; i++) {
+                best = want_max ? std::max(best, data[i]) : std::min(best, data[i]);
+            }
+
+            return best;
+        }
+
+        int64_t dot_packed(const int64_t *lhs, const int64_t *rhs, const size_t n) {
+            int64_t total = 0;
+
+            for (size_t i = 0; i < n; i++) {
+                total = plus(total, times(lhs[i], rhs[i]));
+            }
+
+            return total;
+        }
+
+        double dot_packed(const double *lhs, const double *rhs, const size_t n) {
+            double total = 0;
+            size_t i = 0;
+
+#ifdef SNACK_VECTOR_LANES
+            if (n >= lanes) {
+                auto acc = mul(load(lhs), load(rhs));
+
+                for (i = lanes; i + lanes <= n; i += lanes) {
+                    acc = add(acc, mul(load(lhs + i), load(rhs + i)));
+                }
+
+                double parts[lanes];
+                store(parts, acc);
+
+                for (const double part : parts) {
+                    total += part;
+                }
+            }
+#endif
+
+            for (; i < n; i++) {
+                total += lhs[i] * rhs[i];
+            }
+
+            return total;
+        }
+
+        template <typename T>
+        void add_packed(T *data, const size_t n, const T val) {
+            size_t i = 0;
+
+#ifdef SNACK_VECTOR_LANES
+            const auto vals = splat(val);
+
+            for (; i + lanes <= n; i += lanes) {
+                store(data + i, add(load(data + i), vals));
+            }
+#endif
+
+            for (; i < n; i++) {
+                data[i] = plus(data[i], val);
+            }
+        }
+
+        // Index of the first match, n if there is none
+        template <typename T>
+        size_t find_packed(const T *data, const size_t n, const T val) {
+            size_t i = 0;
+
+#ifdef SNACK_VECTOR_LANES
+            const auto vals = splat(val);
+
+            for (; i + lanes <= n; i += lanes) {
+                const int mask = equal_mask(load(data + i), vals);
+
+                if (mask) {
+                    size_t lane = 0;
+
+                    while (!(mask & (1 << lane))) {
+                        lane++;
+                    }
+
+                    return i + lane;
+                }
+            }
+#endif
+
+            for (; i < n; i++) {
+                if (data[i] == val) {
+                    return i;
+                }
+            }
+
+            return n;
+        }
+
+        template <typename T>
+        int64_t count_packed(const T *data, const size_t n, const T val) {
+            int64_t total = 0;
+            size_t i = 0;
+
+#ifdef SNACK_VECTOR_LANES
+            const auto vals = splat(val);
+
+            for (; i + lanes <= n; i += lanes) {
+                for (int mask = equal_mask(load(data + i), vals); mask; mask &= mask - 1) {
+                    total++;
+                }
+            }
+#endif
+
+            for (; i < n; i++) {
+                total += (data[i] == val);
+            }
+
+            return total;
+        }
+
+        // Number arithmetic and comparisons as the operators do them: two integers stay exact, anything else
+        // goes through doubles
+        ir_element add_numbers(const ir_element &lhs, const ir_element &rhs) {
+            if (lhs.type == ir_element::integer && rhs.type == ir_element::integer) {
+                return plus(lhs.int_data, rhs.int_data);
+            }
+
+            return lhs.get_number() + rhs.get_number();
+        }
+
+        ir_element mul_numbers(const ir_element &lhs, const ir_element &rhs) {
+            if (lhs.type == ir_element::integer && rhs.type == ir_element::integer) {
+                return times(lhs.int_data, rhs.int_data);
+            }
+
+            return lhs.get_number() * rhs.get_number();
+        }
+
+        bool is_less(const ir_element &lhs, const ir_element &rhs) {
+            if (lhs.type == ir_element::integer && rhs.type == ir_element::integer) {
+                return lhs.int_data < rhs.int_data;
+            }
+
+            return lhs.get_number() < rhs.get_number();
+        }
+
+        bool is_equal(const ir_element &lhs, const ir_element &rhs) {
+            if (lhs.type == ir_element::integer && rhs.type == ir_element::integer) {
+                return lhs.int_data == rhs.int_data;
+            }
+
+            return lhs.get_number() == rhs.get_number();
+        }
+
+        ir_array *get_array(ir::backend::ir_interpreter_func_context &context, const ir_element &el) {
+            return (el.type == ir_element::ref) ? context.ref_manager->find_array(el.ref_id) : nullptr;
+        }
+
+        // Scans what find and count can't do packed, -1 for find when nothing matches
+        int64_t scan_equal(ir_array *arr, const ir_element &val, const bool first_only) {
+            int64_t total = 0;
+
+            for (size_t i = 0; i < arr->get_array_length(); i++) {
+                const ir_element el = arr->get_element(i);
+
+                if (el.is_number() && is_equal(el, val)) {
+                    if (first_only) {
+                        return static_cast<int64_t>(i);
+                    }
+
+                    total++;
+                }
+            }
+
+            return first_only ? -1 : total;
+        }
+
+        ir_element get_extreme(ir::backend::ir_interpreter_func_context &context, const ir_element &arr,
+            const bool want_max) {
+            ir_array *target = get_array(context, arr);
+
+            if (!target || !target->get_array_length()) {
+                return ir_element();
+            }
+
+            switch (target->get_storage()) {
+            case ir_array_storage::integers:
+                return extreme_packed(target->get_integers(), target->get_array_length(), want_max);
+
+            case ir_array_storage::numbers:
+                return extreme_packed(target->get_numbers(), target->get_array_length(), want_max);
+
+            default: {
+                ir_element best;
+
+                for (size_t i = 0; i < target->get_array_length(); i++) {
+                    ir_element el = target->get_element(i);
+
+                    if (el.is_number() && (!best.is_number() || (want_max ? is_less(best, el) : is_less(el, best)))) {
+                        best = std::move(el);
+                    }
+                }
+
+                return best;
+            }
+            }
+        }
+    }
+
+    ir::backend::ir_element std_unit::sum(ir::backend::ir_interpreter_func_context &context,
+        const ir::backend::ir_element &arr) {
+        ir_array *target = get_array(context, arr);
+
+        if (!target) {
+            return ir_element();
+        }
+
+        switch (target->get_storage()) {
+        case ir_array_storage::integers:
+            return sum_packed(target->get_integers(), target->get_array_length());
+
+        case ir_array_storage::numbers:
+            return sum_packed(target->get_numbers(), target->get_array_length());
+
+        default: {
+            ir_element total = int64_t(0);
+
+            for (size_t i = 0; i < target->get_array_length(); i++) {
+                const ir_element el = target->get_element(i);
+
+                if (el.is_number()) {
+                    total = add_numbers(total, el);
+                }
+            }
+
+            return total;
+        }
+        }
+    }
+
+    ir::backend::ir_element std_unit::min(ir::backend::ir_interpreter_func_context &context,
+        const ir::backend::ir_element &arr) {
+        return get_extreme(context, arr, false);
+    }
+
+    ir::backend::ir_element std_unit::max(ir::backend::ir_interpreter_func_context &context,
+        const ir::backend::ir_element &arr) {
+        return get_extreme(context, arr, true);
+    }
+
+    ir::backend::ir_element std_unit::dot(ir::backend::ir_interpreter_func_context &context,
+        const ir::backend::ir_element &lhs, const ir::backend::ir_element &rhs) {
+        ir_array *left = get_array(context, lhs);
+        ir_array *right = get_array(context, rhs);
+
+        if (!left || !right) {
+            return ir_element();
+        }
+
+        const size_t n = std::min(left->get_array_length(), right->get_array_length());
+
+        if (left->get_storage() == right->get_storage()) {
+            switch (left->get_storage()) {
+            case ir_array_storage::integers:
+                return dot_packed(left->get_integers(), right->get_integers(), n);
+
+            case ir_array_storage::numbers:
+                return dot_packed(left->get_numbers(), right->get_numbers(), n);
+
+            default:
+                break;
+            }
+        }
+
+        ir_element total = int64_t(0);
+
+        for (size_t i = 0; i < n; i++) {
+            const ir_element left_el = left->get_element(i);
+            const ir_element right_el = right->get_element(i);
+
+            if (left_el.is_number() && right_el.is_number()) {
+                total = add_numbers(total, mul_numbers(left_el, right_el));
+            }
+        }
+
+        return total;
+    }
+
+    int64_t std_unit::find(ir::backend::ir_interpreter_func_context &context, const ir::backend::ir_element &arr,
+        const ir::backend::ir_element &val) {
+        ir_array *target = get_array(context, arr);
+
+        if (!target || !val.is_number()) {
+            return -1;
+        }
+
+        const size_t n = target->get_array_length();
+        size_t idx = n;
+
+        // An integer array searched for a double compares through doubles, element by element
+        if (target->get_storage() == ir_array_storage::integers && val.type == ir_element::integer) {
+            idx = find_packed(target->get_integers(), n, val.int_data);
+        } else if (target->get_storage() == ir_array_storage::numbers) {
+            idx = find_packed(target->get_numbers(), n, val.get_number());
+        } else {
+            return scan_equal(target, val, true);
+        }
+
+        return (idx == n) ? -1 : static_cast<int64_t>(idx);
+    }
+
+    int64_t std_unit::count(ir::backend::ir_interpreter_func_context &context, const ir::backend::ir_element &arr,
+        const ir::backend::ir_element &val) {
+        ir_array *target = get_array(context, arr);
+
+        if (!target || !val.is_number()) {
+            return 0;
+        }
+
+        if (target->get_storage() == ir_array_storage::integers && val.type == ir_element::integer) {
+            return count_packed(target->get_integers(), target->get_array_length(), val.int_data);
+        }
+
+        if (target->get_storage() == ir_array_storage::numbers) {
+            return count_packed(target->get_numbers(), target->get_array_length(), val.get_number());
+        }
+
+        return scan_equal(target, val, false);
+    }
+
+    void std_unit::fill(ir::backend::ir_interpreter_func_context &context, const ir::backend::ir_element &arr,
+        const ir::backend::ir_element &val) {
+        ir_array *target = get_array(context, arr);
+
+        if (!target) {
+            return;
+        }
+
+        const size_t n = target->get_array_length();
+
+        // A packed element takes a number of its own type, anything else but a number resets it to zero
+        switch (target->get_storage()) {
+        case ir_array_storage::integers:
+            if (val.type != ir_element::num) {
+                std::fill_n(target->get_integers(), n, (val.type == ir_element::integer) ? val.int_data : 0);
+                return;
+            }
+
+            break;
+
+        case ir_array_storage::numbers:
+            if (val.type != ir_element::integer) {
+                std::fill_n(target->get_numbers(), n, (val.type == ir_element::num) ? val.num_data : 0.0);
+                return;
+            }
+
+            break;
+
+        default:
+            break;
+        }
+
+        context.ref_manager->write_barrier(target, val);
+
+        for (size_t i = 0; i < n; i++) {
+            target->store_element(i, ir_element(val));
+        }
+    }
+
+    void std_unit::copy(ir::backend::ir_interpreter_func_context &context, const ir::backend::ir_element &dst,
+        const ir::backend::ir_element &src) {
+        ir_array *target = get_array(context, dst);
+        ir_array *source = get_array(context, src);
+
+        if (!target || !source || target == source) {
+            return;
+        }
+
+        const size_t n = source->get_array_length();
+        size_t i = 0;
+
+        // Same packed storage: the part both have is copied as is, the rest is appended
+        if (target->get_storage() == source->get_storage() && target->get_storage() != ir_array_storage::generic) {
+            i = std::min(n, target->get_array_length());
+
+            if (target->get_storage() == ir_array_storage::integers) {
+                std::memcpy(target->get_integers(), source->get_integers(), i * sizeof(int64_t));
+            } else {
+                std::memcpy(target->get_numbers(), source->get_numbers(), i * sizeof(double));
+            }
+        }
+
+        for (; i < n; i++) {
+            ir_element el = source->get_element(i);
+
+            context.ref_manager->write_barrier(target, el);
+            target->store_element(i, std::move(el));
+        }
+    }
+
+    void std_unit::add_scalar(ir::backend::ir_interpreter_func_context &context, const ir::backend::ir_element &arr,
+        const ir::backend::ir_element &val) {
+        ir_array *target = get_array(context, arr);
+
+        if (!target || !val.is_number()) {
+            return;
+        }
+
+        const size_t n = target->get_array_length();
+
+        // Adding a double to integers makes them doubles, which goes through the elements one by one
+        if (target->get_storage() == ir_array_storage::integers && val.type == ir_element::integer) {
+            add_packed(target->get_integers(), n, val.int_data);
+            return;
+        }
+
+        if (target->get_storage() == ir_array_storage::numbers) {
+            add_packed(target->get_numbers(), n, val.get_number());
+            return;
+        }
+
+        for (size_t i = 0; i < n; i++) {
+            const ir_element el = target->get_element(i);
+
+            if (el.is_number()) {
+                target->store_element(i, add_numbers(el, val));
+            }
+        }
+    }
+}
@@ -7,7 +7,8 @@ namespace fs = std::experimental::filesystem;
 
 namespace snack::userspace {
     unit_manager::unit_manager(snack::error_manager &mngr, const bool import_default_external)
-        : err_mngr(&mngr) {
+        : generation(1)
+        , err_mngr(&mngr) {
         if (import_default_external) {
             init_builtin(this);
         }
@@ -41,6 +42,8 @@ namespace snack::userspace {
     }
 
     unit_ptr unit_manager::use_unit(const std::string &unit) {
+        std::lock_guard<std::mutex> guard(units_lock);
+
         if (units.find(unit) != units.end()) {
             return units[unit];
         }
@@ -68,10 +71,22 @@ namespace snack::userspace {
     }
 
     void unit_manager::add_external_unit(unit_ptr unit) {
+        std::lock_guard<std::mutex> guard(units_lock);
         units.emplace(unit->get_unit_name(), std::move(unit));
     }
 
+    void unit_manager::replace_unit(unit_ptr unit) {
+        const std::string name = unit->get_unit_name();
+        std::lock_guard<std::mutex> guard(units_lock);
+
+        // Running frames of the old unit and its loaded buffer stay valid, only new calls move over
+        units[name] = std::move(unit);
+
+        generation.fetch_add(1, std::memory_order_release);
+    }
+
     void unit_manager::add_search_path(const std::string &path) {
+        std::lock_guard<std::mutex> guard(units_lock);
         search_paths.push_back(path);
     }
 
@@ -0,0 +1,116 @@
+#include "script_runner.h"
+
+#include <snack/unit.h>
+
+#include <vector>
+
+// Lets the script hand references to the host while the invocation runs
+class probe_unit : public snack::userspace::external_unit {
+    void note(snack::ir::backend::ir_interpreter_func_context &context, const snack::ir::backend::ir_element &el) {
+        noted.push_back(el.ref_id);
+
+        // Freed with the arena, so not shared with the host
+        if (context.ref_manager->get_obj(el.ref_id) || !context.ref_manager->find_obj(el.ref_id)) {
+            shared_arena_object = true;
+        }
+    }
+
+    void hold(snack::ir::backend::ir_interpreter_func_context &context, const snack::ir::backend::ir_element &el) {
+        context.interpreter->pin(el);
+        note(context, el);
+    }
+
+public:
+    std::vector<uint64_t> noted;
+    bool shared_arena_object = false;
+
+    explicit probe_unit()
+        : external_unit("probe") {
+        bind<&probe_unit::note>("note");
+        bind<&probe_unit::hold>("hold");
+    }
+};
+
+const char *test_script = {
+    "uses probe\n"
+    "\n"
+    "fn main(h):\n"
+    "    var kept = new array(0)\n"
+    "    kept[0] = 1\n"
+    "    var pinned = new array(0)\n"
+    "    pinned[0] = 2\n"
+    "    hold(pinned)\n"
+    "    var stored = new array(0)\n"
+    "    stored[0] = 3\n"
+    "    h[0] = stored\n"
+    "    var junk = new array(0)\n"
+    "    junk[0] = kept\n"
+    "    note(junk)\n"
+    "    ret kept\n"
+    "\n"
+};
+
+// Promoted to the heap under the same reference
+static bool expect_promoted(snack::ir::backend::ir_interpreter_ref_manager &ref_manager, const char *what,
+    const uint64_t id, const int64_t first) {
+    snack::ir::backend::ir_array *arr = ref_manager.find_array(id);
+
+    if (!arr || !ref_manager.get_obj(id)) {
+        std::cout << what << " was not promoted" << std::endl;
+        return false;
+    }
+
+    return expect_integer(what, arr->get_element(0), first);
+}
+
+int main() {
+    std::shared_ptr<probe_unit> probe = std::make_shared<probe_unit>();
+    script_runner runner(test_script, { probe });
+
+    if (!runner.compiled()) {
+        return 1;
+    }
+
+    snack::ir::backend::ir_interpreter interpreter(runner.err_mngr, runner.manager);
+    snack::ir::backend::ir_interpreter_ref_manager &ref_manager = *interpreter.get_ref_manager();
+
+    // Made outside of an invocation, on the heap
+    snack::ir::backend::ir_element heap;
+    heap.type = snack::ir::backend::ir_element::ref;
+    heap.ref_id = ref_manager.make_new_array();
+
+    interpreter.pin(heap);
+    interpreter.set_arena_mode(true);
+
+    if (!interpreter.call_from_host(runner.entry("main", 1), { heap })
+        || interpreter.interpret_for(100000) != snack::ir::backend::ir_run_status::finished) {
+        std::cout << "main did not finish" << std::endl;
+        return 1;
+    }
+
+    if (probe->noted.size() != 2 || probe->shared_arena_object) {
+        std::cout << "get_obj shared an arena object" << std::endl;
+        return 1;
+    }
+
+    const snack::ir::backend::ir_element result = interpreter.take_result();
+    const snack::ir::backend::ir_element stored = ref_manager.find_array(heap.ref_id)->get_element(0);
+
+    if (!expect_promoted(ref_manager, "result", result.ref_id, 1) || !expect_promoted(ref_manager, "pinned", probe->noted[0], 2)
+        || !expect_promoted(ref_manager, "stored into the heap", stored.ref_id, 3)) {
+        return 1;
+    }
+
+    // Reached by nothing, gone with the arena
+    if (ref_manager.find_obj(probe->noted[1])) {
+        std::cout << "junk outlived the arena" << std::endl;
+        return 1;
+    }
+
+    if (ref_manager.get_object_count() != 4) {
+        std::cout << "Expected 4 objects, got " << ref_manager.get_object_count() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,81 @@
+#include "script_runner.h"
+
+const char *test_script = {
+    "uses std\n"
+    "\n"
+    "fn gen(n):\n"
+    "    for var i = 0; i < n; i+=1:\n"
+    "        yield i * 10\n"
+    "    ret 7\n"
+    "\n"
+    "fn main:\n"
+    "    var co = coroutine('gen', 3)\n"
+    "    var before = alive(co)\n"
+    "    var s = 0\n"
+    "    for var i = 0; i < 4; i+=1:\n"
+    "        var v = resume(co)\n"
+    "        s = s * 100 + v\n"
+    "    var after = alive(co)\n"
+    "    ret s * 100 + before * 10 + after\n"
+    "\n"
+    "fn resume_dead:\n"
+    "    var co = coroutine('gen', 0)\n"
+    "    var last = resume(co)\n"
+    "    var again = resume(co)\n"
+    "    ret again\n"
+    "\n"
+};
+
+static snack::ir::backend::ir_element run(script_runner &runner, snack::ir::backend::ir_interpreter &interpreter,
+    const char *name) {
+    runner.call(interpreter, name);
+    interpreter.interpret_for(100000);
+
+    return interpreter.take_result();
+}
+
+int main() {
+    script_runner runner(test_script);
+
+    if (!runner.compiled()) {
+        return 1;
+    }
+
+    snack::ir::backend::ir_interpreter interpreter(runner.err_mngr, runner.manager);
+
+    // Yields 0, 10 and 20, then returns 7. Alive before, not after.
+    if (!expect_integer("main", run(runner, interpreter, "main"), 10200710)) {
+        return 1;
+    }
+
+    // A finished coroutine gives none
+    if (run(runner, interpreter, "resume_dead").type != snack::ir::backend::ir_element::none) {
+        std::cout << "Resuming a dead coroutine from the script gave a value" << std::endl;
+        return 1;
+    }
+
+    // Same from the host
+    const snack::ir::backend::ir_element co = interpreter.create_coroutine(runner.entry("gen", 1),
+        { snack::ir::backend::ir_element(int64_t(2)) });
+
+    const int64_t expected[] = { 0, 10, 7 };
+
+    for (const int64_t value : expected) {
+        if (!expect_integer("resumed from the host", interpreter.resume(co), value)) {
+            return 1;
+        }
+    }
+
+    if (interpreter.resume(co).type != snack::ir::backend::ir_element::none) {
+        std::cout << "Resuming a dead coroutine from the host gave a value" << std::endl;
+        return 1;
+    }
+
+    // None of it is an error
+    if (runner.err_mngr.get_total_error()) {
+        runner.err_mngr.dump_all_error();
+        return 1;
+    }
+
+    return 0;
+}
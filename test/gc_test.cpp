@@ -0,0 +1,115 @@
+#include "script_runner.h"
+
+// holder keeps its array only on its own stack while suspended, churn makes garbage and keeps a
+// chain of cells alive through one array
+const char *test_script = {
+    "uses std\n"
+    "\n"
+    "fn holder(n):\n"
+    "    var a = new array()\n"
+    "    for var i = 0; i < n; i+=1:\n"
+    "        a[i] = i\n"
+    "    yield 0\n"
+    "    var s = 0\n"
+    "    for var j = 0; j < n; j+=1:\n"
+    "        s = s + a[j]\n"
+    "    ret s\n"
+    "\n"
+    "fn churn(n):\n"
+    "    var keep = new array()\n"
+    "    for var i = 0; i < n; i+=1:\n"
+    "        var junk = new array()\n"
+    "        junk[0] = i\n"
+    "        var cell = new array()\n"
+    "        cell[0] = i\n"
+    "        keep[i] = cell\n"
+    "    var s = 0\n"
+    "    for var j = 0; j < n; j+=1:\n"
+    "        var c = keep[j]\n"
+    "        s = s + c[0]\n"
+    "    ret s\n"
+    "\n"
+    "fn main:\n"
+    "    var co = coroutine('holder', 50)\n"
+    "    var first = resume(co)\n"
+    "    var t = churn(300)\n"
+    "    var rest = resume(co)\n"
+    "    ret first + t + rest\n"
+    "\n"
+};
+
+// Sum of 0..299 and of 0..49
+constexpr int64_t expected = 44850 + 1225;
+
+int main() {
+    script_runner runner(test_script);
+
+    if (!runner.compiled()) {
+        return 1;
+    }
+
+    snack::ir::backend::ir_interpreter interpreter(runner.err_mngr, runner.manager);
+    snack::ir::backend::ir_interpreter_ref_manager &ref_manager = *interpreter.get_ref_manager();
+
+    // Reached only through a pin: the pinned array holds the only reference to child
+    snack::ir::backend::ir_element pinned;
+    pinned.type = snack::ir::backend::ir_element::ref;
+    pinned.ref_id = ref_manager.make_new_array();
+
+    snack::ir::backend::ir_element child;
+    child.type = snack::ir::backend::ir_element::ref;
+    child.ref_id = ref_manager.make_new_array();
+
+    ref_manager.find_array(child.ref_id)->store_element(0, snack::ir::backend::ir_element(int64_t(7)));
+    ref_manager.find_array(pinned.ref_id)->store_element(0, snack::ir::backend::ir_element(child));
+
+    interpreter.pin(pinned);
+
+    // The script runs steps of its own too, once a few objects are alive
+    interpreter.set_gc_threshold(8);
+
+    runner.call(interpreter, "main");
+
+    // One step of work between every few instructions, so collections go on while the script
+    // allocates, marking and sweeping alike
+    size_t collections = 0;
+
+    while (interpreter.interpret_for(20) == snack::ir::backend::ir_run_status::suspended) {
+        collections += interpreter.collect_step(1) ? 1 : 0;
+    }
+
+    if (!expect_integer("main", interpreter.take_result(), expected)) {
+        return 1;
+    }
+
+    if (collections < 2) {
+        std::cout << "Only " << collections << " collections finished while running" << std::endl;
+        return 1;
+    }
+
+    snack::ir::backend::ir_array *kept = ref_manager.find_array(pinned.ref_id);
+    snack::ir::backend::ir_array *kept_child = kept ? ref_manager.find_array(kept->get_element(0).ref_id) : nullptr;
+
+    if (!kept_child || !expect_integer("child of the pinned array", kept_child->get_element(0), 7)) {
+        std::cout << "The pinned array or its child was freed" << std::endl;
+        return 1;
+    }
+
+    // Everything the script made is garbage now
+    interpreter.collect();
+
+    if (ref_manager.get_object_count() != 2) {
+        std::cout << "Expected 2 objects left, got " << ref_manager.get_object_count() << std::endl;
+        return 1;
+    }
+
+    interpreter.unpin(pinned);
+    interpreter.collect();
+
+    if (ref_manager.get_object_count() != 0) {
+        std::cout << "Expected nothing left once unpinned, got " << ref_manager.get_object_count() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,136 @@
+#include "script_runner.h"
+
+#include <cstring>
+#include <utility>
+#include <vector>
+
+// Integers and doubles mixed, branches, calls, and array loads and stores. Traces of the later loops
+// leave through their guards: mix takes the other branch at 700, widen turns the sum into a double at
+// 800, and the loop of total, traced on an integer array, gets a double one and then runs past the end.
+const char *test_script = {
+    "fn mix(n):\n"
+    "    var s = 0\n"
+    "    var d = 0.5\n"
+    "    for var i = 0; i < n; i+=1:\n"
+    "        if i < 700:\n"
+    "            s = s + i * 3\n"
+    "        if i >= 700:\n"
+    "            s = s - i\n"
+    "        d = d + 1.5\n"
+    "    ret s + d\n"
+    "\n"
+    "fn callee(x):\n"
+    "    ret x * 2 + 1\n"
+    "\n"
+    "fn calls(n):\n"
+    "    var s = 0\n"
+    "    for var i = 0; i < n; i+=1:\n"
+    "        s = s + callee(i)\n"
+    "    ret s\n"
+    "\n"
+    "fn arrays(n):\n"
+    "    var a = new array()\n"
+    "    for var i = 0; i < n; i+=1:\n"
+    "        a[i] = i\n"
+    "    var s = 0\n"
+    "    for var j = 0; j < n; j+=1:\n"
+    "        s = s + a[j]\n"
+    "    a[n - 300] = 2.5\n"
+    "    for var k = 0; k < n; k+=1:\n"
+    "        s = s + a[k]\n"
+    "    ret s\n"
+    "\n"
+    "fn widen(n):\n"
+    "    var s = 0\n"
+    "    for var i = 0; i < n; i+=1:\n"
+    "        if i == 800:\n"
+    "            s = s + 0.25\n"
+    "        s = s + i\n"
+    "    ret s\n"
+    "\n"
+    "fn total(a, n):\n"
+    "    var s = 0\n"
+    "    for var i = 0; i < n; i+=1:\n"
+    "        s = s + a[i]\n"
+    "    ret s\n"
+    "\n"
+    "fn sums(n):\n"
+    "    var ints = new array()\n"
+    "    var nums = new array()\n"
+    "    for var i = 0; i < n; i+=1:\n"
+    "        ints[i] = i\n"
+    "        nums[i] = i * 0.5\n"
+    "    var x = total(ints, n)\n"
+    "    var y = total(nums, n)\n"
+    "    var z = total(ints, n + 5)\n"
+    "    ret x + y + z\n"
+    "\n"
+};
+
+const std::pair<const char *, snack::ir::backend::ir_jit_mode> modes[] = {
+    { "on", snack::ir::backend::ir_jit_mode::on },
+    { "tracing", snack::ir::backend::ir_jit_mode::tracing },
+    { "differential", snack::ir::backend::ir_jit_mode::differential }
+};
+
+// What the interpreter gives on its own
+const std::pair<const char *, double> functions[] = {
+    { "mix", 480600.5 },
+    { "calls", 1000000 },
+    { "arrays", 998302.5 },
+    { "widen", 499500.25 },
+    { "sums", 1248750 }
+};
+
+static snack::ir::backend::ir_element run(script_runner &runner, const char *name,
+    const snack::ir::backend::ir_jit_mode mode) {
+    snack::ir::backend::ir_interpreter interpreter(runner.err_mngr, runner.manager);
+
+    // Compiled after a couple of calls or back edges, so most of the work runs native
+    interpreter.set_jit_mode(mode, 2);
+    interpreter.call_from_host(runner.entry(name, 1), { snack::ir::backend::ir_element(int64_t(1000)) });
+    interpreter.interpret_for(10000000);
+
+    return interpreter.take_result();
+}
+
+static bool is_same(const snack::ir::backend::ir_element &lhs, const snack::ir::backend::ir_element &rhs) {
+    return lhs.type == rhs.type && std::memcmp(&lhs.int_data, &rhs.int_data, sizeof(int64_t)) == 0;
+}
+
+int main() {
+    script_runner runner(test_script);
+
+    if (!runner.compiled()) {
+        return 1;
+    }
+
+    for (const auto &function : functions) {
+        const char *name = function.first;
+        const snack::ir::backend::ir_element expected = run(runner, name, snack::ir::backend::ir_jit_mode::off);
+
+        if (expected.get_number() != function.second) {
+            std::cout << name << " without the JIT: expected " << function.second << ", got " << expected.get_number()
+                      << std::endl;
+            return 1;
+        }
+
+        for (const auto &mode : modes) {
+            const snack::ir::backend::ir_element result = run(runner, name, mode.second);
+
+            if (!is_same(result, expected)) {
+                std::cout << name << " with the JIT " << mode.first << ": expected " << expected.get_number() << ", got "
+                          << result.get_number() << std::endl;
+                return 1;
+            }
+        }
+    }
+
+    // Native code and the interpreter disagreeing is reported in differential mode
+    if (runner.err_mngr.get_total_error()) {
+        runner.err_mngr.dump_all_error();
+        return 1;
+    }
+
+    return 0;
+}
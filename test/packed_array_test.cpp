@@ -0,0 +1,148 @@
+#include "script_runner.h"
+
+using snack::ir::backend::ir_array;
+using snack::ir::backend::ir_array_storage;
+using snack::ir::backend::ir_element;
+
+const char *test_script = {
+    "fn build(n):\n"
+    "    var a = new array()\n"
+    "    for var i = 0; i < n; i+=1:\n"
+    "        a[i] = i\n"
+    "    ret a\n"
+    "\n"
+    "fn build_mixed(n):\n"
+    "    var a = build(n)\n"
+    "    a[3] = 2.5\n"
+    "    ret a\n"
+    "\n"
+};
+
+static bool expect_storage(const char *what, const ir_array &arr, const ir_array_storage storage, const size_t length) {
+    if (arr.get_storage() != storage || arr.get_array_length() != length) {
+        std::cout << what << ": expected storage " << static_cast<int>(storage) << " of " << length << ", got "
+                  << static_cast<int>(arr.get_storage()) << " of " << arr.get_array_length() << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+static bool expect_number(const char *what, const ir_element &el, const double expected) {
+    if (el.type != ir_element::num || el.num_data != expected) {
+        std::cout << what << ": expected " << expected << ", got " << el.get_number() << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+static ir_array make_integers(const size_t length) {
+    ir_array arr;
+
+    for (size_t i = 0; i < length; i++) {
+        arr.store_element(i, ir_element(static_cast<int64_t>(i)));
+    }
+
+    return arr;
+}
+
+int main() {
+    // Appending integers keeps them packed
+    ir_array ints = make_integers(5);
+
+    if (!expect_storage("integers", ints, ir_array_storage::integers, 5)) {
+        return 1;
+    }
+
+    // A string stored over an element of a packed array resets it to zero, the array stays packed
+    ints.store_element(2, ir_element(std::string("x")));
+
+    if (!expect_storage("string over an integer", ints, ir_array_storage::integers, 5)
+        || !expect_integer("string over an integer", ints.get_element(2), 0)) {
+        return 1;
+    }
+
+    // A double goes generic, keeping the other integers as they are
+    ints.store_element(1, ir_element(1.5));
+
+    if (!expect_storage("double over an integer", ints, ir_array_storage::generic, 5)
+        || !expect_number("double over an integer", ints.get_element(1), 1.5)
+        || !expect_integer("kept integer", ints.get_element(4), 4)) {
+        return 1;
+    }
+
+    // For good, integers alone don't pack it again
+    ints.store_element(1, ir_element(int64_t(1)));
+
+    if (!expect_storage("integer back", ints, ir_array_storage::generic, 5)) {
+        return 1;
+    }
+
+    // A double first packs doubles, an integer appended goes generic
+    ir_array nums;
+    nums.store_element(0, ir_element(0.5));
+    nums.store_element(1, ir_element(1.5));
+
+    if (!expect_storage("doubles", nums, ir_array_storage::numbers, 2)) {
+        return 1;
+    }
+
+    nums.store_element(2, ir_element(int64_t(2)));
+
+    if (!expect_storage("integer after doubles", nums, ir_array_storage::generic, 3)
+        || !expect_number("kept double", nums.get_element(1), 1.5) || !expect_integer("appended", nums.get_element(2), 2)) {
+        return 1;
+    }
+
+    // A gap goes generic, the elements in between are none
+    ir_array gap = make_integers(2);
+    gap.store_element(4, ir_element(int64_t(4)));
+
+    if (!expect_storage("gap", gap, ir_array_storage::generic, 5)) {
+        return 1;
+    }
+
+    if (gap.get_element(3).type != ir_element::none) {
+        std::cout << "The gap is not none" << std::endl;
+        return 1;
+    }
+
+    // So does appending a string
+    ir_array strings = make_integers(2);
+    strings.store_element(2, ir_element(std::string("x")));
+
+    if (!expect_storage("appended string", strings, ir_array_storage::generic, 3)
+        || strings.get_element(2).get_string() != "x") {
+        return 1;
+    }
+
+    // Same through the interpreter
+    script_runner runner(test_script);
+
+    if (!runner.compiled()) {
+        return 1;
+    }
+
+    snack::ir::backend::ir_interpreter interpreter(runner.err_mngr, runner.manager);
+
+    for (const bool mixed : { false, true }) {
+        interpreter.call_from_host(runner.entry(mixed ? "build_mixed" : "build", 1), { ir_element(int64_t(100)) });
+        interpreter.interpret_for(100000);
+
+        const ir_element result = interpreter.take_result();
+        const ir_array_storage storage = mixed ? ir_array_storage::generic : ir_array_storage::integers;
+        ir_array *arr = interpreter.get_ref_manager()->find_array(result.ref_id);
+
+        if (!arr || !expect_storage(mixed ? "build_mixed" : "build", *arr, storage, 100)
+            || !expect_integer("last element", arr->get_element(99), 99)) {
+            return 1;
+        }
+
+        if (mixed && !expect_number("stored double", arr->get_element(3), 2.5)) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,105 @@
+#include "script_runner.h"
+
+#include <snack/ir_opcode.h>
+
+#include <vector>
+
+const char *test_script = {
+    "fn add(a, b):\n"
+    "    ret a + b\n"
+    "\n"
+};
+
+// Number forms in the copy of the code an interpreter runs
+static size_t count_quickened(const std::vector<snack::ir::backend::ir_instruction> &code) {
+    size_t count = 0;
+
+    for (const snack::ir::backend::ir_instruction &inst : code) {
+        count += snack::ir::is_quickened_op(inst.op) ? 1 : 0;
+    }
+
+    return count;
+}
+
+// Generic adds marked never to quicken again, see ir_never_quicken
+static size_t count_never_quickened(const std::vector<snack::ir::backend::ir_instruction> &code) {
+    size_t count = 0;
+
+    for (const snack::ir::backend::ir_instruction &inst : code) {
+        count += (inst.op == snack::ir::opcode::add && inst.short_operand == 1) ? 1 : 0;
+    }
+
+    return count;
+}
+
+static snack::ir::backend::ir_element run(script_runner &runner, snack::ir::backend::ir_interpreter &interpreter,
+    snack::ir::backend::ir_element &&lhs, snack::ir::backend::ir_element &&rhs) {
+    interpreter.call_from_host(runner.entry("add", 2), { lhs, rhs });
+    interpreter.interpret_for(100000);
+
+    return interpreter.take_result();
+}
+
+int main() {
+    script_runner runner(test_script);
+
+    if (!runner.compiled()) {
+        return 1;
+    }
+
+    snack::ir::backend::ir_interpreter interpreter(runner.err_mngr, runner.manager);
+
+    // Two numbers turn the add into its number form
+    if (!expect_integer("1 + 2", run(runner, interpreter, int64_t(1), int64_t(2)), 3)) {
+        return 1;
+    }
+
+    // Copied the first time the interpreter entered the unit
+    const std::vector<snack::ir::backend::ir_instruction> &code = interpreter.get_unit_code(*runner.unit);
+
+    if (count_quickened(code) != 1) {
+        std::cout << "The add was not quickened" << std::endl;
+        return 1;
+    }
+
+    // Strings send it back to the generic form for good
+    const snack::ir::backend::ir_element joined = run(runner, interpreter, std::string("ab"), std::string("cd"));
+
+    if (joined.get_string() != "abcd") {
+        std::cout << "Expected abcd, got " << joined.get_string() << std::endl;
+        return 1;
+    }
+
+    if (count_quickened(code) != 0 || count_never_quickened(code) != 1) {
+        std::cout << "The add was not turned back for good" << std::endl;
+        return 1;
+    }
+
+    // Numbers again still get the right result, without quickening again
+    if (!expect_integer("2 + 5", run(runner, interpreter, int64_t(2), int64_t(5)), 7)) {
+        return 1;
+    }
+
+    if (count_quickened(code) != 0 || count_never_quickened(code) != 1) {
+        std::cout << "The add was quickened again" << std::endl;
+        return 1;
+    }
+
+    // The unit itself is never written, another interpreter quickens its own copy
+    snack::ir::backend::ir_interpreter other(runner.err_mngr, runner.manager);
+
+    const snack::ir::backend::ir_element sum = run(runner, other, 2.5, int64_t(1));
+    const std::vector<snack::ir::backend::ir_instruction> &other_code = other.get_unit_code(*runner.unit);
+
+    if (sum.type != snack::ir::backend::ir_element::num || sum.num_data != 3.5) {
+        std::cout << "Expected 3.5, got " << sum.get_number() << std::endl;
+        return 1;
+    }
+
+    if (count_quickened(other_code) != 1 || count_never_quickened(other_code) != 0) {
+        std::cout << "The other interpreter did not quicken its own copy" << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,100 @@
+#include "script_runner.h"
+
+#include <snack/ir_scheduler.h>
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+const char *test_script = {
+    "uses std\n"
+    "\n"
+    "fn work(n, s):\n"
+    "    var total = 0\n"
+    "    for var i = 0; i < n; i+=1:\n"
+    "        total = total + i\n"
+    "    ret total + length(s)\n"
+    "\n"
+    "fn echo(s):\n"
+    "    ret s\n"
+    "\n"
+    "fn deep(n):\n"
+    "    if n == 0:\n"
+    "        ret 0\n"
+    "    var r = deep(n - 1)\n"
+    "    ret r + 1\n"
+    "\n"
+};
+
+constexpr size_t job_count = 64;
+
+int main() {
+    script_runner runner(test_script);
+
+    if (!runner.compiled()) {
+        return 1;
+    }
+
+    snack::ir::backend::ir_scheduler scheduler(runner.err_mngr, runner.manager, 4);
+
+    // One string that is not interned, shared by every job
+    const snack::ir::backend::ir_element shared(std::string("four"));
+
+    std::vector<snack::ir::backend::ir_job> jobs;
+
+    for (size_t i = 0; i < job_count; i++) {
+        jobs.push_back({ runner.unit, *runner.unit->get_function_idx("work", 2), { int64_t(i * 100), shared } });
+    }
+
+    std::vector<std::future<snack::ir::backend::ir_element>> futures = scheduler.submit(std::move(jobs));
+    jobs.clear();
+
+    for (size_t i = 0; i < job_count; i++) {
+        const int64_t n = i * 100;
+
+        if (!expect_integer("future", futures[i].get(), n * (n - 1) / 2 + 4)) {
+            return 1;
+        }
+    }
+
+    // Callbacks run on the workers
+    std::vector<int64_t> echoed(job_count);
+    std::atomic<size_t> called{ 0 };
+
+    for (size_t i = 0; i < job_count; i++) {
+        jobs.push_back({ runner.unit, *runner.unit->get_function_idx("echo", 1), { shared } });
+    }
+
+    scheduler.submit(std::move(jobs), [&](const size_t index, snack::ir::backend::ir_element &&result) {
+        echoed[index] = (result.get_string() == "four") ? 1 : 0;
+        called++;
+    });
+
+    jobs.clear();
+
+    scheduler.wait_idle();
+
+    if (called != job_count || std::count(echoed.begin(), echoed.end(), 1) != job_count) {
+        std::cout << "Callbacks: " << called << " called, " << std::count(echoed.begin(), echoed.end(), 1)
+                  << " echoed the string" << std::endl;
+        return 1;
+    }
+
+    // Errors of every worker end up in the shared manager once the batch is done
+    const size_t errors_before = runner.err_mngr.get_total_error();
+
+    // Overflows the stack
+    for (size_t i = 0; i < 4; i++) {
+        jobs.push_back({ runner.unit, *runner.unit->get_function_idx("deep", 1), { int64_t(1000000) } });
+    }
+
+    scheduler.submit(std::move(jobs));
+    scheduler.wait_idle();
+
+    if (runner.err_mngr.get_total_error() == errors_before) {
+        std::cout << "Errors of the workers were not merged" << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <snack/ir_compiler.h>
+#include <snack/ir_interpreter.h>
+
+#include <snack/error.h>
+
+#include <snack/lexer.h>
+#include <snack/parser.h>
+
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/*! \brief Compiles a script into the unit "bim" and calls its functions on interpreters. */
+struct script_runner {
+    snack::error_manager err_mngr;
+    snack::userspace::unit_manager manager;
+
+    // The unit reads the binary in place
+    std::string binary;
+    snack::userspace::unit_ptr unit;
+
+    // Host units the script uses are added before it is compiled
+    explicit script_runner(const char *script, const std::vector<snack::userspace::unit_ptr> &host_units = {})
+        : manager(err_mngr) {
+        err_mngr.connect("stdio hole", snack::make_standard_stdio_hole());
+
+        for (const snack::userspace::unit_ptr &host_unit : host_units) {
+            manager.add_external_unit(host_unit);
+        }
+
+        std::istringstream stream;
+        stream.str(script);
+
+        snack::lexer lexer(err_mngr, stream);
+        snack::parser parser(err_mngr, lexer);
+
+        parser.parse();
+
+        snack::ir::backend::ir_compiler compiler(err_mngr, manager);
+        compiler.compile(parser.get_unit_node());
+
+        if (err_mngr.get_total_error()) {
+            err_mngr.dump_all_error();
+            return;
+        }
+
+        binary = compiler.get_compile_binary();
+
+        manager.add_external_unit(std::make_shared<snack::userspace::interpreted_unit>("bim", binary.data()));
+        unit = manager.use_unit("bim");
+    }
+
+    // Function entry the host can call or start a coroutine on
+    snack::ir::backend::ir_function_entry &entry(const std::string &name, const int argc) {
+        snack::ir::backend::ir_call_site site{};
+        unit->resolve_call(*unit->get_function_idx(name, argc), site);
+
+        return *site.script_func;
+    }
+
+    bool compiled() const {
+        return unit != nullptr;
+    }
+
+    // Enter a function from the host, run it with interpret_for
+    void call(snack::ir::backend::ir_interpreter &interpreter, const std::string &name, const int argc = 0) {
+        unit->call_function(&interpreter, *unit->get_function_idx(name, argc), nullptr);
+    }
+};
+
+inline bool expect_integer(const char *what, const snack::ir::backend::ir_element &result, const int64_t expected) {
+    if (result.type != snack::ir::backend::ir_element::integer || result.get_integer() != expected) {
+        std::cout << what << ": expected " << expected << ", got " << result.get_integer() << std::endl;
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,94 @@
+#include "script_runner.h"
+
+#include <vector>
+
+// Keeps an array and a coroutine alive across the point it is stopped at
+const char *test_script = {
+    "uses std\n"
+    "\n"
+    "fn gen(n):\n"
+    "    for var i = 0; i < n; i+=1:\n"
+    "        yield i\n"
+    "    ret 0\n"
+    "\n"
+    "fn main:\n"
+    "    var arr = new array(0)\n"
+    "    var co = coroutine('gen', 1000)\n"
+    "    var s = 0\n"
+    "    for var i = 0; i < 200; i+=1:\n"
+    "        arr[i] = i\n"
+    "        var v = resume(co)\n"
+    "        s = s + v\n"
+    "    for var j = 0; j < 200; j+=1:\n"
+    "        s = s + arr[j]\n"
+    "    ret s\n"
+    "\n"
+};
+
+// Sum of 0..199 twice
+constexpr int64_t expected = 39800;
+
+int main() {
+    script_runner runner(test_script);
+
+    if (!runner.compiled()) {
+        return 1;
+    }
+
+    snack::ir::backend::ir_interpreter interpreter(runner.err_mngr, runner.manager);
+
+    runner.call(interpreter, "main");
+
+    if (interpreter.interpret_for(2000) != snack::ir::backend::ir_run_status::suspended) {
+        std::cout << "Finished before the snapshot" << std::endl;
+        return 1;
+    }
+
+    std::vector<uint8_t> buffer(interpreter.snapshot(nullptr, 0));
+    interpreter.snapshot(buffer.data(), buffer.size());
+
+    // Frames point into the code of the interpreter that took it
+    {
+        snack::ir::backend::ir_interpreter other(runner.err_mngr, runner.manager);
+
+        if (other.restore(buffer.data(), buffer.size())) {
+            std::cout << "Restored the snapshot of another interpreter" << std::endl;
+            return 1;
+        }
+    }
+
+    // Cut short
+    if (interpreter.restore(buffer.data(), buffer.size() / 2)) {
+        std::cout << "Restored a truncated snapshot" << std::endl;
+        return 1;
+    }
+
+    // Objects read fine, the stacks after them don't
+    std::vector<uint8_t> corrupt = buffer;
+    std::fill(corrupt.end() - 256, corrupt.end(), 0xFF);
+
+    if (interpreter.restore(corrupt.data(), corrupt.size())) {
+        std::cout << "Restored a corrupt snapshot" << std::endl;
+        return 1;
+    }
+
+    // Neither touched what runs now
+    interpreter.interpret_for(1000000);
+
+    if (!expect_integer("after failed restores", interpreter.take_result(), expected)) {
+        return 1;
+    }
+
+    if (!interpreter.restore(buffer.data(), buffer.size())) {
+        std::cout << "Could not restore the snapshot" << std::endl;
+        return 1;
+    }
+
+    interpreter.interpret_for(1000000);
+
+    if (!expect_integer("after restore", interpreter.take_result(), expected)) {
+        return 1;
+    }
+
+    return 0;
+}
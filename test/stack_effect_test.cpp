@@ -0,0 +1,70 @@
+#include <snack/ir_compiler.h>
+#include <snack/ir_interpreter.h>
+
+#include <snack/error.h>
+
+#include <snack/lexer.h>
+#include <snack/parser.h>
+
+#include <iostream>
+#include <sstream>
+
+// Indexing something that is no array still leaves one value, the locals after it must stay intact
+const char *test_script = {
+    "fn main:\n"
+    "    var a = 5\n"
+    "    var i = 1\n"
+    "    var x = a[0]\n"
+    "    var k = 7\n"
+    "    var y = a[i]\n"
+    "    var cur = 3\n"
+    "    var n = 0\n"
+    "    for var j = 0; j < 4; j+=1:\n"
+    "        cur = cur[1]\n"
+    "        n = n + 1\n"
+    "    ret k * 10 + n\n"
+    "\n"
+};
+
+int main() {
+    std::istringstream stream;
+    stream.str(test_script);
+
+    snack::error_manager err_mngr{};
+    err_mngr.connect("stdio hole", snack::make_standard_stdio_hole());
+
+    snack::lexer lexer(err_mngr, stream);
+    snack::parser parser(err_mngr, lexer);
+
+    parser.parse();
+
+    snack::userspace::unit_manager manager(err_mngr);
+
+    snack::ir::backend::ir_compiler compiler(err_mngr, manager);
+    compiler.compile(parser.get_unit_node());
+
+    if (err_mngr.get_total_error()) {
+        err_mngr.dump_all_error();
+        return 1;
+    }
+
+    std::string res = compiler.get_compile_binary();
+
+    snack::ir::backend::ir_interpreter interpreter(err_mngr, manager);
+    manager.add_external_unit(std::make_shared<snack::userspace::interpreted_unit>("bim", res.data()));
+
+    snack::userspace::unit_ptr unit = manager.use_unit("bim");
+    unit->call_function(&interpreter, *unit->get_function_idx("main", 0), nullptr);
+
+    // Bounded, a frame reading below its stack never finishes the loop
+    interpreter.interpret_for(100000);
+
+    const snack::ir::backend::ir_element result = interpreter.take_result();
+
+    if (result.get_integer() != 74) {
+        std::cout << "Expected 74, got " << result.get_integer() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
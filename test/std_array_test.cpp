@@ -0,0 +1,244 @@
+#include "script_runner.h"
+
+#include <vector>
+
+using snack::ir::backend::ir_array;
+using snack::ir::backend::ir_array_storage;
+using snack::ir::backend::ir_element;
+
+const char *test_script = {
+    "uses std\n"
+    "\n"
+    "fn t_sum(a):\n"
+    "    ret sum(a)\n"
+    "\n"
+    "fn t_min(a):\n"
+    "    ret min(a)\n"
+    "\n"
+    "fn t_max(a):\n"
+    "    ret max(a)\n"
+    "\n"
+    "fn t_dot(a, b):\n"
+    "    ret dot(a, b)\n"
+    "\n"
+    "fn t_find(a, v):\n"
+    "    ret find(a, v)\n"
+    "\n"
+    "fn t_count(a, v):\n"
+    "    ret count(a, v)\n"
+    "\n"
+    "fn t_fill(a, v):\n"
+    "    fill(a, v)\n"
+    "    ret 0\n"
+    "\n"
+    "fn t_copy(a, b):\n"
+    "    copy(a, b)\n"
+    "    ret 0\n"
+    "\n"
+    "fn t_add_scalar(a, v):\n"
+    "    add_scalar(a, v)\n"
+    "    ret 0\n"
+    "\n"
+};
+
+// Past a few vector iterations of any width, every remainder included
+constexpr size_t max_length = 37;
+
+struct array_tester {
+    script_runner &runner;
+    snack::ir::backend::ir_interpreter interpreter;
+
+    // Packed doubles, or generic: the numbers followed by a string, which every function skips
+    bool doubles;
+    bool generic;
+
+    explicit array_tester(script_runner &runner, const bool doubles, const bool generic)
+        : runner(runner)
+        , interpreter(runner.err_mngr, runner.manager)
+        , doubles(doubles)
+        , generic(generic) {}
+
+    ir_element call(const char *name, std::vector<ir_element> &&args) {
+        interpreter.call_from_host(runner.entry(name, args.size()), args);
+        interpreter.interpret_for(1000000);
+
+        return interpreter.take_result();
+    }
+
+    // Small numbers with repeats and negatives, halves of them as doubles so any summing order is exact
+    ir_element value(const size_t idx) const {
+        const int64_t val = static_cast<int64_t>(idx * 7 % 11) - 5;
+        return doubles ? ir_element(val * 0.5) : ir_element(val);
+    }
+
+    ir_element make(const size_t length, const int64_t shift = 0, const bool packed = false) {
+        ir_element arr;
+        arr.type = ir_element::ref;
+        arr.ref_id = interpreter.get_ref_manager()->make_new_array();
+
+        ir_array *target = get_array(arr);
+
+        for (size_t i = 0; i < length; i++) {
+            target->store_element(i, ir_element(value(i + shift)));
+        }
+
+        if (generic && !packed) {
+            target->store_element(length, ir_element(std::string("x")));
+        }
+
+        return arr;
+    }
+
+    ir_array *get_array(const ir_element &arr) {
+        return interpreter.get_ref_manager()->find_array(arr.ref_id);
+    }
+
+    bool check(const char *what, const size_t length, const ir_element &result, const ir_element &expected) {
+        const bool same_number = result.is_number() && expected.is_number() && result.get_number() == expected.get_number();
+
+        if (result.type != expected.type || (expected.type != ir_element::none && !same_number)) {
+            std::cout << what << (doubles ? " on doubles" : " on integers") << (generic ? ", generic" : ", packed")
+                      << ", " << length << " long: expected " << expected.get_number() << ", got " << result.get_number()
+                      << std::endl;
+            return false;
+        }
+
+        return true;
+    }
+
+    // Every element against what the same loop gives in C++
+    bool check_elements(const char *what, const size_t length, const ir_element &arr, const ir_array_storage storage,
+        ir_element (*expected)(const array_tester &, size_t)) {
+        ir_array *target = get_array(arr);
+
+        // An empty array packs integers until its first double
+        if (length && target->get_storage() != storage) {
+            std::cout << what << ", " << length << " long: storage changed" << std::endl;
+            return false;
+        }
+
+        for (size_t i = 0; i < length; i++) {
+            if (!check(what, length, target->get_element(i), expected(*this, i))) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    bool run(const size_t length) {
+        const ir_array_storage storage = generic ? ir_array_storage::generic
+                                                 : (doubles ? ir_array_storage::numbers : ir_array_storage::integers);
+
+        ir_element total = doubles ? ir_element(0.0) : ir_element(int64_t(0));
+        ir_element squares = total;
+        ir_element low;
+        ir_element high;
+
+        for (size_t i = 0; i < length; i++) {
+            const double val = value(i).get_number();
+
+            total = doubles ? ir_element(total.get_number() + val) : ir_element(total.get_integer() + value(i).int_data);
+            squares = doubles ? ir_element(squares.get_number() + val * val)
+                              : ir_element(squares.get_integer() + value(i).int_data * value(i).int_data);
+
+            if (!low.is_number() || val < low.get_number()) {
+                low = value(i);
+            }
+
+            if (!high.is_number() || val > high.get_number()) {
+                high = value(i);
+            }
+        }
+
+        // Both start from an integer zero
+        if (doubles && length == 0) {
+            total = int64_t(0);
+            squares = int64_t(0);
+        }
+
+        const ir_element arr = make(length);
+
+        if (!check("sum", length, call("t_sum", { arr }), total) || !check("min", length, call("t_min", { arr }), low)
+            || !check("max", length, call("t_max", { arr }), high)
+            || !check("dot", length, call("t_dot", { arr, make(length) }), squares)) {
+            return false;
+        }
+
+        // Present at its first index or not at all
+        const ir_element sought = value(length / 2 + 3);
+        const ir_element missing = doubles ? ir_element(50.5) : ir_element(int64_t(100));
+        int64_t first = -1;
+        int64_t matches = 0;
+
+        for (size_t i = 0; i < length; i++) {
+            if (value(i).get_number() == sought.get_number()) {
+                first = (first < 0) ? static_cast<int64_t>(i) : first;
+                matches++;
+            }
+        }
+
+        if (!check("find", length, call("t_find", { arr, sought }), int64_t(first))
+            || !check("count", length, call("t_count", { arr, sought }), int64_t(matches))
+            || !check("find missing", length, call("t_find", { arr, missing }), int64_t(-1))) {
+            return false;
+        }
+
+        const ir_element step = doubles ? ir_element(1.5) : ir_element(int64_t(3));
+        call("t_add_scalar", { arr, step });
+
+        const auto added = [](const array_tester &tester, const size_t idx) {
+            const ir_element val = tester.value(idx);
+            return tester.doubles ? ir_element(val.num_data + 1.5) : ir_element(val.int_data + 3);
+        };
+
+        if (!check_elements("add_scalar", length, arr, storage, added)) {
+            return false;
+        }
+
+        // Shorter than the source, the rest is appended. Packed either way, a generic source goes one
+        // element at a time.
+        const ir_element src = make(length, 5);
+        const ir_element dst = make(length / 2, 0, true);
+
+        call("t_copy", { dst, src });
+
+        const auto shifted = [](const array_tester &tester, const size_t idx) {
+            return tester.value(idx + 5);
+        };
+
+        if (!check_elements("copy", length, dst, storage, shifted)) {
+            return false;
+        }
+
+        call("t_fill", { arr, step });
+
+        const auto filled = [](const array_tester &tester, const size_t) {
+            return tester.doubles ? ir_element(1.5) : ir_element(int64_t(3));
+        };
+
+        return check_elements("fill", length, arr, storage, filled);
+    }
+};
+
+int main() {
+    script_runner runner(test_script);
+
+    if (!runner.compiled()) {
+        return 1;
+    }
+
+    for (const bool doubles : { false, true }) {
+        for (const bool generic : { false, true }) {
+            array_tester tester(runner, doubles, generic);
+
+            for (size_t length = 0; length <= max_length; length++) {
+                if (!tester.run(length)) {
+                    return 1;
+                }
+            }
+        }
+    }
+
+    return 0;
+}
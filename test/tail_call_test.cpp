@@ -0,0 +1,73 @@
+#include "script_runner.h"
+
+#include <vector>
+
+const char *test_script = {
+    "fn count(n, acc):\n"
+    "    if n == 0:\n"
+    "        ret acc\n"
+    "    ret count(n - 1, acc + n)\n"
+    "\n"
+    "fn is_even(n):\n"
+    "    if n == 0:\n"
+    "        ret 1\n"
+    "    ret is_odd(n - 1)\n"
+    "\n"
+    "fn is_odd(n):\n"
+    "    if n == 0:\n"
+    "        ret 0\n"
+    "    ret is_even(n - 1)\n"
+    "\n"
+    "fn not_tail(n):\n"
+    "    if n == 0:\n"
+    "        ret 0\n"
+    "    var r = not_tail(n - 1)\n"
+    "    ret r + 1\n"
+    "\n"
+};
+
+// Far fewer frames than the calls go deep
+constexpr size_t frame_count = 8;
+
+static snack::ir::backend::ir_element run(script_runner &runner, const char *name,
+    std::vector<snack::ir::backend::ir_element> &&args) {
+    snack::ir::backend::ir_interpreter interpreter(runner.err_mngr, runner.manager,
+        snack::ir::backend::ir_default_value_stack_size, frame_count);
+
+    interpreter.call_from_host(runner.entry(name, args.size()), args);
+    interpreter.interpret_for(10000000);
+
+    return interpreter.take_result();
+}
+
+int main() {
+    script_runner runner(test_script);
+
+    if (!runner.compiled()) {
+        return 1;
+    }
+
+    // Every tail call takes over the frame of its caller
+    if (!expect_integer("count", run(runner, "count", { int64_t(100000), int64_t(0) }), 5000050000)) {
+        return 1;
+    }
+
+    if (!expect_integer("is_even", run(runner, "is_even", { int64_t(100001) }), 0)) {
+        return 1;
+    }
+
+    if (runner.err_mngr.get_total_error()) {
+        runner.err_mngr.dump_all_error();
+        return 1;
+    }
+
+    // Without tail calls, a hundred calls deep is already too deep
+    run(runner, "not_tail", { int64_t(100) });
+
+    if (!runner.err_mngr.get_total_error()) {
+        std::cout << "Calls that are not tail calls did not run out of frames" << std::endl;
+        return 1;
+    }
+
+    return 0;
+}